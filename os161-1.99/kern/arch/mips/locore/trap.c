@@ -117,29 +117,14 @@ kill_curthread(vaddr_t epc, unsigned code, vaddr_t vaddr)
   struct proc *p = curproc;
 
   
-  global_process_array[curproc->pid - 2]->exit_code = _MKWAIT_SIG(code);
-  global_process_array[curproc->pid - 2]->ex = 1;
-
-  unsigned int x = array_num(curproc->children);
-  int z;
-  lock_acquire(glb_arr_lck);
-  for(unsigned int i = 0; i < x; i++){
-      z = (int)array_get(curproc->children, i) - 2;
-      if(global_process_array[z]->ex == 1){
-        global_process_array[z]->ex = 0;
-        global_process_array[z]->proc_id = -1;
-        global_process_array[z]->exists = 0;
-      }
-  }
-  V(global_process_array[curproc->pid - 2]->sm);
-  lock_release(glb_arr_lck);
+  proc_info_exit(curproc, _MKWAIT_SIG(code));
   DEBUG(DB_SYSCALL,"Syscall: _exit(%d)\n",code);
 
   KASSERT(curproc->p_addrspace != NULL);
   as_deactivate();
   
   as = curproc_setas(NULL);
-  as_destroy(as);
+  curproc_putas(as);
 
 
   proc_remthread(curthread);
@@ -219,8 +204,21 @@ mips_trap(struct trapframe *tf)
 			doadjust = false;
 		}
 
+		/* Let hardclock() know what it interrupted. */
+		curcpu->c_irq_fromuser = !iskern;
+		curcpu->c_stats.sc_irqs++;
+
 		mainbus_interrupt(tf);
 
+		/*
+		 * If the interrupt woke a real-time thread (or was
+		 * IPI_RESCHED), switch to it now rather than at the
+		 * next hardclock.
+		 */
+		if (curcpu->c_rt_preempt) {
+			thread_yield();
+		}
+
 		if (doadjust) {
 			KASSERT(curthread->t_curspl == IPL_HIGH);
 			KASSERT(curthread->t_iplhigh_count == 1);
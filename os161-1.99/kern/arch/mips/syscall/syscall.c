@@ -31,7 +31,9 @@
 #include <kern/errno.h>
 #include <kern/syscall.h>
 #include <lib.h>
+#include <copyinout.h>
 #include <mips/trapframe.h>
+#include <cpu.h>
 #include <thread.h>
 #include <current.h>
 #include <syscall.h>
@@ -77,6 +79,18 @@
  * stack, starting at sp+16 to skip over the slots for the
  * registerized values, with copyin().
  */
+
+/*
+ * Fetch a 64-bit argument that follows three 32-bit ones, which ends
+ * up in the first stack slot pair.
+ */
+static
+int
+syscall_stackoff(struct trapframe *tf, off_t *ret)
+{
+	return copyin((const_userptr_t)(tf->tf_sp + 16), ret, sizeof(*ret));
+}
+
 void
 syscall(struct trapframe *tf)
 {
@@ -110,16 +124,217 @@ syscall(struct trapframe *tf)
 		err = sys___time((userptr_t)tf->tf_a0,
 				 (userptr_t)tf->tf_a1);
 		break;
+
+	    case SYS_nanosleep:
+		err = sys_nanosleep((const_userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1);
+		break;
+
+	    case SYS_schedstat:
+		err = sys_schedstat((int)tf->tf_a0,
+				    (userptr_t)tf->tf_a1,
+				    (size_t)tf->tf_a2,
+				    &retval);
+		break;
+
+	    case SYS_sched_setaffinity:
+		err = sys_sched_setaffinity((pid_t)tf->tf_a0,
+					    (uint32_t)tf->tf_a1);
+		break;
+
+	    case SYS_sched_getaffinity:
+		err = sys_sched_getaffinity((pid_t)tf->tf_a0,
+					    (userptr_t)tf->tf_a1);
+		break;
+
+	    case SYS_sched_setrt:
+		err = sys_sched_setrt((pid_t)tf->tf_a0,
+				      (const_userptr_t)tf->tf_a1);
+		break;
+
+	    case SYS_futex_wait:
+		err = sys_futex_wait((userptr_t)tf->tf_a0,
+				     (int)tf->tf_a1,
+				     (const_userptr_t)tf->tf_a2);
+		break;
+
+	    case SYS_futex_wake:
+		err = sys_futex_wake((userptr_t)tf->tf_a0,
+				     (int)tf->tf_a1,
+				     &retval);
+		break;
 #ifdef UW
 	case SYS_fork:
 	  err=sys_fork(tf, (pid_t *)&retval);
 	  break;
+	case SYS_open:
+	  err = sys_open((userptr_t)tf->tf_a0,
+			 (int)tf->tf_a1,
+			 (mode_t)tf->tf_a2,
+			 (int *)(&retval));
+	  break;
+	case SYS_read:
+	  err = sys_read((int)tf->tf_a0,
+			 (userptr_t)tf->tf_a1,
+			 (size_t)tf->tf_a2,
+			 (int *)(&retval));
+	  break;
 	case SYS_write:
 	  err = sys_write((int)tf->tf_a0,
+			  (userptr_t)tf->tf_a1,
+			  (size_t)tf->tf_a2,
+			  (int *)(&retval));
+	  break;
+	case SYS_pread:
+	case SYS_pwrite:
+	  {
+	    off_t pos;
+
+	    err = syscall_stackoff(tf, &pos);
+	    if (err) {
+	      break;
+	    }
+	    if (callno == SYS_pread) {
+	      err = sys_pread((int)tf->tf_a0,
+			      (userptr_t)tf->tf_a1,
+			      (size_t)tf->tf_a2,
+			      pos,
+			      (int *)(&retval));
+	    }
+	    else {
+	      err = sys_pwrite((int)tf->tf_a0,
+			       (userptr_t)tf->tf_a1,
+			       (size_t)tf->tf_a2,
+			       pos,
+			       (int *)(&retval));
+	    }
+	  }
+	  break;
+	case SYS_readv:
+	  err = sys_readv((int)tf->tf_a0,
 			  (userptr_t)tf->tf_a1,
 			  (int)tf->tf_a2,
 			  (int *)(&retval));
 	  break;
+	case SYS_writev:
+	  err = sys_writev((int)tf->tf_a0,
+			   (userptr_t)tf->tf_a1,
+			   (int)tf->tf_a2,
+			   (int *)(&retval));
+	  break;
+	case SYS_preadv:
+	case SYS_pwritev:
+	  {
+	    off_t pos;
+
+	    err = syscall_stackoff(tf, &pos);
+	    if (err) {
+	      break;
+	    }
+	    if (callno == SYS_preadv) {
+	      err = sys_preadv((int)tf->tf_a0,
+			       (userptr_t)tf->tf_a1,
+			       (int)tf->tf_a2,
+			       pos,
+			       (int *)(&retval));
+	    }
+	    else {
+	      err = sys_pwritev((int)tf->tf_a0,
+				(userptr_t)tf->tf_a1,
+				(int)tf->tf_a2,
+				pos,
+				(int *)(&retval));
+	    }
+	  }
+	  break;
+	case SYS_close:
+	  err = sys_close((int)tf->tf_a0);
+	  break;
+	case SYS_pipe:
+	  err = sys_pipe((userptr_t)tf->tf_a0);
+	  break;
+	case SYS_copy_file_range:
+	  {
+	    /* len and flags follow a0-a3 on the stack */
+	    uint32_t stackargs[2];
+
+	    err = copyin((const_userptr_t)(tf->tf_sp + 16),
+			 stackargs, sizeof(stackargs));
+	    if (err) {
+	      break;
+	    }
+	    err = sys_copy_file_range((int)tf->tf_a0,
+				      (userptr_t)tf->tf_a1,
+				      (int)tf->tf_a2,
+				      (userptr_t)tf->tf_a3,
+				      (size_t)stackargs[0],
+				      (unsigned)stackargs[1],
+				      (int *)(&retval));
+	  }
+	  break;
+	case SYS_sendfile:
+	  err = sys_sendfile((int)tf->tf_a0,
+			     (int)tf->tf_a1,
+			     (userptr_t)tf->tf_a2,
+			     (size_t)tf->tf_a3,
+			     (int *)(&retval));
+	  break;
+	case SYS_remove:
+	  err = sys_remove((userptr_t)tf->tf_a0);
+	  break;
+	case SYS_rename:
+	  err = sys_rename((userptr_t)tf->tf_a0,
+			   (userptr_t)tf->tf_a1);
+	  break;
+	case SYS_lseek:
+	  {
+	    /* pos is in a2/a3; whence is on the stack; the result
+	       goes back in v0 (high word) and v1 (low word) */
+	    off_t pos, newpos;
+	    int whence;
+
+	    pos = ((off_t)tf->tf_a2 << 32) | (uint32_t)tf->tf_a3;
+	    err = copyin((const_userptr_t)(tf->tf_sp + 16),
+			 &whence, sizeof(whence));
+	    if (err) {
+	      break;
+	    }
+	    err = sys_lseek((int)tf->tf_a0, pos, whence, &newpos);
+	    if (err == 0) {
+	      retval = (int32_t)(newpos >> 32);
+	      tf->tf_v1 = (uint32_t)newpos;
+	    }
+	  }
+	  break;
+	case SYS_dup2:
+	  err = sys_dup2((int)tf->tf_a0,
+			 (int)tf->tf_a1,
+			 (int *)(&retval));
+	  break;
+	case SYS_select:
+	  {
+	    /* the timeout follows a0-a3 on the stack */
+	    uint32_t timeout;
+
+	    err = copyin((const_userptr_t)(tf->tf_sp + 16),
+			 &timeout, sizeof(timeout));
+	    if (err) {
+	      break;
+	    }
+	    err = sys_select((int)tf->tf_a0,
+			     (userptr_t)tf->tf_a1,
+			     (userptr_t)tf->tf_a2,
+			     (userptr_t)tf->tf_a3,
+			     (userptr_t)timeout,
+			     (int *)(&retval));
+	  }
+	  break;
+	case SYS_poll:
+	  err = sys_poll((userptr_t)tf->tf_a0,
+			 (unsigned)tf->tf_a1,
+			 (int)tf->tf_a2,
+			 (int *)(&retval));
+	  break;
 	case SYS__exit:
 	  // kprintf("tf: %d\n", tf->tf_a0);
 	  sys__exit((int)tf->tf_a0);
@@ -136,9 +351,28 @@ syscall(struct trapframe *tf)
 			    (pid_t *)&retval);
 	  // kprintf("%d\n", retval);
 	  	break;
+	case SYS_wait4:
+	  err = sys_wait4((pid_t)tf->tf_a0,
+			  (userptr_t)tf->tf_a1,
+			  (int)tf->tf_a2,
+			  (userptr_t)tf->tf_a3,
+			  (pid_t *)&retval);
+	  break;
+	case SYS_getrusage:
+	  err = sys_getrusage((int)tf->tf_a0,
+			      (userptr_t)tf->tf_a1);
+	  break;
 	case SYS_execv:
-		err = sys_execv((char *)tf->tf_a0,
-						(char **)tf->tf_a1);
+		err = sys_execv((userptr_t)tf->tf_a0,
+				(userptr_t)tf->tf_a1);
+		break;
+	case SYS_vfork:
+		err = sys_vfork(tf, (pid_t *)&retval);
+		break;
+	case SYS_spawn:
+		err = sys_spawn((userptr_t)tf->tf_a0,
+				(userptr_t)tf->tf_a1,
+				(pid_t *)&retval);
 		break;
 #endif // UW
 
@@ -177,6 +411,11 @@ syscall(struct trapframe *tf)
 	KASSERT(curthread->t_curspl == 0);
 	/* ...or leak any spinlocks */
 	KASSERT(curthread->t_iplhigh_count == 0);
+
+	/* If the call woke a real-time thread, let it run now. */
+	if (curcpu->c_rt_preempt) {
+		thread_yield();
+	}
 }
 
 /*
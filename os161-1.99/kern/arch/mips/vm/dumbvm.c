@@ -258,6 +258,10 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	/* make sure it's page-aligned */
 	KASSERT((paddr & PAGE_FRAME) == paddr);
 
+	/* Every page is resident, so this is only ever a TLB reload. */
+	curproc->p_usage.pu_vmstats[VMSTAT_TLB_FAULT]++;
+	curproc->p_usage.pu_vmstats[VMSTAT_TLB_RELOAD]++;
+
 	/* Disable interrupts on this CPU while frobbing the TLB. */
 	spl = splhigh();
 
@@ -266,6 +270,7 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		if (elo & TLBLO_VALID) {
 			continue;
 		}
+		curproc->p_usage.pu_vmstats[VMSTAT_TLB_FAULT_FREE]++;
 		ehi = faultaddress;
 		elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
 		if(ehi >= vbase1 && ehi <= vtop1){
@@ -278,6 +283,7 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		splx(spl);
 		return 0;
 	}
+	curproc->p_usage.pu_vmstats[VMSTAT_TLB_FAULT_REPLACE]++;
 	ehi = faultaddress;
 	elo = paddr | TLBLO_DIRTY | TLBLO_VALID;
 	if(ehi >= vbase1 && ehi <= vtop1){
@@ -352,6 +358,8 @@ as_activate(void)
 	}
 
 	splx(spl);
+
+	curproc->p_usage.pu_vmstats[VMSTAT_TLB_INVALIDATE]++;
 }
 
 void
@@ -459,6 +467,39 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+int
+as_translate(struct addrspace *as, vaddr_t vaddr, bool write, paddr_t *ret)
+{
+	vaddr_t page, vtop1, vtop2, stackbase;
+	paddr_t paddr;
+
+	page = vaddr & PAGE_FRAME;
+	vtop1 = as->as_vbase1 + as->as_npages1 * PAGE_SIZE;
+	vtop2 = as->as_vbase2 + as->as_npages2 * PAGE_SIZE;
+	stackbase = USERSTACK - DUMBVM_STACKPAGES * PAGE_SIZE;
+
+	if (page >= as->as_vbase1 && page < vtop1) {
+		/* Text is read-only once loaded, as in vm_fault. */
+		if (write && as->elf_done) {
+			return EFAULT;
+		}
+		paddr = as->text_table[(page - as->as_vbase1) / PAGE_SIZE].phys_addr;
+	}
+	else if (page >= as->as_vbase2 && page < vtop2) {
+		paddr = as->data_table[(page - as->as_vbase2) / PAGE_SIZE].phys_addr;
+	}
+	else if (page >= stackbase && page < USERSTACK) {
+		paddr = as->stack_table[(page - stackbase) / PAGE_SIZE].phys_addr;
+	}
+	else {
+		return EFAULT;
+	}
+
+	/* Every page is resident. */
+	*ret = paddr + (vaddr - page);
+	return 0;
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
@@ -479,11 +479,21 @@ emufs_reclaim(struct vnode *v)
 	vfs_biglock_acquire();
 	lock_acquire(ef->ef_emu->e_lock);
 
+	/*
+	 * Someone may have picked up the vnode since VOP_DECREF
+	 * decided to reclaim it; if so, consume the reference it gave
+	 * us and leave the vnode alone.
+	 */
+	spinlock_acquire(&ev->ev_v.vn_countlock);
 	if (ev->ev_v.vn_refcount != 1) {
+		KASSERT(ev->ev_v.vn_refcount > 1);
+		ev->ev_v.vn_refcount--;
+		spinlock_release(&ev->ev_v.vn_countlock);
 		lock_release(ef->ef_emu->e_lock);
 		vfs_biglock_release();
 		return EBUSY;
 	}
+	spinlock_release(&ev->ev_v.vn_countlock);
 
 	/* emu_close retries on I/O error */
 	result = emu_close(ev->ev_emu, ev->ev_handle);
@@ -1088,6 +1098,7 @@ static const struct vnode_ops emufs_fileops = {
 	emufs_stat,
 	emufs_file_gettype,
 	emufs_tryseek,
+	vnode_poll_ready,
 	emufs_fsync,
 	emufs_mmap,
 	emufs_truncate,
@@ -1123,6 +1134,7 @@ static const struct vnode_ops emufs_dirops = {
 	emufs_stat,
 	emufs_dir_gettype,
 	emufs_dir_tryseek,
+	vnode_poll_ready,
 	emufs_void_op_isdir,  /* fsync */
 	emufs_void_op_isdir,  /* mmap */
 	emufs_truncate_isdir,
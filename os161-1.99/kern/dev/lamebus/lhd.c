@@ -300,12 +300,18 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 		lh->lh_clear = NULL;
 		return ENOMEM;
 	}
+	/*
+	 * V is called from the interrupt handler, which can't switch,
+	 * but this still puts the waiting thread first in line.
+	 */
+	sem_sethandoff(lh->lh_done, true);
 
 	/* Set up the VFS device structure. */
 	lh->lh_dev.d_open = lhd_open;
 	lh->lh_dev.d_close = lhd_close;
 	lh->lh_dev.d_io = lhd_io;
 	lh->lh_dev.d_ioctl = lhd_ioctl;
+	lh->lh_dev.d_poll = NULL;
 	lh->lh_dev.d_blocks = bus_read_register(lh->lh_busdata, lh->lh_buspos,
 						LHD_REG_NSECT);
 	lh->lh_dev.d_blocksize = LHD_SECTSIZE;
@@ -99,6 +99,12 @@ struct addrspace {
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
+ *
+ *    as_translate - find the physical address that user address VADDR
+ *                maps to in AS, which need not be the current address
+ *                space. Fails with EFAULT if VADDR is not mapped, or,
+ *                if WRITE, not writeable. Lets the kernel move data
+ *                straight into another process's memory.
  */
 
 struct addrspace *as_create(void);
@@ -115,6 +121,8 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_translate(struct addrspace *as, vaddr_t vaddr,
+                               bool write, paddr_t *ret);
 
 
 /*
@@ -38,8 +38,8 @@
  * hardclock() is called on every CPU HZ times a second, possibly only
  * when the CPU is not idle, for scheduling.
  *
- * timerclock() is called on one CPU once a second to allow simple
- * timed operations. (This is a fairly simpleminded interface.)
+ * timerclock() is called on one CPU once a second. Timed operations
+ * should use callouts (below) instead.
  *
  * gettime() may be used to fetch the current time of day.
  * getinterval() computes the time from time1 to time2.
@@ -63,14 +63,64 @@ void timerclock(void);
 
 void gettime(time_t *seconds, uint32_t *nanoseconds);
 
+/*
+ * gettime_ns() returns the current time as a single count of
+ * nanoseconds, for timing short intervals. It returns 0 if no clock
+ * device has been attached yet, so it is safe to call early in boot.
+ */
+uint64_t gettime_ns(void);
+
 void getinterval(time_t secs1, uint32_t nsecs,
                  time_t secs2, uint32_t nsecs2,
                  time_t *rsecs, uint32_t *rnsecs);
 
 /*
- * clocksleep() suspends execution for the requested number of seconds,
- * like userlevel sleep(3). (Don't confuse it with wchan_sleep.)
+ * Callouts: functions to be called a given number of hardclock ticks
+ * in the future.
+ *
+ * Callouts are kept in a hierarchical timing wheel that is advanced
+ * once per tick by CPU 0's hardclock(), so scheduling and cancelling
+ * are O(1) and each tick only touches the callouts that are due (plus
+ * an occasional cascade of a coarser slot). The function is called
+ * from interrupt context on CPU 0 and must not sleep.
+ *
+ * The structure is public so callouts can be embedded in other
+ * structures or live on the stack; use only the functions below to
+ * touch it.
+ *
+ * callout_init     Set up a callout that will call FUNC(ARG).
+ * callout_schedule Arrange for the function to be called once TICKS
+ *                  (at least 1) whole ticks have passed, that is, at
+ *                  the TICKS+1'th hardclock from now; if already
+ *                  scheduled, it is rescheduled. Delays beyond
+ *                  CALLOUT_MAXTICKS are clamped to it.
+ * callout_stop     Cancel. Returns true if the callout was pending
+ *                  (and now will not run), false if it was not
+ *                  scheduled or has already been dispatched.
+ */
+struct callout {
+	struct callout *co_next;	/* Link in wheel slot */
+	struct callout **co_prevp;	/* Pointer to whatever points to us */
+	unsigned co_expire;		/* Tick at which to fire */
+	void (*co_func)(void *);	/* Function to call */
+	void *co_arg;			/* Argument to pass */
+};
+
+#define CALLOUT_WHEELBITS	6
+#define CALLOUT_WHEELLEVELS	4
+#define CALLOUT_MAXTICKS \
+	((1U << (CALLOUT_WHEELBITS * CALLOUT_WHEELLEVELS)) - 1)
+
+void callout_init(struct callout *co, void (*func)(void *), void *arg);
+void callout_schedule(struct callout *co, unsigned ticks);
+bool callout_stop(struct callout *co);
+
+/*
+ * clock_sleepticks() suspends the current thread for at least the requested
+ * number of hardclock ticks. clocksleep() does the same in seconds,
+ * like userlevel sleep(3). (Don't confuse these with wchan_sleep.)
  */
+void clock_sleepticks(unsigned ticks);
 void clocksleep(int seconds);
 
 
@@ -33,6 +33,7 @@
 
 #include <spinlock.h>
 #include <threadlist.h>
+#include <kern/schedstat.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
 
@@ -59,16 +60,34 @@ struct cpu {
 	 */
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
+	struct threadlist c_threadcache; /* Exited threads kept for reuse */
+	struct thread *c_handoff;	/* Thread leaving for another cpu */
+	struct thread *c_idlethread;	/* Runs when c_handoff must go */
+	struct thread *c_yieldto;	/* Thread to run next; see thread.c */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	uint32_t c_steal_seed;		/* State for picking steal victims */
+	unsigned c_steals;		/* Threads stolen from other cpus */
+	unsigned c_steal_misses;	/* Idle passes that found nothing */
+	bool c_irq_fromuser;		/* Current interrupt hit user mode */
+	struct schedstat_cpu c_stats;	/* Scheduler statistics */
+	unsigned c_rcu_gpseen;		/* Last RCU grace period noted */
 
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the runqueue lock.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
+	bool c_rt_preempt;		/* Earlier deadline is queued */
 	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	struct threadlist c_rtqueue;	/* Real-time threads, by deadline */
+	struct threadlist c_rtthrottled; /* Real-time threads out of budget */
 	struct spinlock c_runqueue_lock;
 
+	/*
+	 * Protected by the real-time admission lock in thread.c.
+	 */
+	unsigned c_rt_util;		/* Real-time bandwidth reserved */
+
 	/*
 	 * Accessed by other cpus.
 	 * Protected by the IPI lock.
@@ -162,6 +181,7 @@ void cpu_halt(void);
 #define IPI_OFFLINE		1	/* CPU is requested to go offline */
 #define IPI_UNIDLE		2	/* Runnable threads are available */
 #define IPI_TLBSHOOTDOWN	3	/* MMU mapping(s) need invalidation */
+#define IPI_RESCHED		4	/* Real-time thread should preempt */
 
 void ipi_send(struct cpu *target, int code);
 void ipi_broadcast(int code);
@@ -36,16 +36,21 @@
 
 
 struct uio;  /* in <uio.h> */
+struct pollent;  /* in <poll.h> */
 
 /*
  * Filesystem-namespace-accessible device.
  * d_io is for both reads and writes; the uio indicates the direction.
+ * d_poll is optional: devices that never block leave it NULL. Those
+ * that do implement it as for vop_poll (see vnode.h).
  */
 struct device {
 	int (*d_open)(struct device *, int flags_from_open);
 	int (*d_close)(struct device *);
 	int (*d_io)(struct device *, struct uio *);
 	int (*d_ioctl)(struct device *, int op, userptr_t data);
+	int (*d_poll)(struct device *, int events, struct pollent *pe,
+		      int *revents);
 
 	blkcnt_t d_blocks;
 	blksize_t d_blocksize;
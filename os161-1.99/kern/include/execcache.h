@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _EXECCACHE_H_
+#define _EXECCACHE_H_
+
+/*
+ * Executable image cache.
+ *
+ * Keeps the parsed ELF headers and the file contents of each loadable
+ * segment for recently run programs, so that running the same program
+ * again loads it from memory instead of reading and parsing the file.
+ * Images are keyed by vnode (vn_execimage points at a file's image),
+ * hold a reference to it, and are dropped when the file is written or
+ * truncated, when its filesystem is unmounted, or to make room, least
+ * recently used first. See syscall/loadelf.c and syscall/execcache.c.
+ */
+
+struct vnode;
+struct fs;
+
+/* Most loadable segments an image can have. */
+#define EXECIMAGE_MAXSEGS	4
+
+/* Limits on what the cache keeps. */
+#define EXECCACHE_MAXIMAGES	16
+#define EXECCACHE_MAXBYTES	(512*1024)
+
+struct execseg {
+	vaddr_t es_vaddr;		/* Where it goes */
+	size_t es_memsize;		/* Size in memory */
+	size_t es_filesize;		/* Size of es_data */
+	uint32_t es_flags;		/* PF_R, PF_W, PF_X */
+	void *es_data;			/* Contents from the file */
+};
+
+struct execimage {
+	struct vnode *ei_vnode;		/* File it was read from */
+	vaddr_t ei_entrypoint;
+	unsigned ei_nsegs;
+	struct execseg ei_segs[EXECIMAGE_MAXSEGS];
+	size_t ei_bytes;		/* Total of es_filesize */
+	unsigned ei_refcount;		/* Users, counting the cache */
+	struct execimage *ei_next;	/* LRU list, newest first */
+	struct execimage *ei_prev;
+};
+
+/*
+ * Cache operations.
+ *
+ * execcache_bootstrap  Set up at boot.
+ * execimage_create     Make an empty image for V, with one reference.
+ * execcache_get        Look up V; returns its image with a reference
+ *                      added, or NULL. *GEN is set to a token to pass
+ *                      to execcache_put if the image has to be read.
+ * execcache_put        Offer image EI, just read from its file, to the
+ *                      cache. Dropped if the file was written since
+ *                      execcache_get handed out GEN.
+ * execimage_release    Drop a reference; the last one frees the image.
+ * execcache_invalidate Forget V's image, if any; V has been modified.
+ * execcache_flush      Forget all images from FS (all images if NULL).
+ * execcache_printstats Print hit rates.
+ */
+void execcache_bootstrap(void);
+struct execimage *execimage_create(struct vnode *v);
+struct execimage *execcache_get(struct vnode *v, unsigned *gen);
+void execcache_put(struct execimage *ei, unsigned gen);
+void execimage_release(struct execimage *ei);
+void execcache_invalidate(struct vnode *v);
+void execcache_flush(struct fs *fs);
+void execcache_printstats(void);
+
+#endif /* _EXECCACHE_H_ */
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _FILE_H_
+#define _FILE_H_
+
+/*
+ * Open files and file descriptor tables.
+ *
+ * An openfile is what open() creates: a vnode plus the access mode
+ * and the seek position. It is reference counted, and shared by
+ * every descriptor that refers to it, whether through dup2 or
+ * because the descriptor was inherited across fork. Each openfile
+ * has its own sleep lock for the seek position, held across the I/O
+ * that uses it, so I/O through one open file never waits for another.
+ *
+ * A filetable maps a process's descriptors to openfiles. Changes to
+ * it are serialized by ft_lock. Lookups take no lock at all: the
+ * slots are read under RCU, and openfiles are freed only after a
+ * grace period, so a lookup can safely try to take a reference to
+ * an openfile even as it is being closed, and simply fails if it
+ * lost the race.
+ */
+
+#include <limits.h>
+#include <spinlock.h>
+#include <rcu.h>
+
+struct vnode;
+struct lock;
+
+struct openfile {
+	struct vnode *of_vnode;
+	int of_flags;			/* Open flags (O_ACCMODE, O_APPEND) */
+	struct lock *of_lock;		/* Protects of_offset */
+	off_t of_offset;		/* Seek position */
+	struct spinlock of_reflock;	/* Protects of_refcount */
+	unsigned of_refcount;
+	struct rcu_head of_rcu;
+};
+
+struct filetable {
+	struct lock *ft_lock;		/* Serializes changes */
+	struct openfile *ft_files[OPEN_MAX];
+};
+
+/*
+ * Open file operations.
+ *
+ * openfile_open     vfs_open PATH and make an openfile for it, with
+ *                   one reference. May destroy PATH.
+ * openfile_create   Make an openfile, with one reference, for VN,
+ *                   which is already open (as by vfs_open). The
+ *                   openfile takes over the open on success; on
+ *                   failure it is still the caller's to vfs_close.
+ * openfile_incref   Add a reference.
+ * openfile_decref   Drop a reference; the last one closes the file.
+ */
+int openfile_open(char *path, int flags, mode_t mode, struct openfile **ret);
+int openfile_create(struct vnode *vn, int flags, struct openfile **ret);
+void openfile_incref(struct openfile *of);
+void openfile_decref(struct openfile *of);
+
+/*
+ * File table operations.
+ *
+ * filetable_create   Make an empty table.
+ * filetable_copy     Make a table sharing all of FT's open files.
+ * filetable_destroy  Close everything in FT and free it.
+ * filetable_get      Look up FD; returns the open file with a
+ *                    reference added, or fails with EBADF.
+ * filetable_add      Put OF in the lowest free descriptor, taking
+ *                    over the caller's reference, and return that
+ *                    descriptor. Fails with EMFILE if there is none.
+ * filetable_set      Put OF in descriptor FD, taking over the
+ *                    caller's reference. Whatever was there before is
+ *                    handed back in *OLDOF (NULL if nothing) for the
+ *                    caller to drop.
+ * filetable_remove   Take FD out of the table and hand back its open
+ *                    file in *RET, reference and all. EBADF if unused.
+ */
+struct filetable *filetable_create(void);
+int filetable_copy(struct filetable *ft, struct filetable **ret);
+void filetable_destroy(struct filetable *ft);
+int filetable_get(struct filetable *ft, int fd, struct openfile **ret);
+int filetable_add(struct filetable *ft, struct openfile *of, int *fd);
+int filetable_set(struct filetable *ft, int fd, struct openfile *of,
+		  struct openfile **oldof);
+int filetable_remove(struct filetable *ft, int fd, struct openfile **ret);
+
+#endif /* _FILE_H_ */
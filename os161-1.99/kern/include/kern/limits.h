@@ -65,11 +65,11 @@
 /* Min value for a process ID (that can be assigned to a user process) */
 #define __PID_MIN       2
 
-/* Max value for a process ID */
-#define __PID_MAX       512
+/* Max value for a process ID (the kernel's table grows on demand) */
+#define __PID_MAX       32767
 
 /* Max bytes for atomic pipe I/O -- see description in the pipe() man page */
-#define __PIPE_BUF      512
+#define __PIPE_BUF      4096
 
 
 /*
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _KERN_SCHEDSTAT_H_
+#define _KERN_SCHEDSTAT_H_
+
+/*
+ * Scheduler statistics, as returned by schedstat().
+ *
+ * All counts are since boot (or since the owning thread was created)
+ * and wrap silently.
+ */
+
+/*
+ * Runnable-to-running latency histogram. Bucket 0 counts latencies
+ * under 1 microsecond; bucket i (i > 0) counts latencies of at least
+ * 2^(i-1) and less than 2^i microseconds; the last bucket also
+ * collects everything longer.
+ */
+#define SCHEDSTAT_NBUCKETS	20
+
+/* Special "which" value for schedstat(): the calling thread. */
+#define SCHEDSTAT_SELF		(-1)
+
+/* Per-CPU statistics. */
+struct schedstat_cpu {
+	__u32 sc_ticks_user;		/* hardclocks that hit user mode */
+	__u32 sc_ticks_sys;		/* hardclocks that hit kernel mode */
+	__u32 sc_ticks_idle;		/* hardclocks that hit the idle loop */
+	__u32 sc_irqs;			/* interrupts taken */
+	__u32 sc_switches;		/* context switches */
+	__u32 sc_migrations;		/* threads moved onto this cpu */
+	__u32 sc_rqlen_sum;		/* run queue length, summed per tick */
+	__u32 sc_latency[SCHEDSTAT_NBUCKETS];
+	__u32 sc_rt_util;		/* real-time share reserved, per mille */
+	__u32 sc_rt_misses;		/* real-time deadlines missed */
+	__u32 sc_rt_throttles;		/* real-time budgets exhausted */
+};
+
+/* Per-thread statistics. */
+struct schedstat_thread {
+	__u32 st_runs;			/* times the thread was switched to */
+	__u32 st_latency[SCHEDSTAT_NBUCKETS];
+	__u32 st_rt_misses;		/* real-time deadlines missed */
+	__u32 st_rt_throttles;		/* real-time budgets exhausted */
+};
+
+#endif /* _KERN_SCHEDSTAT_H_ */
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _LOCKSTAT_H_
+#define _LOCKSTAT_H_
+
+/*
+ * Lock contention statistics.
+ *
+ * Compiled in only with "options lockstat". Statistics are kept per
+ * name and kind, so all locks created with the same name (e.g. every
+ * vnode's lock) add up in one record. Sleep locks and semaphores use
+ * the name they were created with; spinlocks have no name and are
+ * tracked only once given one with spinlock_setname.
+ *
+ * Times come from the realtime clock (gettime_ns), so nothing is
+ * timed before the clock attaches.
+ */
+
+#include "opt-lockstat.h"
+
+/* Kinds of lock. */
+#define LOCKSTAT_SPINLOCK	0
+#define LOCKSTAT_LOCK		1
+#define LOCKSTAT_SEM		2
+
+struct lockstat {
+	const char *ls_name;
+	unsigned ls_kind;
+	volatile spinlock_data_t ls_busy; /* protects the counters */
+	uint32_t ls_acquires;		/* acquisitions */
+	uint32_t ls_contended;		/* ...that had to wait */
+	uint64_t ls_wait_ns;		/* total time waited */
+	uint64_t ls_maxwait_ns;		/* longest wait */
+	uint64_t ls_hold_ns;		/* total time held (not for sems) */
+	uint64_t ls_maxhold_ns;		/* longest hold */
+	struct lockstat *ls_next;	/* list of all records */
+};
+
+#if OPT_LOCKSTAT
+
+/*
+ * Find or create the record for NAME and KIND. Returns NULL if out
+ * of memory, in which case the lock just isn't tracked.
+ */
+struct lockstat *lockstat_get(const char *name, unsigned kind);
+
+/* Current time, for the calls below; 0 if there's no clock yet. */
+uint64_t lockstat_now(void);
+
+/*
+ * Record an acquisition. WAITSTART is when the acquirer first found
+ * the lock busy, or 0 if it didn't. NOW is the time of acquisition.
+ */
+void lockstat_acquired(struct lockstat *ls, uint64_t waitstart, uint64_t now);
+
+/* Record a release of a lock acquired at time ACQUIRED. */
+void lockstat_released(struct lockstat *ls, uint64_t acquired);
+
+/* Print the TOPN most contended records. */
+void lockstat_print(unsigned topn);
+
+/* Zero all statistics. */
+void lockstat_reset(void);
+
+#endif /* OPT_LOCKSTAT */
+
+#endif /* _LOCKSTAT_H_ */
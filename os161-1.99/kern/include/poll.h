@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _POLL_H_
+#define _POLL_H_
+
+/*
+ * Readiness notification, for poll() and select().
+ *
+ * Anything that can block - the console, pipes - keeps a pollq, a
+ * list of the pollers currently waiting for it, and calls
+ * pollq_wakeup whenever it might have become ready. Its vop_poll
+ * (see vnode.h) adds the poller's pollent to the pollq, if given
+ * one, before checking whether it is ready, so a change that
+ * happens after the check is sure to be seen.
+ *
+ * The pollent belongs to the poller, which takes it off the queue
+ * again when done. It keeps a reference to the object while its
+ * pollent is queued, so the queue does not go away under it.
+ *
+ * pollq_wakeup may be called from interrupt handlers.
+ */
+
+#include <spinlock.h>
+
+struct pollwaiter;	/* Private to the poll code */
+
+struct pollent {
+	struct pollent *pe_next;	/* Link in pollq */
+	struct pollent **pe_prevp;	/* Pointer to whatever points to us */
+	struct pollq *pe_q;		/* Queue we are on, or NULL */
+	struct pollwaiter *pe_waiter;	/* Whom to wake */
+};
+
+struct pollq {
+	struct spinlock pq_lock;
+	struct pollent *pq_ents;
+};
+
+void pollq_init(struct pollq *pq);
+void pollq_cleanup(struct pollq *pq);
+void pollq_add(struct pollq *pq, struct pollent *pe);
+void pollq_wakeup(struct pollq *pq);
+
+/* Set up the wait channels pollers sleep on. */
+void poll_bootstrap(void);
+
+#endif /* _POLL_H_ */
@@ -39,16 +39,47 @@
 #include <spinlock.h>
 #include <thread.h> /* required for struct threadarray */
 #include <limits.h>
+#include <kern/time.h>
+#include <kern/resource.h>
+#include <uw-vmstats.h>
+#include <rcu.h>
 
 
 struct addrspace;
 struct vnode;
+struct filetable;
 struct proc_info;
+struct proc_waitq;
 #ifdef UW
 struct semaphore;
 #endif // UW
-extern struct proc_info **global_process_array;
-struct lock * glb_arr_lck;
+struct lock;
+/*
+ * Serializes changes to the process table (see proc_info below).
+ * Lookups don't take it; they read inside an RCU read section
+ * instead (see rcu.h).
+ */
+extern struct lock *glb_arr_lck;
+
+/*
+ * Resource usage counters. Each process charges its own as it runs:
+ * hardclock charges ticks, the VM system faults (counted by
+ * uw-vmstats category), thread_switch context switches, and the I/O
+ * system calls bytes moved. User processes have a single thread, and
+ * only it touches them (hardclock runs on its stack), so they need no
+ * lock; kproc, whose threads run concurrently, is not charged.
+ * proc_usage_get converts them to a struct rusage.
+ */
+struct proc_usage {
+	unsigned pu_uticks;		/* Hardclocks in user mode */
+	unsigned pu_sticks;		/* Hardclocks in the kernel */
+	unsigned pu_vmstats[VMSTAT_COUNT]; /* VM events, as uw-vmstats */
+	unsigned pu_nvcsw;		/* Switches away while blocking */
+	unsigned pu_nivcsw;		/* Switches away while runnable */
+	uint64_t pu_inbytes;		/* Bytes read */
+	uint64_t pu_outbytes;		/* Bytes written */
+};
+
 /*
  * Process structure.
  */
@@ -56,33 +87,63 @@ struct proc {
 	char *p_name;			/* Name of this process */
 	struct spinlock p_lock;		/* Lock for this structure */
 	struct threadarray p_threads;	/* Threads in this process */
-	struct array *children;
+	struct proc_info *p_info;	/* Process table entry */
+	struct proc_waitq *p_waitq;	/* Where children report exit */
+	struct proc_usage p_usage;	/* Resources used */
+	struct proc_usage p_cusage;	/* Used by reaped descendants */
 	int parent_pid;
 	int pid;
 	/* VM */
 	struct addrspace *p_addrspace;	/* virtual address space */
+	struct semaphore *p_vfork;	/* Set while borrowing parent's space */
 	/* VFS */
 	struct vnode *p_cwd;		/* current working directory */
-
-#ifdef UW
-  /* a vnode to refer to the console device */
-  /* this is a quick-and-dirty way to get console writes working */
-  /* you will probably need to change this when implementing file-related
-     system calls, since each process will need to keep track of all files
-     it has opened, not just the console. */
-  struct vnode *console;                /* a vnode for the console device */
-#endif
+	struct filetable *p_files;	/* open file descriptors */
 
 	/* add more material here as needed */
 };
 
+/*
+ * Process table entry, one per PID in use. Created when the PID is
+ * allocated, and released when the parent collects the exit status,
+ * or when the process exits if there is no parent to do so.
+ * Released entries are freed after an RCU grace period, so
+ * proc_info_get results stay valid through the read section; the
+ * parent may keep using its child's entry after that, as only it can
+ * release it while both are alive.
+ *
+ * pi_parent is the parent's wait queue (NULL if there is none) and
+ * never changes; ex, exit_code, pi_usage and the zombie links are
+ * protected by its wq_lock.
+ */
 struct proc_info{
+	struct rcu_head pi_rcu;
 	int proc_id;
-	struct proc * parent_proc;
+	struct proc_waitq *pi_parent;
 	int exit_code;
 	int ex; /* is_exited */
-	int exists;
-	struct semaphore * sm;
+	struct proc_info *pi_znext;	/* Link in parent's zombie queue */
+	struct proc_info *pi_zprev;
+	struct proc_usage pi_usage;	/* Usage (self and reaped), once exited */
+};
+
+/*
+ * Where a process's children report their exit, and where it waits
+ * for them. Kept apart from struct proc so that children can still
+ * get at it after the parent has gone; it is freed once the parent
+ * has exited and no unreaped child remains.
+ *
+ * Exited children are queued on wq_zombies, oldest first, so wait
+ * for any child finds one at once. wq_children counts children not
+ * yet reaped, exited or not.
+ */
+struct proc_waitq {
+	struct lock *wq_lock;
+	struct cv *wq_cv;		/* Signalled when a child exits */
+	struct proc_info *wq_zombies;	/* Exited children */
+	struct proc_info *wq_zombtail;
+	unsigned wq_children;		/* Children not yet reaped */
+	bool wq_parentgone;		/* Parent has exited */
 };
 /* This is the process structure for the kernel and for kernel-only threads. */
 extern struct proc *kproc;
@@ -101,6 +162,35 @@ struct proc *proc_create_runprogram(const char *name);
 /* Destroy a process. */
 void proc_destroy(struct proc *proc);
 
+/*
+ * Process table operations.
+ *
+ * proc_info_get     Look up PID. Call in an RCU read section or with
+ *                   glb_arr_lck held. Returns NULL if PID is not in use.
+ * proc_info_release Free PID and its entry. Call with glb_arr_lck held.
+ * proc_info_exit    Record that P exited with EXITCODE (as encoded by
+ *                   _MKWAIT_*), and let go of its children.
+ * proc_wait         Reap a child of the current process: PID, or any
+ *                   child if PID is WAIT_ANY. OPTIONS may include
+ *                   WNOHANG. Hands back the child's PID (0 if WNOHANG
+ *                   and no child has exited yet), its exit status, and
+ *                   its resource usage if RUSAGE is not NULL.
+ */
+struct proc_info *proc_info_get(pid_t pid);
+void proc_info_release(struct proc_info *pi);
+void proc_info_exit(struct proc *p, int exitcode);
+int proc_wait(pid_t pid, int options, int *status, struct rusage *rusage,
+	      pid_t *ret);
+
+/*
+ * Resource usage.
+ *
+ * proc_usage_add   Add the counts in FROM to TO.
+ * proc_usage_get   Convert PU to a struct rusage.
+ */
+void proc_usage_add(struct proc_usage *to, const struct proc_usage *from);
+void proc_usage_get(const struct proc_usage *pu, struct rusage *ru);
+
 /* Attach a thread to a process. Must not already have a process. */
 int proc_addthread(struct proc *proc, struct thread *t);
 
@@ -113,5 +203,12 @@ struct addrspace *curproc_getas(void);
 /* Change the address space of the current process, and return the old one. */
 struct addrspace *curproc_setas(struct addrspace *);
 
+/*
+ * Dispose of an address space the current process no longer uses:
+ * destroy it, or if it was borrowed from the parent by vfork, give
+ * it back and let the parent run again.
+ */
+void curproc_putas(struct addrspace *);
+
 
 #endif /* _PROC_H_ */
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _RCU_H_
+#define _RCU_H_
+
+/*
+ * Read-copy-update.
+ *
+ * For tables that are read far more often than they are changed.
+ * Readers bracket their lookups with rcu_read_lock/rcu_read_unlock
+ * and take no locks at all; they must not sleep inside, and the
+ * thread is not preempted while inside. Writers, serialized among
+ * themselves by some ordinary lock, never change an object a reader
+ * may be looking at: they build a new version, publish it with a
+ * single pointer store, and hand the old one to call_rcu, which runs
+ * its function once every reader that might still see it is done.
+ *
+ * "Done" is tracked with grace periods. A grace period ends once
+ * every cpu that was busy when it began has passed a quiescent state:
+ * a context switch, a clock tick outside a read section, or going
+ * idle. The scheduler and hardclock report these by calling
+ * rcu_quiescent. Memory on System/161 is sequentially consistent,
+ * so publishing needs no barriers.
+ *
+ * rcu_read_lock     Begin a read section. Nests.
+ * rcu_read_unlock   End a read section.
+ * call_rcu          Arrange for FUNC(ARG) to be called, in thread
+ *                   context, after a grace period. RH is storage for
+ *                   the request, usually embedded in the object.
+ * synchronize_rcu   Wait for a grace period. May sleep.
+ * rcu_quiescent     Report a quiescent state on this cpu.
+ *
+ * rcu_bootstrap sets up the wait channel and is called early, before
+ * anything can call call_rcu; rcu_start starts the thread that runs
+ * the callbacks, once the system is up enough to run threads.
+ */
+
+struct rcu_head {
+	struct rcu_head *rh_next;	/* Link in list of callbacks */
+	unsigned rh_gp;			/* Grace period to wait for */
+	void (*rh_func)(void *);	/* Function to call */
+	void *rh_arg;			/* Argument to pass */
+};
+
+void rcu_bootstrap(void);
+void rcu_start(void);
+
+void rcu_read_lock(void);
+void rcu_read_unlock(void);
+
+void call_rcu(struct rcu_head *rh, void (*func)(void *), void *arg);
+void synchronize_rcu(void);
+
+void rcu_quiescent(void);
+
+#endif /* _RCU_H_ */
@@ -48,11 +48,42 @@
  */
 #include <kern/sfs.h>
 
+/*
+ * Locking.
+ *
+ * Each vnode has a sleep lock, sv_lock, that protects its in-memory
+ * inode (sv_i, sv_dirty) and the file's data and indirect blocks.
+ * The table of loaded vnodes is protected by sfs_vnlock, and the free
+ * block bitmap and the superblock by sfs_freemaplock. The vnode
+ * reference count is protected by the vnode's vn_countlock spinlock.
+ * The inode type and inode number never change once a vnode is
+ * loaded and may be read without locks.
+ *
+ * The lock order is:
+ *
+ *      directory sv_lock (lowest inode number first, if two)
+ *        -> file sv_lock
+ *          -> sfs_vnlock
+ *            -> sfs_freemaplock
+ *              -> vn_countlock
+ *
+ * The VFS layer's knowndevs_lock (see vfslist.c) comes before all of
+ * these, as sfs_getroot and sfs_unmount are called with it held.
+ * Device I/O may be done while holding any of the sleep locks but not
+ * the spinlock. VOP_DECREF may end up in sfs_reclaim, which takes the
+ * vnode's own sv_lock and then sfs_vnlock; so it may be called while
+ * holding the lock of the directory the vnode was found in, but never
+ * while holding sfs_vnlock, sfs_freemaplock, or the vnode's own lock.
+ */
+
+struct lock;
+
 struct sfs_vnode {
 	struct vnode sv_v;              /* abstract vnode structure */
 	struct sfs_inode sv_i;		/* on-disk inode */
 	uint32_t sv_ino;                /* inode number */
 	bool sv_dirty;                  /* true if sv_i modified */
+	struct lock *sv_lock;           /* protects sv_i, sv_dirty, data */
 };
 
 struct sfs_fs {
@@ -61,8 +92,10 @@ struct sfs_fs {
 	bool sfs_superdirty;            /* true if superblock modified */
 	struct device *sfs_device;      /* device mounted on */
 	struct vnodearray *sfs_vnodes;  /* vnodes loaded into memory */
+	struct lock *sfs_vnlock;        /* protects sfs_vnodes */
 	struct bitmap *sfs_freemap;     /* blocks in use are marked 1 */
 	bool sfs_freemapdirty;          /* true if freemap modified */
+	struct lock *sfs_freemaplock;   /* protects freemap and super */
 };
 
 /*
@@ -36,6 +36,9 @@
  */
 
 #include <cdefs.h>
+#include "opt-lockstat.h"
+
+struct lockstat;
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -50,19 +53,34 @@
  *
  * Note that spinlocks are held by CPUs, not by threads.
  *
+ * Spinlocks are ticket locks: each CPU that wants the lock takes the
+ * next number from lk_next and waits until lk_serving reaches it, so
+ * CPUs get the lock in the order they asked and none can starve.
+ *
  * This structure is made public so spinlocks do not have to be
  * malloc'd; however, code that uses spinlocks should not look inside
  * the structure directly but always use the spinlock API functions.
  */
 struct spinlock {
-	volatile spinlock_data_t lk_lock; /* The memory word where we spin. */
+	volatile spinlock_data_t lk_next; /* Next ticket to hand out. */
+	volatile spinlock_data_t lk_serving; /* Ticket holding the lock. */
 	struct cpu *lk_holder;		/* CPU holding this lock. */
+#if OPT_LOCKSTAT
+	struct lockstat *lk_stat;	/* Statistics, if named. */
+	uint64_t lk_acquired_ns;	/* When acquired, for hold time. */
+#endif
 };
 
 /*
  * Initializer for cases where a spinlock needs to be static or global.
  */
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#if OPT_LOCKSTAT
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, \
+				  SPINLOCK_DATA_INITIALIZER, NULL, NULL, 0 }
+#else
+#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, \
+				  SPINLOCK_DATA_INITIALIZER, NULL }
+#endif
 
 /*
  * Spinlock functions.
@@ -74,10 +92,14 @@ struct spinlock {
  * release	Release the lock. May re-enable interrupts.
  *
  * do_i_hold	Check if the current CPU holds the lock.
+ *
+ * setname	Give the lock a name for lock statistics (see lockstat.h).
+ *		Does nothing unless those are compiled in. NAME is copied.
  */
 
 void spinlock_init(struct spinlock *lk);
 void spinlock_cleanup(struct spinlock *lk);
+void spinlock_setname(struct spinlock *lk, const char *name);
 
 void spinlock_acquire(struct spinlock *lk);
 void spinlock_release(struct spinlock *lk);
@@ -42,16 +42,27 @@
  *
  * The name field is for easier debugging. A copy of the name is made
  * internally.
+ *
+ * If sem_handoff is set (with sem_sethandoff), V hands the cpu
+ * straight to the thread it wakes when that thread will run on the
+ * same cpu, instead of queueing it behind everything else. This
+ * suits request/response pairs, where the waker is about to wait for
+ * the answer anyway.
  */
 struct semaphore {
         char *sem_name;
 	struct wchan *sem_wchan;
 	struct spinlock sem_lock;
         volatile int sem_count;
+	bool sem_handoff;
+#if OPT_LOCKSTAT
+	struct lockstat *sem_stat;
+#endif
 };
 
 struct semaphore *sem_create(const char *name, int initial_count);
 void sem_destroy(struct semaphore *);
+void sem_sethandoff(struct semaphore *, bool handoff);
 
 /*
  * Operations (both atomic):
@@ -71,14 +82,32 @@ void V(struct semaphore *);
  *
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
+ *
+ * Locks are adaptive: a thread that finds the lock held spins while
+ * the holder is running on another CPU (for at most LOCK_SPIN_MAX
+ * iterations), and sleeps only if the holder is not running.
+ * lk_spins and lk_blocks count contended acquisitions that were
+ * resolved by spinning and by sleeping respectively.
+ *
+ * lk_handoff (set with lock_sethandoff) makes lock_release hand the
+ * cpu to the waiter it wakes, as for semaphores.
  */
+#define LOCK_SPIN_MAX 10000
+
 struct lock {
         char *lk_name;
         struct wchan *lk_wchan;
         struct spinlock lk_lock;
-        struct thread *cur_th;
+        struct thread *volatile cur_th;
         volatile int initial_val;
         // (don't forget to mark things volatile as needed)
+        unsigned lk_spins;
+        unsigned lk_blocks;
+        bool lk_handoff;
+#if OPT_LOCKSTAT
+        struct lockstat *lk_stat;
+        uint64_t lk_acquired_ns;
+#endif
 };
 
 struct lock *lock_create(const char *name);
@@ -98,6 +127,7 @@ void lock_acquire(struct lock *);
 void lock_release(struct lock *);
 bool lock_do_i_hold(struct lock *);
 void lock_destroy(struct lock *);
+void lock_sethandoff(struct lock *, bool handoff);
 
 
 /*
@@ -108,7 +138,10 @@ void lock_destroy(struct lock *);
  * actual variable, as such, in the CV.
  *
  * These CVs are expected to support Mesa semantics, that is, no
- * guarantees are made about scheduling.
+ * guarantees are made about scheduling. While the lock is held,
+ * cv_signal and cv_broadcast move waiters onto the lock's queue
+ * rather than waking them, so they are woken one at a time as the
+ * lock is released.
  *
  * The name field is for easier debugging. A copy of the name is
  * (should be) made internally.
@@ -140,4 +173,56 @@ void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers, or one writer, may hold the lock at once.
+ * Both readers and writers sleep while waiting. Writers have
+ * preference: once a writer is waiting, new readers wait behind it.
+ * (So a thread must not take the read lock recursively, as a writer
+ * arriving in between would deadlock it.)
+ *
+ * A lock made with rwlock_create_percpu keeps its reader count per
+ * cpu, so that uncontended readers on different cpus don't write the
+ * same memory. Taking the write lock costs more, as the writer has
+ * to sum the per-cpu counts. Use it for data that is read far more
+ * often than it is written.
+ *
+ * The name field is for easier debugging. A copy of the name is made
+ * internally.
+ */
+struct rwlock_pcpu;
+
+struct rwlock {
+	char *rw_name;
+	struct wchan *rw_readwchan;	/* readers wait here */
+	struct wchan *rw_writewchan;	/* writers wait here */
+	struct spinlock rw_lock;
+	volatile unsigned rw_readers;	/* readers, if not per-cpu */
+	volatile unsigned rw_writewaiters; /* writers waiting */
+	struct thread *volatile rw_writer; /* writer holding the lock */
+	struct rwlock_pcpu *rw_pcpu;	/* per-cpu reader counts, or NULL */
+};
+
+struct rwlock *rwlock_create(const char *name);
+struct rwlock *rwlock_create_percpu(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading.
+ *    rwlock_release_read  - Release a read hold.
+ *    rwlock_acquire_write - Get the lock for writing (exclusively).
+ *    rwlock_release_write - Release a write hold.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds
+ *                   the lock for writing. (Read holds aren't tracked
+ *                   per thread, so there is no read equivalent.)
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
@@ -32,6 +32,7 @@
 
 
 struct trapframe; /* from <machine/trapframe.h> */
+struct addrspace; /* from <addrspace.h> */
 
 /*
  * The system call dispatcher.
@@ -50,6 +51,11 @@ void enter_forked_process(void *tf, unsigned long x);
 void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 		       vaddr_t entrypoint);
 
+/* Load a program and its arguments into a new address space. */
+int program_load(char *progname, char **args, int argc,
+		 struct addrspace **oldas, vaddr_t *entrypoint,
+		 userptr_t *argv, vaddr_t *stackptr);
+
 
 /*
  * Prototypes for IN-KERNEL entry points for system call implementations.
@@ -57,14 +63,47 @@ void enter_new_process(int argc, userptr_t argv, vaddr_t stackptr,
 
 int sys_reboot(int code);
 int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+int sys_nanosleep(const_userptr_t user_req, userptr_t user_rem);
+int sys_schedstat(int which, userptr_t buf, size_t buflen, int *retval);
+int sys_sched_setaffinity(pid_t pid, uint32_t mask);
+int sys_sched_getaffinity(pid_t pid, userptr_t mask);
+int sys_sched_setrt(pid_t pid, const_userptr_t param);
+int sys_futex_wait(userptr_t addr, int val, const_userptr_t timeout);
+int sys_futex_wake(userptr_t addr, int nwake, int *retval);
 
 #ifdef UW
-int sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval);
+int sys_open(userptr_t path, int flags, mode_t mode, int *retval);
+int sys_read(int fd, userptr_t buf, size_t len, int *retval);
+int sys_write(int fd, userptr_t buf, size_t len, int *retval);
+int sys_pread(int fd, userptr_t buf, size_t len, off_t pos, int *retval);
+int sys_pwrite(int fd, userptr_t buf, size_t len, off_t pos, int *retval);
+int sys_readv(int fd, userptr_t iov, int iovcnt, int *retval);
+int sys_writev(int fd, userptr_t iov, int iovcnt, int *retval);
+int sys_preadv(int fd, userptr_t iov, int iovcnt, off_t pos, int *retval);
+int sys_pwritev(int fd, userptr_t iov, int iovcnt, off_t pos, int *retval);
+int sys_close(int fd);
+int sys_pipe(userptr_t fds);
+int sys_copy_file_range(int infd, userptr_t inpos, int outfd, userptr_t outpos,
+			size_t len, unsigned flags, int *retval);
+int sys_sendfile(int outfd, int infd, userptr_t inpos, size_t len,
+		 int *retval);
+int sys_remove(userptr_t path);
+int sys_rename(userptr_t oldpath, userptr_t newpath);
+int sys_lseek(int fd, off_t pos, int whence, off_t *retval);
+int sys_dup2(int oldfd, int newfd, int *retval);
+int sys_poll(userptr_t fds, unsigned nfds, int timeout, int *retval);
+int sys_select(int nfds, userptr_t readfds, userptr_t writefds,
+	       userptr_t exceptfds, userptr_t timeout, int *retval);
 void sys__exit(int exitcode);
 int sys_getpid(pid_t *retval);
 int sys_waitpid(pid_t pid, userptr_t status, int options, pid_t *retval);
+int sys_wait4(pid_t pid, userptr_t status, int options, userptr_t rusage,
+	      pid_t *retval);
+int sys_getrusage(int who, userptr_t rusage);
 int sys_fork(struct trapframe * tf, pid_t *retval);
-int sys_execv(const char *program, char **args);
+int sys_vfork(struct trapframe *tf, pid_t *retval);
+int sys_execv(userptr_t program, userptr_t args);
+int sys_spawn(userptr_t program, userptr_t args, pid_t *retval);
 
 #endif // UW
 
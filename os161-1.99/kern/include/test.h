@@ -59,6 +59,14 @@ int threadtest3(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
+int rwtest(int, char **);
+int rcutest(int, char **);
+
+/* thread benchmarks */
+int forkbench(int, char **);
+int rtbench(int, char **);
+int spinbench(int, char **);
+int pingpong(int, char **);
 
 #ifdef UW
 /* Another thread and synchronization test */
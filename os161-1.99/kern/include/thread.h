@@ -39,6 +39,7 @@
 #include <array.h>
 #include <spinlock.h>
 #include <threadlist.h>
+#include <kern/schedstat.h>
 
 struct cpu;
 
@@ -55,6 +56,38 @@ struct cpu;
 /* Macro to test if two addresses are on the same kernel stack */
 #define SAME_STACK(p1, p2)     (((p1) & STACK_MASK) == ((p2) & STACK_MASK))
 
+/* Names shorter than this are stored in the thread, not kmalloc'd */
+#define THREAD_NAMEBUF_SIZE 32
+
+/* Exited threads kept per CPU for reuse by thread_fork */
+#define THREAD_CACHE_MAX 16
+
+/*
+ * CPU affinity masks have one bit per CPU number (so MAXCPUS can be
+ * at most 32). THREAD_AFFINITY_ALL allows every CPU. A real-time
+ * thread may run only on the CPU its reservation was admitted on.
+ */
+#define THREAD_AFFINITY_ALL	0xffffffffU
+#define THREAD_CPU_ALLOWED(t, c) \
+	((t)->t_rt_cpu != NULL ? (t)->t_rt_cpu == (c) : \
+	 ((t)->t_affinity & ((uint32_t)1 << (c)->c_number)) != 0)
+
+/*
+ * Real-time bandwidth is accounted in parts per THREAD_RT_UTILSCALE
+ * of one CPU. Admission control keeps the total reserved on each CPU
+ * at or below THREAD_RT_UTILMAX, so some time is always left for
+ * ordinary threads.
+ */
+#define THREAD_RT_UTILSCALE	1000
+#define THREAD_RT_UTILMAX	900
+
+/*
+ * A thread that last ran on a CPU fewer than this many of its
+ * hardclocks ago is assumed to still have a warm cache there, and
+ * work stealing prefers to leave it alone.
+ */
+#define THREAD_CACHEHOT_TICKS	2
+
 
 /* States a thread can be in. */
 typedef enum {
@@ -71,6 +104,7 @@ struct thread {
 	 * debugger is messed up.
 	 */
 	char *t_name;			/* Name of this thread */
+	char t_namebuf[THREAD_NAMEBUF_SIZE]; /* Storage for short names */
 	const char *t_wchan_name;	/* Name of wait channel, if sleeping */
 	threadstate_t t_state;		/* State this thread is in */
 
@@ -83,6 +117,37 @@ struct thread {
 	struct switchframe *t_context;	/* Saved register context (on stack) */
 	struct cpu *t_cpu;		/* CPU thread runs on */
 	struct proc *t_proc;		/* Process thread belongs to */
+	uint32_t t_affinity;		/* CPUs the thread may run on */
+	unsigned t_lastran;		/* t_cpu's c_hardclocks when last run */
+	unsigned t_rcu_nesting;		/* Depth of RCU read sections */
+
+	/*
+	 * Real-time (EDF) scheduling state; meaningful only if t_rt
+	 * is set. Parameters and times are in hardclock ticks of
+	 * t_rt_cpu. Each period the thread may run for t_rt_budget
+	 * ticks, which should be done by t_rt_deadline ticks after
+	 * the period starts. Protected by t_rt_cpu's run queue lock
+	 * once admitted.
+	 */
+	bool t_rt;			/* In the real-time class */
+	bool t_rt_throttled;		/* Budget used up this period */
+	bool t_rt_missed;		/* Miss already counted this period */
+	struct cpu *t_rt_cpu;		/* CPU reservation is on, or NULL */
+	unsigned t_rt_util;		/* Reserved share of t_rt_cpu */
+	unsigned t_rt_period;		/* Period length */
+	unsigned t_rt_budget;		/* Run time allowed per period */
+	unsigned t_rt_deadline;		/* Deadline relative to period start */
+	unsigned t_rt_release;		/* Start of current period */
+	unsigned t_rt_absdeadline;	/* Deadline of current period */
+	unsigned t_rt_left;		/* Budget left this period */
+
+	/*
+	 * Scheduler statistics. t_runnable_ns is when the thread was
+	 * last made runnable (0 if not known); it is consumed when
+	 * the thread is next switched to.
+	 */
+	uint64_t t_runnable_ns;
+	struct schedstat_thread t_stats;
 
 	/*
 	 * Interrupt state fields.
@@ -144,6 +209,37 @@ int thread_fork(const char *name, struct proc *proc,
                 void (*func)(void *, unsigned long),
                 void *data1, unsigned long data2);
 
+/*
+ * Restrict the current thread to the CPUs in MASK (one bit per CPU
+ * number). Fails with EINVAL if MASK includes no CPU that exists. If
+ * the current CPU is not in the mask, the thread moves to one that is
+ * before returning. Threads created with thread_fork inherit the
+ * creator's mask.
+ *
+ * thread_getaffinity returns the current thread's mask.
+ */
+int thread_setaffinity(uint32_t mask);
+uint32_t thread_getaffinity(void);
+
+/*
+ * Move the current thread into the real-time class: every PERIOD
+ * ticks it is entitled to BUDGET ticks of CPU time, to be delivered
+ * within DEADLINE ticks of the start of the period (0 means the same
+ * as PERIOD). Real-time threads are scheduled earliest deadline
+ * first, ahead of all ordinary threads, and are throttled until
+ * their next period once the budget is spent.
+ *
+ * The reservation is admitted on one CPU in the thread's affinity
+ * mask, and the thread then runs only there. Fails with EINVAL for
+ * inconsistent parameters and EBUSY if no allowed CPU has the
+ * bandwidth left. A PERIOD of 0 returns the thread to ordinary
+ * scheduling. Forked threads do not inherit the real-time class.
+ */
+int thread_setrt(unsigned period, unsigned budget, unsigned deadline);
+
+/* Called from hardclock to do real-time budget accounting. */
+void thread_rttick(void);
+
 /*
  * Cause the current thread to exit.
  * Interrupts need not be disabled.
@@ -157,16 +253,34 @@ void thread_exit(void);
  */
 void thread_yield(void);
 
+/*
+ * Yield to TARGET, a thread just returned by wchan_wakeone_handoff,
+ * so it runs straight away; the current thread runs right after it.
+ * Does nothing if TARGET is NULL or when it isn't safe to switch.
+ */
+void thread_yield_to(struct thread *target);
+
 /*
  * Reshuffle the run queue. Called from the timer interrupt.
  */
 void schedule(void);
 
 /*
- * Potentially migrate ready threads to other CPUs. Called from the
- * timer interrupt.
+ * Print per-CPU work-stealing counters.
+ */
+void thread_printstealstats(void);
+
+/*
+ * Scheduler statistics. thread_numcpus returns the number of CPUs;
+ * thread_busycpus returns a mask of those not currently idle;
+ * thread_getcpustats copies out the statistics of one of them, and
+ * fails with EINVAL if there is no such CPU. thread_printschedstats
+ * prints everything for the kernel menu.
  */
-void thread_consider_migration(void);
+unsigned thread_numcpus(void);
+uint32_t thread_busycpus(void);
+int thread_getcpustats(unsigned cpunum, struct schedstat_cpu *ret);
+void thread_printschedstats(void);
 
 void kill_curthread(vaddr_t epc, unsigned code, vaddr_t vaddr);
 #endif /* _THREAD_H_ */
@@ -185,8 +185,9 @@ DECLARRAY(vnode);
 DEFARRAY(vnode, VFSINLINE);
 
 /*
- * Global one-big-lock for all filesystem operations.
- * You must remove this for the filesystem assignment.
+ * Global big lock. No longer used for file operations; it serializes
+ * mount, unmount, and setting the boot filesystem, and protects
+ * emufs. SFS uses its own finer-grained locks.
  */
 void vfs_biglock_acquire(void);
 void vfs_biglock_release(void);
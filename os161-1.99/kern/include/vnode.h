@@ -30,8 +30,11 @@
 #ifndef _VNODE_H_
 #define _VNODE_H_
 
+#include <spinlock.h>
 
 struct uio;
+struct execimage;
+struct pollent;
 struct stat;
 
 /*
@@ -50,10 +53,18 @@ struct stat;
  * vn_opencount is managed using VOP_INCOPEN and VOP_DECOPEN by
  * vfs_open() and vfs_close(). Code above the VFS layer should not
  * need to worry about it.
+ *
+ * vn_countlock protects vn_refcount and vn_opencount, so taking and
+ * dropping references does not need any filesystem lock. It also
+ * protects vn_writegen, which counts writes and truncates, and
+ * vn_execimage, the file's entry in the exec cache (see execcache.h).
  */
 struct vnode {
 	int vn_refcount;                /* Reference count */
 	int vn_opencount;
+	struct spinlock vn_countlock;   /* Lock for the counts */
+	unsigned vn_writegen;           /* Bumped by each write/truncate */
+	struct execimage *vn_execimage; /* Cached executable image */
 
 	struct fs *vn_fs;               /* Filesystem vnode belongs to */
 
@@ -132,6 +143,14 @@ struct vnode {
  *                      past EOF on files whose sizes are fixed may be
  *                      as well.)
  *
+ *    vop_poll        - Check which of the poll events (see kern/poll.h)
+ *                      in EVENTS could be handled without blocking, and
+ *                      hand back those that could, plus POLLERR and
+ *                      POLLHUP if they apply, in REVENTS. If PE is not
+ *                      NULL, first add it to the object's pollq (see
+ *                      poll.h) unless it is already there. Objects that
+ *                      never block can use vnode_poll_ready.
+ *
  *    vop_fsync       - Force any dirty buffers associated with this file
  *                      to stable storage.
  *
@@ -208,6 +227,8 @@ struct vnode_ops {
 	int (*vop_stat)(struct vnode *object, struct stat *statbuf);
 	int (*vop_gettype)(struct vnode *object, mode_t *result);
 	int (*vop_tryseek)(struct vnode *object, off_t pos);
+	int (*vop_poll)(struct vnode *object, int events,
+			struct pollent *pe, int *revents);
 	int (*vop_fsync)(struct vnode *object);
 	int (*vop_mmap)(struct vnode *file /* add stuff */);
 	int (*vop_truncate)(struct vnode *file, off_t len);
@@ -248,14 +269,15 @@ struct vnode_ops {
 #define VOP_READ(vn, uio)               (__VOP(vn, read)(vn, uio))
 #define VOP_READLINK(vn, uio)           (__VOP(vn, readlink)(vn, uio))
 #define VOP_GETDIRENTRY(vn, uio)        (__VOP(vn,getdirentry)(vn, uio))
-#define VOP_WRITE(vn, uio)              (__VOP(vn, write)(vn, uio))
+#define VOP_WRITE(vn, uio)              vnode_write(vn, uio)
 #define VOP_IOCTL(vn, code, buf)        (__VOP(vn, ioctl)(vn,code,buf))
 #define VOP_STAT(vn, ptr) 	        (__VOP(vn, stat)(vn, ptr))
 #define VOP_GETTYPE(vn, result)         (__VOP(vn, gettype)(vn, result))
 #define VOP_TRYSEEK(vn, pos)            (__VOP(vn, tryseek)(vn, pos))
+#define VOP_POLL(vn, ev, pe, rev)       (__VOP(vn, poll)(vn, ev, pe, rev))
 #define VOP_FSYNC(vn)                   (__VOP(vn, fsync)(vn))
 #define VOP_MMAP(vn /*add stuff */)     (__VOP(vn, mmap)(vn /*add stuff */))
-#define VOP_TRUNCATE(vn, pos)           (__VOP(vn, truncate)(vn, pos))
+#define VOP_TRUNCATE(vn, pos)           vnode_truncate(vn, pos)
 #define VOP_NAMEFILE(vn, uio)           (__VOP(vn, namefile)(vn, uio))
 
 #define VOP_CREAT(vn,nm,excl,mode,res)  (__VOP(vn, creat)(vn,nm,excl,mode,res))
@@ -295,6 +317,23 @@ void vnode_decopen(struct vnode *);
 #define VOP_INCOPEN(vn) 		vnode_incopen(vn)
 #define VOP_DECOPEN(vn) 		vnode_decopen(vn)
 
+/*
+ * Write and truncate (handled partly above filesystem level)
+ *
+ * These call vop_write and vop_truncate, and then note that the file
+ * has changed, so that cached copies of it (see execcache.h) are
+ * dropped.
+ */
+int vnode_write(struct vnode *, struct uio *);
+int vnode_truncate(struct vnode *, off_t);
+
+/*
+ * vop_poll for objects that are always ready, like files and
+ * directories.
+ */
+int vnode_poll_ready(struct vnode *, int events, struct pollent *pe,
+		     int *revents);
+
 /*
  * Vnode initialization (intended for use by filesystem code)
  * The reference count is initialized to 1.
@@ -36,6 +36,7 @@
 
 
 struct wchan; /* Opaque */
+struct thread;
 
 /*
  * Create a wait channel. Use NAME as a symbolic name for the channel.
@@ -81,5 +82,20 @@ void wchan_sleep(struct wchan *wc);
 void wchan_wakeone(struct wchan *wc);
 void wchan_wakeall(struct wchan *wc);
 
+/*
+ * Wake up one thread, and if it will run on this CPU, queue it to run
+ * next and return it, for the caller to pass to thread_yield_to once
+ * it holds no spinlocks. Returns NULL otherwise. The queue should not
+ * already be locked.
+ */
+struct thread *wchan_wakeone_handoff(struct wchan *wc);
+
+/*
+ * Move one thread, or all threads (if ALL is true), sleeping on FROM
+ * to the end of TO's queue, without waking them; they wake when TO is
+ * woken. FROM must be locked by the caller and TO must not be.
+ */
+void wchan_requeue(struct wchan *from, struct wchan *to, bool all);
+
 
 #endif /* _WCHAN_H_ */
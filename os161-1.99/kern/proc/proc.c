@@ -43,13 +43,17 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <kern/wait.h>
 #include <proc.h>
 #include <current.h>
+#include <clock.h>
 #include <addrspace.h>
 #include <vnode.h>
 #include <vfs.h>
 #include <synch.h>
 #include <kern/fcntl.h>  
+#include <file.h>
 
 /*
  * The process for the kernel; this holds all the kernel-only threads.
@@ -69,7 +73,461 @@ static struct semaphore *proc_count_mutex;
 struct semaphore *no_proc_sem;   
 #endif  // UW
 
-struct proc_info **global_process_array;
+struct lock *glb_arr_lck;
+
+/*
+ * The process table, indexed by PID - PID_MIN. It starts empty and
+ * doubles when every slot is in use, so it is only as big as the
+ * most processes there have been at once, however large PID_MAX is.
+ * Lookups read it without locks (see proc.h): growing installs a new
+ * copy and frees the old one after an RCU grace period.
+ *
+ * Free PIDs wait in pt_free, a FIFO ring, so a PID is reused as late
+ * as possible. pt_used counts slots that have ever been handed out;
+ * PIDs from there up are free but not on the ring. Allocating and
+ * freeing are both constant time. All but the lookups need
+ * glb_arr_lck.
+ */
+struct proctab {
+	struct rcu_head pt_rcu;		/* For freeing once replaced */
+	unsigned pt_size;		/* Number of slots */
+	struct proc_info **pt_slots;	/* Slots; follow the header */
+};
+
+#define PROCTAB_MINSIZE 16
+#define PROCTAB_MAXSIZE (PID_MAX - PID_MIN + 1)
+
+static struct proctab *volatile proctab;
+static unsigned pt_used;
+static pid_t *pt_free;
+static unsigned pt_freehead, pt_freecount;
+
+static
+struct proctab *
+proctab_create(unsigned size)
+{
+	struct proctab *pt;
+
+	pt = kmalloc(sizeof(*pt) + size * sizeof(struct proc_info *));
+	if (pt == NULL) {
+		return NULL;
+	}
+	pt->pt_size = size;
+	pt->pt_slots = (struct proc_info **)(pt + 1);
+	return pt;
+}
+
+/*
+ * Double the table and the free ring. Fails with ENPROC if the table
+ * already covers every PID, or ENOMEM.
+ */
+static
+int
+proctab_grow(void)
+{
+	struct proctab *old, *new;
+	pid_t *newfree;
+	unsigned size, i;
+
+	KASSERT(lock_do_i_hold(glb_arr_lck));
+
+	old = proctab;
+	if (old->pt_size >= PROCTAB_MAXSIZE) {
+		return ENPROC;
+	}
+	size = old->pt_size * 2;
+	if (size < PROCTAB_MINSIZE) {
+		size = PROCTAB_MINSIZE;
+	}
+	if (size > PROCTAB_MAXSIZE) {
+		size = PROCTAB_MAXSIZE;
+	}
+
+	new = proctab_create(size);
+	if (new == NULL) {
+		return ENOMEM;
+	}
+	newfree = kmalloc(size * sizeof(pid_t));
+	if (newfree == NULL) {
+		kfree(new);
+		return ENOMEM;
+	}
+
+	for (i=0; i<old->pt_size; i++) {
+		new->pt_slots[i] = old->pt_slots[i];
+	}
+	for (; i<size; i++) {
+		new->pt_slots[i] = NULL;
+	}
+	/* Unwrap the ring into the front of the new one. */
+	for (i=0; i<pt_freecount; i++) {
+		newfree[i] = pt_free[(pt_freehead + i) % old->pt_size];
+	}
+	if (pt_free != NULL) {
+		kfree(pt_free);
+	}
+	pt_free = newfree;
+	pt_freehead = 0;
+
+	proctab = new;
+	call_rcu(&old->pt_rcu, kfree, old);
+	return 0;
+}
+
+/*
+ * Create and destroy a wait queue.
+ */
+static
+struct proc_waitq *
+proc_waitq_create(void)
+{
+	struct proc_waitq *wq;
+
+	wq = kmalloc(sizeof(*wq));
+	if (wq == NULL) {
+		return NULL;
+	}
+	wq->wq_lock = lock_create("proc_waitq");
+	if (wq->wq_lock == NULL) {
+		kfree(wq);
+		return NULL;
+	}
+	wq->wq_cv = cv_create("proc_waitq");
+	if (wq->wq_cv == NULL) {
+		lock_destroy(wq->wq_lock);
+		kfree(wq);
+		return NULL;
+	}
+	wq->wq_zombies = wq->wq_zombtail = NULL;
+	wq->wq_children = 0;
+	wq->wq_parentgone = false;
+	return wq;
+}
+
+static
+void
+proc_waitq_destroy(struct proc_waitq *wq)
+{
+	KASSERT(wq->wq_zombies == NULL);
+	KASSERT(wq->wq_children == 0);
+	cv_destroy(wq->wq_cv);
+	lock_destroy(wq->wq_lock);
+	kfree(wq);
+}
+
+/*
+ * Take exited child PI off WQ's zombie queue, and drop it from the
+ * count of children. Call with wq_lock held.
+ */
+static
+void
+proc_waitq_reap(struct proc_waitq *wq, struct proc_info *pi)
+{
+	KASSERT(lock_do_i_hold(wq->wq_lock));
+	KASSERT(pi->ex);
+
+	if (pi->pi_zprev != NULL) {
+		pi->pi_zprev->pi_znext = pi->pi_znext;
+	}
+	else {
+		wq->wq_zombies = pi->pi_znext;
+	}
+	if (pi->pi_znext != NULL) {
+		pi->pi_znext->pi_zprev = pi->pi_zprev;
+	}
+	else {
+		wq->wq_zombtail = pi->pi_zprev;
+	}
+	KASSERT(wq->wq_children > 0);
+	wq->wq_children--;
+}
+
+/*
+ * Allocate a PID and its table entry, as a child of PARENT (which
+ * may be NULL).
+ */
+static
+int
+proc_info_alloc(struct proc_waitq *parent, struct proc_info **ret)
+{
+	struct proc_info *pi;
+	pid_t pid;
+	int result;
+
+	pi = kmalloc(sizeof(*pi));
+	if (pi == NULL) {
+		return ENOMEM;
+	}
+	pi->pi_parent = parent;
+	pi->exit_code = -1;
+	pi->ex = 0;
+	pi->pi_znext = pi->pi_zprev = NULL;
+	bzero(&pi->pi_usage, sizeof(pi->pi_usage));
+
+	lock_acquire(glb_arr_lck);
+	if (pt_freecount > 0) {
+		pid = pt_free[pt_freehead];
+		pt_freehead = (pt_freehead + 1) % proctab->pt_size;
+		pt_freecount--;
+	}
+	else {
+		if (pt_used == proctab->pt_size) {
+			result = proctab_grow();
+			if (result) {
+				lock_release(glb_arr_lck);
+				kfree(pi);
+				return result;
+			}
+		}
+		pid = PID_MIN + pt_used++;
+	}
+	KASSERT(proctab->pt_slots[pid - PID_MIN] == NULL);
+	pi->proc_id = pid;
+	proctab->pt_slots[pid - PID_MIN] = pi;
+	lock_release(glb_arr_lck);
+
+	if (parent != NULL) {
+		lock_acquire(parent->wq_lock);
+		parent->wq_children++;
+		lock_release(parent->wq_lock);
+	}
+
+	*ret = pi;
+	return 0;
+}
+
+/*
+ * Undo proc_info_alloc for a process that never ran.
+ */
+static
+void
+proc_info_unalloc(struct proc_info *pi)
+{
+	struct proc_waitq *parent = pi->pi_parent;
+
+	if (parent != NULL) {
+		lock_acquire(parent->wq_lock);
+		KASSERT(parent->wq_children > 0);
+		parent->wq_children--;
+		lock_release(parent->wq_lock);
+	}
+	lock_acquire(glb_arr_lck);
+	proc_info_release(pi);
+	lock_release(glb_arr_lck);
+}
+
+struct proc_info *
+proc_info_get(pid_t pid)
+{
+	struct proctab *pt;
+
+	pt = proctab;
+	if (pid < PID_MIN || (unsigned)(pid - PID_MIN) >= pt->pt_size) {
+		return NULL;
+	}
+	return pt->pt_slots[pid - PID_MIN];
+}
+
+void
+proc_info_release(struct proc_info *pi)
+{
+	struct proctab *pt;
+	unsigned slot;
+
+	KASSERT(lock_do_i_hold(glb_arr_lck));
+
+	pt = proctab;
+	slot = pi->proc_id - PID_MIN;
+	KASSERT(pt->pt_slots[slot] == pi);
+	pt->pt_slots[slot] = NULL;
+
+	KASSERT(pt_freecount < pt->pt_size);
+	pt_free[(pt_freehead + pt_freecount) % pt->pt_size] = pi->proc_id;
+	pt_freecount++;
+
+	call_rcu(&pi->pi_rcu, kfree, pi);
+}
+
+void
+proc_info_exit(struct proc *p, int exitcode)
+{
+	struct proc_info *pi, *child;
+	struct proc_waitq *wq;
+	bool freewq;
+
+	/*
+	 * Let go of our own children: release the ones that have
+	 * exited, and mark the queue so the rest release themselves.
+	 */
+	wq = p->p_waitq;
+	p->p_waitq = NULL;
+	KASSERT(wq != NULL);
+	lock_acquire(wq->wq_lock);
+	wq->wq_parentgone = true;
+	while ((child = wq->wq_zombies) != NULL) {
+		proc_waitq_reap(wq, child);
+		lock_acquire(glb_arr_lck);
+		proc_info_release(child);
+		lock_release(glb_arr_lck);
+	}
+	freewq = wq->wq_children == 0;
+	lock_release(wq->wq_lock);
+	if (freewq) {
+		proc_waitq_destroy(wq);
+	}
+
+	/* Report to our parent, if it's still there to wait for us. */
+	pi = p->p_info;
+	wq = pi->pi_parent;
+	if (wq != NULL) {
+		lock_acquire(wq->wq_lock);
+		if (!wq->wq_parentgone) {
+			pi->exit_code = exitcode;
+			pi->pi_usage = p->p_usage;
+			proc_usage_add(&pi->pi_usage, &p->p_cusage);
+			pi->ex = 1;
+			pi->pi_znext = NULL;
+			pi->pi_zprev = wq->wq_zombtail;
+			if (wq->wq_zombtail != NULL) {
+				wq->wq_zombtail->pi_znext = pi;
+			}
+			else {
+				wq->wq_zombies = pi;
+			}
+			wq->wq_zombtail = pi;
+			cv_broadcast(wq->wq_cv, wq->wq_lock);
+			lock_release(wq->wq_lock);
+			return;
+		}
+		KASSERT(wq->wq_children > 0);
+		wq->wq_children--;
+		freewq = wq->wq_children == 0;
+		lock_release(wq->wq_lock);
+		if (freewq) {
+			proc_waitq_destroy(wq);
+		}
+	}
+
+	/* Nobody will wait for us. */
+	lock_acquire(glb_arr_lck);
+	proc_info_release(pi);
+	lock_release(glb_arr_lck);
+}
+
+int
+proc_wait(pid_t pid, int options, int *status, struct rusage *rusage,
+	  pid_t *ret)
+{
+	struct proc_waitq *wq;
+	struct proc_info *pi, *target;
+
+	if ((options & ~(WNOHANG | WUNTRACED)) != 0) {
+		return EINVAL;
+	}
+	wq = curproc->p_waitq;
+	KASSERT(wq != NULL);
+
+	target = NULL;
+	if (pid != WAIT_ANY) {
+		rcu_read_lock();
+		target = proc_info_get(pid);
+		if (target == NULL) {
+			rcu_read_unlock();
+			return ESRCH;
+		}
+		if (target->pi_parent != wq) {
+			rcu_read_unlock();
+			return ECHILD;
+		}
+		/* Only we can release our child's entry. */
+		rcu_read_unlock();
+	}
+
+	lock_acquire(wq->wq_lock);
+	while (1) {
+		if (target != NULL) {
+			pi = target->ex ? target : NULL;
+		}
+		else {
+			pi = wq->wq_zombies;
+		}
+		if (pi != NULL) {
+			break;
+		}
+		if (wq->wq_children == 0) {
+			lock_release(wq->wq_lock);
+			return ECHILD;
+		}
+		if (options & WNOHANG) {
+			lock_release(wq->wq_lock);
+			*ret = 0;
+			return 0;
+		}
+		cv_wait(wq->wq_cv, wq->wq_lock);
+	}
+	proc_waitq_reap(wq, pi);
+	lock_release(wq->wq_lock);
+
+	*status = pi->exit_code;
+	if (rusage != NULL) {
+		proc_usage_get(&pi->pi_usage, rusage);
+	}
+	proc_usage_add(&curproc->p_cusage, &pi->pi_usage);
+	*ret = pi->proc_id;
+
+	lock_acquire(glb_arr_lck);
+	proc_info_release(pi);
+	lock_release(glb_arr_lck);
+	return 0;
+}
+void
+proc_usage_add(struct proc_usage *to, const struct proc_usage *from)
+{
+	unsigned i;
+
+	to->pu_uticks += from->pu_uticks;
+	to->pu_sticks += from->pu_sticks;
+	for (i=0; i<VMSTAT_COUNT; i++) {
+		to->pu_vmstats[i] += from->pu_vmstats[i];
+	}
+	to->pu_nvcsw += from->pu_nvcsw;
+	to->pu_nivcsw += from->pu_nivcsw;
+	to->pu_inbytes += from->pu_inbytes;
+	to->pu_outbytes += from->pu_outbytes;
+}
+
+/*
+ * Ticks to a struct timeval.
+ */
+static
+void
+proc_ticks_to_timeval(unsigned ticks, struct timeval *tv)
+{
+	tv->tv_sec = ticks / HZ;
+	tv->tv_usec = (ticks % HZ) * (1000000 / HZ);
+}
+
+void
+proc_usage_get(const struct proc_usage *pu, struct rusage *ru)
+{
+	unsigned faults, majflt;
+
+	bzero(ru, sizeof(*ru));
+	proc_ticks_to_timeval(pu->pu_uticks, &ru->ru_utime);
+	proc_ticks_to_timeval(pu->pu_sticks, &ru->ru_stime);
+
+	/* Faults that had to go to disk are major; the rest minor. */
+	faults = pu->pu_vmstats[VMSTAT_TLB_FAULT];
+	majflt = pu->pu_vmstats[VMSTAT_PAGE_FAULT_DISK];
+	ru->ru_majflt = majflt;
+	ru->ru_minflt = faults > majflt ? faults - majflt : 0;
+
+	ru->ru_nvcsw = pu->pu_nvcsw;
+	ru->ru_nivcsw = pu->pu_nivcsw;
+	ru->ru_inbytes = pu->pu_inbytes;
+	ru->ru_outbytes = pu->pu_outbytes;
+}
+
 /*
  * Create a proc structure.
  */
@@ -87,8 +545,11 @@ proc_create(const char *name)
 		kfree(proc);
 		return NULL;
 	}
-	proc->children = array_create();
-	array_init(proc->children);
+	proc->p_info = NULL;
+	proc->p_waitq = NULL;
+	proc->p_vfork = NULL;
+	bzero(&proc->p_usage, sizeof(proc->p_usage));
+	bzero(&proc->p_cusage, sizeof(proc->p_cusage));
 	threadarray_init(&proc->p_threads);
 	spinlock_init(&proc->p_lock);
 	/* VM fields */
@@ -97,9 +558,7 @@ proc_create(const char *name)
 	/* VFS fields */
 	proc->p_cwd = NULL;
 	proc->pid = proc->parent_pid = 0;
-#ifdef UW
-	proc->console = NULL;
-#endif // UW
+	proc->p_files = NULL;
 	
 	return proc;
 }
@@ -155,11 +614,16 @@ proc_destroy(struct proc *proc)
 	}
 #endif // UW
 
-#ifdef UW
-	if (proc->console) {
-	  vfs_close(proc->console);
+	if (proc->p_files) {
+		filetable_destroy(proc->p_files);
+		proc->p_files = NULL;
+	}
+
+	/* A process that never ran still holds its PID. */
+	if (proc->p_waitq != NULL) {
+		proc_waitq_destroy(proc->p_waitq);
+		proc_info_unalloc(proc->p_info);
 	}
-#endif // UW
 
 	threadarray_cleanup(&proc->p_threads);
 	spinlock_cleanup(&proc->p_lock);
@@ -191,15 +655,13 @@ proc_destroy(struct proc *proc)
 void
 proc_bootstrap(void)
 {
-  glb_arr_lck = lock_create("lck");
-  global_process_array = kmalloc(PID_MAX*sizeof(struct proc_info*));
-  for(int i = 0; i < PID_MAX; i++){
-  		global_process_array[i] = kmalloc(sizeof(struct proc_info));
-  		global_process_array[i]->proc_id = -1;
-  		global_process_array[i]->exit_code = -1;
-  		global_process_array[i]->ex = 0;
-  		global_process_array[i]->exists = 0;
-  		global_process_array[i]->sm = sem_create("ishiqfor", 0);
+  glb_arr_lck = lock_create("glb_arr_lck");
+  if (glb_arr_lck == NULL) {
+    panic("could not create process table lock\n");
+  }
+  proctab = proctab_create(0);
+  if (proctab == NULL) {
+    panic("could not create process table\n");
   }
 #ifdef UW
   proc_count = 0;
@@ -218,6 +680,46 @@ proc_bootstrap(void)
   }
 }
 
+/*
+ * Give PROC a new file table with the console open on descriptors
+ * 0, 1 and 2, all three sharing one open file.
+ */
+static
+int
+proc_stdio_open(struct proc *proc)
+{
+	struct openfile *of;
+	char *path;
+	int i, fd, result;
+
+	proc->p_files = filetable_create();
+	if (proc->p_files == NULL) {
+		return ENOMEM;
+	}
+	path = kstrdup("con:");
+	if (path == NULL) {
+		filetable_destroy(proc->p_files);
+		proc->p_files = NULL;
+		return ENOMEM;
+	}
+	result = openfile_open(path, O_RDWR, 0, &of);
+	kfree(path);
+	if (result) {
+		filetable_destroy(proc->p_files);
+		proc->p_files = NULL;
+		return result;
+	}
+	/* The table is empty, so these land on 0, 1 and 2 in turn. */
+	for (i = 0; i < 3; i++) {
+		if (i > 0) {
+			openfile_incref(of);
+		}
+		result = filetable_add(proc->p_files, of, &fd);
+		KASSERT(result == 0 && fd == i);
+	}
+	return 0;
+}
+
 /*
  * Create a fresh proc for use by runprogram.
  *
@@ -228,35 +730,46 @@ struct proc *
 proc_create_runprogram(const char *name)
 {
 	struct proc *proc;
-	char *console_path;
+	struct proc_info *pi;
+	int result;
 
+	/* The kernel menu never waits for what it runs. */
+	if (proc_info_alloc(curproc->p_waitq, &pi)) {
+		return NULL;
+	}
 	proc = proc_create(name);
 	if (proc == NULL) {
+		proc_info_unalloc(pi);
 		return NULL;
 	}
-	lock_acquire(glb_arr_lck);
-	for(unsigned int i = 0; i < PID_MAX; i++){
-		if(global_process_array[i]->proc_id == -1){
-          proc->pid = i+2;
-		  global_process_array[i]->proc_id = i+2;
-          global_process_array[i]->parent_proc = curproc;
-          global_process_array[i]->exists = 1;
-          array_add(curproc->children, (void*)proc->pid, NULL);
-          break;
-      }
-  	}
-  	lock_release(glb_arr_lck);
-#ifdef UW
-	/* open the console - this should always succeed */
-	console_path = kstrdup("con:");
-	if (console_path == NULL) {
-	  panic("unable to copy console path name during process creation\n");
+	proc->p_waitq = proc_waitq_create();
+	if (proc->p_waitq == NULL) {
+		kfree(proc->p_name);
+		kfree(proc);
+		proc_info_unalloc(pi);
+		return NULL;
+	}
+	proc->p_info = pi;
+	proc->pid = pi->proc_id;
+
+	/*
+	 * A child of a user process (fork, vfork, spawn) shares its
+	 * parent's open files; one started from the menu gets the
+	 * console as standard input, output and error.
+	 */
+	if (curproc->p_files != NULL) {
+		result = filetable_copy(curproc->p_files, &proc->p_files);
 	}
-	if (vfs_open(console_path,O_WRONLY,0,&(proc->console))) {
-	  panic("unable to open the console during process creation\n");
+	else {
+		result = proc_stdio_open(proc);
+	}
+	if (result) {
+		proc_waitq_destroy(proc->p_waitq);
+		kfree(proc->p_name);
+		kfree(proc);
+		proc_info_unalloc(pi);
+		return NULL;
 	}
-	kfree(console_path);
-#endif // UW
 	  
 	/* VM fields */
 
@@ -387,3 +900,22 @@ curproc_setas(struct addrspace *newas)
 	spinlock_release(&proc->p_lock);
 	return oldas;
 }
+
+void
+curproc_putas(struct addrspace *as)
+{
+	struct proc *proc = curproc;
+	struct semaphore *parent;
+
+	KASSERT(as != NULL);
+	KASSERT(as != proc->p_addrspace);
+
+	parent = proc->p_vfork;
+	if (parent == NULL) {
+		as_destroy(as);
+		return;
+	}
+	/* The parent frees the semaphore once it wakes up. */
+	proc->p_vfork = NULL;
+	V(parent);
+}
@@ -38,6 +38,10 @@
 #include <lib.h>
 #include <spl.h>
 #include <clock.h>
+#include <futex.h>
+#include <poll.h>
+#include <execcache.h>
+#include <rcu.h>
 #include <thread.h>
 #include <proc.h>
 #include <current.h>
@@ -110,7 +114,11 @@ boot(void)
 	proc_bootstrap();
 	thread_bootstrap();
 	hardclock_bootstrap();
+	rcu_bootstrap();
+	futex_bootstrap();
+	poll_bootstrap();
 	vfs_bootstrap();
+	execcache_bootstrap();
 
 	/* Probe and initialize devices. Interrupts should come on. */
 	kprintf("Device probe...\n");
@@ -125,6 +133,7 @@ boot(void)
 	vm_bootstrap();
 	kprintf_bootstrap();
 	thread_start_cpus();
+	rcu_start();
 
 	/* Default bootfs - but ignore failure, in case emu0 doesn't exist */
 	vfs_setbootfs("emu0");
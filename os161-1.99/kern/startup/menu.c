@@ -38,13 +38,16 @@
 #include <thread.h>
 #include <proc.h>
 #include <synch.h>
+#include <lockstat.h>
 #include <vfs.h>
 #include <sfs.h>
+#include <execcache.h>
 #include <syscall.h>
 #include <test.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
+#include "opt-lockstat.h"
 
 /*
  * In-kernel menu and command dispatcher.
@@ -401,6 +404,82 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_stealstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	thread_printstealstats();
+
+	return 0;
+}
+
+static
+int
+cmd_schedstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	thread_printschedstats();
+
+	return 0;
+}
+
+static
+int
+cmd_execstats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	execcache_printstats();
+
+	return 0;
+}
+
+#if OPT_LOCKSTAT
+
+#define LOCKSTAT_DEFAULT_TOPN 10
+
+/*
+ * Command for printing the most contended locks.
+ */
+static
+int
+cmd_lockstat(int nargs, char **args)
+{
+	unsigned topn;
+
+	if (nargs > 2) {
+		kprintf("Usage: lks [count]\n");
+		return EINVAL;
+	}
+	topn = nargs == 2 ? (unsigned)atoi(args[1]) : LOCKSTAT_DEFAULT_TOPN;
+	lockstat_print(topn);
+
+	return 0;
+}
+
+/*
+ * Command for zeroing lock statistics.
+ */
+static
+int
+cmd_lockstatreset(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	lockstat_reset();
+
+	return 0;
+}
+
+#endif /* OPT_LOCKSTAT */
+
 ////////////////////////////////////////
 //
 // Menus.
@@ -475,12 +554,18 @@ static const char *testmenu[] = {
 	"[tt1] Thread test 1                 ",
 	"[tt2] Thread test 2                 ",
 	"[tt3] Thread test 3                 ",
+	"[tb1] Thread fork/exit benchmark    ",
+	"[tb2] Real-time latency benchmark   ",
+	"[tb3] Spinlock scaling benchmark    ",
+	"[tb4] Ping-pong wakeup benchmark    ",
 #if OPT_NET
 	"[net] Network test                  ",
 #endif
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
+	"[sy4] Rwlock test                   ",
+	"[sy5] RCU test                      ",
 #ifdef UW
 	"[uw1] UW lock test          (1)     ",
 	"[uw2] UW vmstats test       (3)     ",
@@ -520,6 +605,13 @@ static const char *mainmenu[] = {
 #endif /* UW */
 #endif
 	"[kh] Kernel heap stats              ",
+	"[ws] Work stealing stats            ",
+	"[ss] Scheduler stats                ",
+	"[ec] Exec cache stats               ",
+#if OPT_LOCKSTAT
+	"[lks] Lock contention stats         ",
+	"[lkr] Reset lock contention stats   ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -577,6 +669,13 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "ws",         cmd_stealstats },
+	{ "ss",         cmd_schedstats },
+	{ "ec",         cmd_execstats },
+#if OPT_LOCKSTAT
+	{ "lks",        cmd_lockstat },
+	{ "lkr",        cmd_lockstatreset },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -589,11 +688,17 @@ static struct {
 	{ "tt1",	threadtest },
 	{ "tt2",	threadtest2 },
 	{ "tt3",	threadtest3 },
+	{ "tb1",	forkbench },
+	{ "tb2",	rtbench },
+	{ "tb3",	spinbench },
+	{ "tb4",	pingpong },
 	{ "sy1",	semtest },
 
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
+	{ "sy4",	rwtest },
+	{ "sy5",	rcutest },
 #ifdef UW
 	{ "uw1",	uwlocktest1 },
 	{ "uw2",	uwvmstatstest },
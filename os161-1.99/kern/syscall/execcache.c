@@ -0,0 +1,321 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Executable image cache.
+ *
+ * Images hang off their vnodes (vn_execimage), so lookup is just a
+ * pointer load, and sit on one LRU list for eviction. A sleep lock
+ * protects the list, the counters, and the image reference counts;
+ * vn_execimage is changed only with both that lock and the vnode's
+ * vn_countlock held, so vnode_changed can check it with just the
+ * latter. Images are destroyed outside the lock, since dropping the
+ * last vnode reference may go into the filesystem.
+ *
+ * The cache holds a reference to each image in it, and each loader
+ * holds one while copying out of it.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <synch.h>
+#include <vnode.h>
+#include <execcache.h>
+
+static struct lock *execcache_lock;
+static struct execimage *ec_head;	/* Most recently used */
+static struct execimage *ec_tail;	/* Least recently used */
+static unsigned ec_nimages;
+static size_t ec_bytes;
+
+/* Statistics */
+static unsigned ec_hits;		/* Found in the cache */
+static unsigned ec_misses;		/* Had to read the file */
+static unsigned ec_raced;		/* Read, but file changed meanwhile */
+static unsigned ec_invalidations;	/* Dropped because file changed */
+static unsigned ec_evictions;		/* Dropped to make room */
+
+void
+execcache_bootstrap(void)
+{
+	execcache_lock = lock_create("execcache");
+	if (execcache_lock == NULL) {
+		panic("execcache_bootstrap: Out of memory\n");
+	}
+}
+
+struct execimage *
+execimage_create(struct vnode *v)
+{
+	struct execimage *ei;
+	unsigned i;
+
+	ei = kmalloc(sizeof(*ei));
+	if (ei == NULL) {
+		return NULL;
+	}
+	VOP_INCREF(v);
+	ei->ei_vnode = v;
+	ei->ei_entrypoint = 0;
+	ei->ei_nsegs = 0;
+	for (i=0; i<EXECIMAGE_MAXSEGS; i++) {
+		ei->ei_segs[i].es_data = NULL;
+	}
+	ei->ei_bytes = 0;
+	ei->ei_refcount = 1;
+	ei->ei_next = ei->ei_prev = NULL;
+	return ei;
+}
+
+static
+void
+execimage_destroy(struct execimage *ei)
+{
+	unsigned i;
+
+	KASSERT(ei->ei_refcount == 0);
+	for (i=0; i<EXECIMAGE_MAXSEGS; i++) {
+		if (ei->ei_segs[i].es_data != NULL) {
+			kfree(ei->ei_segs[i].es_data);
+		}
+	}
+	VOP_DECREF(ei->ei_vnode);
+	kfree(ei);
+}
+
+void
+execimage_release(struct execimage *ei)
+{
+	bool last;
+
+	lock_acquire(execcache_lock);
+	KASSERT(ei->ei_refcount > 0);
+	ei->ei_refcount--;
+	last = ei->ei_refcount == 0;
+	lock_release(execcache_lock);
+
+	if (last) {
+		execimage_destroy(ei);
+	}
+}
+
+/*
+ * LRU list handling. Call with execcache_lock held.
+ */
+static
+void
+ec_pushfront(struct execimage *ei)
+{
+	ei->ei_prev = NULL;
+	ei->ei_next = ec_head;
+	if (ec_head != NULL) {
+		ec_head->ei_prev = ei;
+	}
+	else {
+		ec_tail = ei;
+	}
+	ec_head = ei;
+}
+
+static
+void
+ec_unlink(struct execimage *ei)
+{
+	if (ei->ei_prev != NULL) {
+		ei->ei_prev->ei_next = ei->ei_next;
+	}
+	else {
+		ec_head = ei->ei_next;
+	}
+	if (ei->ei_next != NULL) {
+		ei->ei_next->ei_prev = ei->ei_prev;
+	}
+	else {
+		ec_tail = ei->ei_prev;
+	}
+	ei->ei_next = ei->ei_prev = NULL;
+}
+
+/*
+ * Take EI out of the cache and drop the cache's reference. If that
+ * was the last one, chain EI onto *DEAD (through ei_next) for the
+ * caller to destroy once it has let go of execcache_lock.
+ */
+static
+void
+ec_remove(struct execimage *ei, struct execimage **dead)
+{
+	struct vnode *v = ei->ei_vnode;
+
+	KASSERT(lock_do_i_hold(execcache_lock));
+
+	spinlock_acquire(&v->vn_countlock);
+	KASSERT(v->vn_execimage == ei);
+	v->vn_execimage = NULL;
+	spinlock_release(&v->vn_countlock);
+
+	ec_unlink(ei);
+	KASSERT(ec_nimages > 0);
+	ec_nimages--;
+	ec_bytes -= ei->ei_bytes;
+
+	KASSERT(ei->ei_refcount > 0);
+	ei->ei_refcount--;
+	if (ei->ei_refcount == 0) {
+		ei->ei_next = *dead;
+		*dead = ei;
+	}
+}
+
+static
+void
+ec_destroyall(struct execimage *dead)
+{
+	struct execimage *next;
+
+	while (dead != NULL) {
+		next = dead->ei_next;
+		execimage_destroy(dead);
+		dead = next;
+	}
+}
+
+struct execimage *
+execcache_get(struct vnode *v, unsigned *gen)
+{
+	struct execimage *ei;
+
+	lock_acquire(execcache_lock);
+	ei = v->vn_execimage;
+	if (ei != NULL) {
+		ei->ei_refcount++;
+		ec_unlink(ei);
+		ec_pushfront(ei);
+		ec_hits++;
+	}
+	else {
+		ec_misses++;
+	}
+	spinlock_acquire(&v->vn_countlock);
+	*gen = v->vn_writegen;
+	spinlock_release(&v->vn_countlock);
+	lock_release(execcache_lock);
+
+	return ei;
+}
+
+void
+execcache_put(struct execimage *ei, unsigned gen)
+{
+	struct vnode *v = ei->ei_vnode;
+	struct execimage *dead = NULL;
+
+	if (ei->ei_bytes > EXECCACHE_MAXBYTES) {
+		/* Would push out everything else; not worth it. */
+		return;
+	}
+
+	lock_acquire(execcache_lock);
+
+	spinlock_acquire(&v->vn_countlock);
+	if (v->vn_writegen != gen || v->vn_execimage != NULL) {
+		/* Changed since we read it, or someone beat us to it. */
+		spinlock_release(&v->vn_countlock);
+		ec_raced++;
+		lock_release(execcache_lock);
+		return;
+	}
+	v->vn_execimage = ei;
+	spinlock_release(&v->vn_countlock);
+
+	ei->ei_refcount++;
+	ec_pushfront(ei);
+	ec_nimages++;
+	ec_bytes += ei->ei_bytes;
+
+	while (ec_nimages > EXECCACHE_MAXIMAGES ||
+	       ec_bytes > EXECCACHE_MAXBYTES) {
+		KASSERT(ec_tail != ei);
+		ec_remove(ec_tail, &dead);
+		ec_evictions++;
+	}
+
+	lock_release(execcache_lock);
+
+	ec_destroyall(dead);
+}
+
+void
+execcache_invalidate(struct vnode *v)
+{
+	struct execimage *dead = NULL;
+
+	lock_acquire(execcache_lock);
+	if (v->vn_execimage != NULL) {
+		ec_remove(v->vn_execimage, &dead);
+		ec_invalidations++;
+	}
+	lock_release(execcache_lock);
+
+	ec_destroyall(dead);
+}
+
+void
+execcache_flush(struct fs *fs)
+{
+	struct execimage *ei, *next, *dead = NULL;
+
+	lock_acquire(execcache_lock);
+	for (ei = ec_head; ei != NULL; ei = next) {
+		next = ei->ei_next;
+		if (fs == NULL || ei->ei_vnode->vn_fs == fs) {
+			ec_remove(ei, &dead);
+		}
+	}
+	lock_release(execcache_lock);
+
+	ec_destroyall(dead);
+}
+
+void
+execcache_printstats(void)
+{
+	unsigned lookups;
+
+	lock_acquire(execcache_lock);
+	lookups = ec_hits + ec_misses;
+	kprintf("execcache: %u images, %lu bytes\n",
+		ec_nimages, (unsigned long)ec_bytes);
+	kprintf("execcache: %u lookups, %u hits (%u%%), %u misses\n",
+		lookups, ec_hits,
+		lookups > 0 ? ec_hits * 100 / lookups : 0, ec_misses);
+	kprintf("execcache: %u invalidated, %u evicted, %u raced\n",
+		ec_invalidations, ec_evictions, ec_raced);
+	lock_release(execcache_lock);
+}
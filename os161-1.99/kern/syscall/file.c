@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Open files and file descriptor tables. See file.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <synch.h>
+#include <vfs.h>
+#include <file.h>
+
+/*
+ * Called after the grace period that follows the last reference
+ * being dropped, when no lookup can still be looking at OF.
+ */
+static
+void
+openfile_free(void *arg)
+{
+	struct openfile *of = arg;
+
+	spinlock_cleanup(&of->of_reflock);
+	kfree(of);
+}
+
+int
+openfile_create(struct vnode *vn, int flags, struct openfile **ret)
+{
+	struct openfile *of;
+
+	of = kmalloc(sizeof(*of));
+	if (of == NULL) {
+		return ENOMEM;
+	}
+	of->of_lock = lock_create("openfile");
+	if (of->of_lock == NULL) {
+		kfree(of);
+		return ENOMEM;
+	}
+	of->of_vnode = vn;
+	of->of_flags = flags & (O_ACCMODE | O_APPEND);
+	of->of_offset = 0;
+	spinlock_init(&of->of_reflock);
+	of->of_refcount = 1;
+
+	*ret = of;
+	return 0;
+}
+
+int
+openfile_open(char *path, int flags, mode_t mode, struct openfile **ret)
+{
+	struct vnode *vn;
+	int result;
+
+	result = vfs_open(path, flags, mode, &vn);
+	if (result) {
+		return result;
+	}
+	result = openfile_create(vn, flags, ret);
+	if (result) {
+		vfs_close(vn);
+		return result;
+	}
+	return 0;
+}
+
+void
+openfile_incref(struct openfile *of)
+{
+	spinlock_acquire(&of->of_reflock);
+	KASSERT(of->of_refcount > 0);
+	of->of_refcount++;
+	spinlock_release(&of->of_reflock);
+}
+
+/*
+ * Add a reference unless the count has already reached zero, that
+ * is, unless the file is being closed. For lookups under RCU.
+ */
+static
+bool
+openfile_tryincref(struct openfile *of)
+{
+	bool ok;
+
+	spinlock_acquire(&of->of_reflock);
+	ok = of->of_refcount > 0;
+	if (ok) {
+		of->of_refcount++;
+	}
+	spinlock_release(&of->of_reflock);
+	return ok;
+}
+
+void
+openfile_decref(struct openfile *of)
+{
+	bool last;
+
+	spinlock_acquire(&of->of_reflock);
+	KASSERT(of->of_refcount > 0);
+	of->of_refcount--;
+	last = of->of_refcount == 0;
+	spinlock_release(&of->of_reflock);
+
+	if (last) {
+		/*
+		 * Lookups that still see OF only ever touch the
+		 * reference count, and will find it zero, so the rest
+		 * can go now; only the memory has to wait.
+		 */
+		vfs_close(of->of_vnode);
+		lock_destroy(of->of_lock);
+		call_rcu(&of->of_rcu, openfile_free, of);
+	}
+}
+
+////////////////////////////////////////////////////////////
+
+struct filetable *
+filetable_create(void)
+{
+	struct filetable *ft;
+	int fd;
+
+	ft = kmalloc(sizeof(*ft));
+	if (ft == NULL) {
+		return NULL;
+	}
+	ft->ft_lock = lock_create("filetable");
+	if (ft->ft_lock == NULL) {
+		kfree(ft);
+		return NULL;
+	}
+	for (fd = 0; fd < OPEN_MAX; fd++) {
+		ft->ft_files[fd] = NULL;
+	}
+	return ft;
+}
+
+int
+filetable_copy(struct filetable *ft, struct filetable **ret)
+{
+	struct filetable *newft;
+	struct openfile *of;
+	int fd;
+
+	newft = filetable_create();
+	if (newft == NULL) {
+		return ENOMEM;
+	}
+
+	lock_acquire(ft->ft_lock);
+	for (fd = 0; fd < OPEN_MAX; fd++) {
+		of = ft->ft_files[fd];
+		if (of != NULL) {
+			openfile_incref(of);
+			newft->ft_files[fd] = of;
+		}
+	}
+	lock_release(ft->ft_lock);
+
+	*ret = newft;
+	return 0;
+}
+
+void
+filetable_destroy(struct filetable *ft)
+{
+	int fd;
+
+	for (fd = 0; fd < OPEN_MAX; fd++) {
+		if (ft->ft_files[fd] != NULL) {
+			openfile_decref(ft->ft_files[fd]);
+			ft->ft_files[fd] = NULL;
+		}
+	}
+	lock_destroy(ft->ft_lock);
+	kfree(ft);
+}
+
+/*
+ * The read path: no lock, just an RCU read section around loading
+ * the slot and taking the reference.
+ */
+int
+filetable_get(struct filetable *ft, int fd, struct openfile **ret)
+{
+	struct openfile *of;
+
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return EBADF;
+	}
+
+	rcu_read_lock();
+	of = ft->ft_files[fd];
+	if (of == NULL || !openfile_tryincref(of)) {
+		rcu_read_unlock();
+		return EBADF;
+	}
+	rcu_read_unlock();
+
+	*ret = of;
+	return 0;
+}
+
+int
+filetable_add(struct filetable *ft, struct openfile *of, int *ret)
+{
+	int fd;
+
+	lock_acquire(ft->ft_lock);
+	for (fd = 0; fd < OPEN_MAX; fd++) {
+		if (ft->ft_files[fd] == NULL) {
+			ft->ft_files[fd] = of;
+			lock_release(ft->ft_lock);
+			*ret = fd;
+			return 0;
+		}
+	}
+	lock_release(ft->ft_lock);
+	return EMFILE;
+}
+
+int
+filetable_set(struct filetable *ft, int fd, struct openfile *of,
+	      struct openfile **oldof)
+{
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return EBADF;
+	}
+
+	lock_acquire(ft->ft_lock);
+	*oldof = ft->ft_files[fd];
+	ft->ft_files[fd] = of;
+	lock_release(ft->ft_lock);
+	return 0;
+}
+
+int
+filetable_remove(struct filetable *ft, int fd, struct openfile **ret)
+{
+	struct openfile *of;
+
+	if (fd < 0 || fd >= OPEN_MAX) {
+		return EBADF;
+	}
+
+	lock_acquire(ft->ft_lock);
+	of = ft->ft_files[fd];
+	ft->ft_files[fd] = NULL;
+	lock_release(ft->ft_lock);
+
+	if (of == NULL) {
+		return EBADF;
+	}
+	*ret = of;
+	return 0;
+}
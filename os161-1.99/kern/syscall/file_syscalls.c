@@ -1,60 +1,736 @@
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/seek.h>
+#include <kern/stat.h>
 #include <kern/unistd.h>
+#include <limits.h>
 #include <lib.h>
+#include <copyinout.h>
 #include <uio.h>
 #include <syscall.h>
 #include <vnode.h>
 #include <vfs.h>
+#include <synch.h>
+#include <vm.h>
 #include <current.h>
 #include <proc.h>
+#include <file.h>
+#include <pipe.h>
 
-/* handler for write() system call                  */
 /*
- * n.b.
- * This implementation handles only writes to standard output 
- * and standard error, both of which go to the console.
- * Also, it does not provide any synchronization, so writes
- * are not atomic.
+ * File system calls. Descriptors are looked up in the process's file
+ * table (see file.h) without locking; the open file's own lock then
+ * covers the seek position for the duration of the I/O, so that
+ * concurrent reads or writes through one open file (say, after
+ * fork) each get their own stretch of the file. The positional calls
+ * (pread and friends) neither use nor lock the seek position.
  *
- * You will need to improve this implementation
- */
-
-int
-sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval)
-{
-  struct iovec iov;
-  struct uio u;
-  int res;
-
-  DEBUG(DB_SYSCALL,"Syscall: write(%d,%x,%d)\n",fdesc,(unsigned int)ubuf,nbytes);
-  
-  /* only stdout and stderr writes are currently implemented */
-  if (!((fdesc==STDOUT_FILENO)||(fdesc==STDERR_FILENO))) {
-    return EUNIMP;
-  }
-  KASSERT(curproc != NULL);
-  KASSERT(curproc->console != NULL);
-  KASSERT(curproc->p_addrspace != NULL);
-
-  /* set up a uio structure to refer to the user program's buffer (ubuf) */
-  iov.iov_ubase = ubuf;
-  iov.iov_len = nbytes;
-  u.uio_iov = &iov;
-  u.uio_iovcnt = 1;
-  u.uio_offset = 0;  /* not needed for the console */
-  u.uio_resid = nbytes;
-  u.uio_segflg = UIO_USERSPACE;
-  u.uio_rw = UIO_WRITE;
-  u.uio_space = curproc->p_addrspace;
-
-  res = VOP_WRITE(curproc->console,&u);
-  if (res) {
-    return res;
-  }
-
-  /* pass back the number of bytes actually written */
-  *retval = nbytes - u.uio_resid;
-  KASSERT(*retval >= 0);
-  return 0;
+ * All the read and write variants come down to one uio with as many
+ * iovecs as the caller gave, handed to the file system in one go.
+ */
+
+/*
+ * Vectors up to this long are copied onto the stack rather than
+ * into a kmalloc'd array.
+ */
+#define SMALL_IOVCNT	8
+
+/* Most bytes one call can move; the count has to fit in the result. */
+#define RW_MAX		0x7fffffff
+
+/*
+ * True if OF has a seek position; the console and pipes don't.
+ */
+static
+bool
+file_seekable(struct openfile *of)
+{
+	return VOP_TRYSEEK(of->of_vnode, 0) == 0;
+}
+
+/*
+ * Do the I/O described by U on OF, at POS if POSITIONAL and at the
+ * seek position otherwise, advancing the seek position past what
+ * was done in the latter case.
+ *
+ * The lock only protects the seek position, so things that don't
+ * have one (the console, pipes) are done without it. Otherwise a
+ * read waiting for console input would hold up every write to the
+ * same open file - and fds 0-2 are normally all the one open file.
+ */
+static
+int
+file_doio(struct openfile *of, struct uio *u, bool positional, off_t pos)
+{
+	struct stat st;
+	int accmode, result;
+
+	accmode = of->of_flags & O_ACCMODE;
+	if (u->uio_rw == UIO_READ ? accmode == O_WRONLY : accmode == O_RDONLY) {
+		return EBADF;
+	}
+
+	if (!positional && !file_seekable(of)) {
+		/* Not seekable; the offset means nothing. */
+		u->uio_offset = 0;
+		if (u->uio_rw == UIO_READ) {
+			return VOP_READ(of->of_vnode, u);
+		}
+		return VOP_WRITE(of->of_vnode, u);
+	}
+
+	if (positional) {
+		/* Fails with ESPIPE for things like the console. */
+		result = VOP_TRYSEEK(of->of_vnode, pos);
+		if (result) {
+			return result;
+		}
+		u->uio_offset = pos;
+		if (u->uio_rw == UIO_READ) {
+			return VOP_READ(of->of_vnode, u);
+		}
+		return VOP_WRITE(of->of_vnode, u);
+	}
+
+	lock_acquire(of->of_lock);
+	if (u->uio_rw == UIO_WRITE && (of->of_flags & O_APPEND)) {
+		result = VOP_STAT(of->of_vnode, &st);
+		if (result) {
+			lock_release(of->of_lock);
+			return result;
+		}
+		of->of_offset = st.st_size;
+	}
+	u->uio_offset = of->of_offset;
+	if (u->uio_rw == UIO_READ) {
+		result = VOP_READ(of->of_vnode, u);
+	}
+	else {
+		result = VOP_WRITE(of->of_vnode, u);
+	}
+	of->of_offset = u->uio_offset;
+	lock_release(of->of_lock);
+	return result;
+}
+
+/*
+ * Common code for all the reads and writes: IOV is already in the
+ * kernel, but the buffers it points to are the user's.
+ */
+static
+int
+file_rw(int fd, struct iovec *iov, int iovcnt, bool positional, off_t pos,
+	enum uio_rw rw, int *retval)
+{
+	struct openfile *of;
+	struct uio u;
+	size_t total;
+	int i, result;
+
+	if (positional && pos < 0) {
+		return EINVAL;
+	}
+
+	total = 0;
+	for (i = 0; i < iovcnt; i++) {
+		if (iov[i].iov_len > RW_MAX - total) {
+			return EINVAL;
+		}
+		total += iov[i].iov_len;
+	}
+
+	result = filetable_get(curproc->p_files, fd, &of);
+	if (result) {
+		return result;
+	}
+
+	u.uio_iov = iov;
+	u.uio_iovcnt = iovcnt;
+	u.uio_resid = total;
+	u.uio_segflg = UIO_USERSPACE;
+	u.uio_rw = rw;
+	u.uio_space = curproc->p_addrspace;
+
+	result = file_doio(of, &u, positional, pos);
+	openfile_decref(of);
+	if (result) {
+		return result;
+	}
+
+	*retval = total - u.uio_resid;
+	KASSERT(*retval >= 0);
+	if (rw == UIO_READ) {
+		curproc->p_usage.pu_inbytes += *retval;
+	}
+	else {
+		curproc->p_usage.pu_outbytes += *retval;
+	}
+	return 0;
+}
+
+/*
+ * Single-buffer read and write.
+ */
+static
+int
+file_rw1(int fd, userptr_t buf, size_t len, bool positional, off_t pos,
+	 enum uio_rw rw, int *retval)
+{
+	struct iovec iov;
+
+	iov.iov_ubase = buf;
+	iov.iov_len = len;
+	return file_rw(fd, &iov, 1, positional, pos, rw, retval);
+}
+
+/*
+ * Vectored read and write: copy the user's iovec array in with a
+ * single copyin, onto the stack if it is short.
+ */
+static
+int
+file_rwv(int fd, userptr_t uiov, int iovcnt, bool positional, off_t pos,
+	 enum uio_rw rw, int *retval)
+{
+	struct iovec smalliov[SMALL_IOVCNT];
+	struct iovec *iov;
+	int result;
+
+	if (iovcnt < 0 || iovcnt > IOV_MAX) {
+		return EINVAL;
+	}
+	if (iovcnt <= SMALL_IOVCNT) {
+		iov = smalliov;
+	}
+	else {
+		iov = kmalloc(iovcnt * sizeof(*iov));
+		if (iov == NULL) {
+			return ENOMEM;
+		}
+	}
+
+	result = copyin(uiov, iov, iovcnt * sizeof(*iov));
+	if (result == 0) {
+		result = file_rw(fd, iov, iovcnt, positional, pos, rw, retval);
+	}
+
+	if (iov != smalliov) {
+		kfree(iov);
+	}
+	return result;
+}
+
+/*
+ * Copy in a pathname for open, remove and rename.
+ */
+static
+int
+file_copyinpath(userptr_t upath, char **ret)
+{
+	char *path;
+	int result;
+
+	path = kmalloc(PATH_MAX);
+	if (path == NULL) {
+		return ENOMEM;
+	}
+	result = copyinstr(upath, path, PATH_MAX, NULL);
+	if (result) {
+		kfree(path);
+		return result;
+	}
+	*ret = path;
+	return 0;
+}
+
+int
+sys_open(userptr_t upath, int flags, mode_t mode, int *retval)
+{
+	struct openfile *of;
+	char *path;
+	int fd, result;
+
+	if ((flags & O_ACCMODE) == O_ACCMODE) {
+		return EINVAL;
+	}
+
+	result = file_copyinpath(upath, &path);
+	if (result) {
+		return result;
+	}
+
+	DEBUG(DB_SYSCALL,"Syscall: open(%s,%d)\n",path,flags);
+
+	result = openfile_open(path, flags, mode, &of);
+	kfree(path);
+	if (result) {
+		return result;
+	}
+
+	result = filetable_add(curproc->p_files, of, &fd);
+	if (result) {
+		openfile_decref(of);
+		return result;
+	}
+	*retval = fd;
+	return 0;
+}
+
+int
+sys_read(int fd, userptr_t buf, size_t len, int *retval)
+{
+	DEBUG(DB_SYSCALL,"Syscall: read(%d,%x,%d)\n",fd,(unsigned int)buf,len);
+	return file_rw1(fd, buf, len, false, 0, UIO_READ, retval);
+}
+
+int
+sys_write(int fd, userptr_t buf, size_t len, int *retval)
+{
+	DEBUG(DB_SYSCALL,"Syscall: write(%d,%x,%d)\n",fd,(unsigned int)buf,len);
+	return file_rw1(fd, buf, len, false, 0, UIO_WRITE, retval);
+}
+
+int
+sys_pread(int fd, userptr_t buf, size_t len, off_t pos, int *retval)
+{
+	return file_rw1(fd, buf, len, true, pos, UIO_READ, retval);
+}
+
+int
+sys_pwrite(int fd, userptr_t buf, size_t len, off_t pos, int *retval)
+{
+	return file_rw1(fd, buf, len, true, pos, UIO_WRITE, retval);
+}
+
+int
+sys_readv(int fd, userptr_t iov, int iovcnt, int *retval)
+{
+	return file_rwv(fd, iov, iovcnt, false, 0, UIO_READ, retval);
+}
+
+int
+sys_writev(int fd, userptr_t iov, int iovcnt, int *retval)
+{
+	return file_rwv(fd, iov, iovcnt, false, 0, UIO_WRITE, retval);
+}
+
+int
+sys_preadv(int fd, userptr_t iov, int iovcnt, off_t pos, int *retval)
+{
+	return file_rwv(fd, iov, iovcnt, true, pos, UIO_READ, retval);
+}
+
+int
+sys_pwritev(int fd, userptr_t iov, int iovcnt, off_t pos, int *retval)
+{
+	return file_rwv(fd, iov, iovcnt, true, pos, UIO_WRITE, retval);
+}
+
+int
+sys_close(int fd)
+{
+	struct openfile *of;
+	int result;
+
+	DEBUG(DB_SYSCALL,"Syscall: close(%d)\n",fd);
+
+	result = filetable_remove(curproc->p_files, fd, &of);
+	if (result) {
+		return result;
+	}
+	openfile_decref(of);
+	return 0;
+}
+
+int
+sys_lseek(int fd, off_t pos, int whence, off_t *retval)
+{
+	struct openfile *of;
+	struct stat st;
+	off_t newpos;
+	int result;
+
+	result = filetable_get(curproc->p_files, fd, &of);
+	if (result) {
+		return result;
+	}
+
+	lock_acquire(of->of_lock);
+	switch (whence) {
+	    case SEEK_SET:
+		newpos = pos;
+		break;
+	    case SEEK_CUR:
+		newpos = of->of_offset + pos;
+		break;
+	    case SEEK_END:
+		result = VOP_STAT(of->of_vnode, &st);
+		if (result) {
+			goto out;
+		}
+		newpos = st.st_size + pos;
+		break;
+	    default:
+		result = EINVAL;
+		goto out;
+	}
+	if (newpos < 0) {
+		result = EINVAL;
+		goto out;
+	}
+	result = VOP_TRYSEEK(of->of_vnode, newpos);
+	if (result) {
+		goto out;
+	}
+	of->of_offset = newpos;
+	*retval = newpos;
+
+ out:
+	lock_release(of->of_lock);
+	openfile_decref(of);
+	return result;
+}
+
+int
+sys_dup2(int oldfd, int newfd, int *retval)
+{
+	struct openfile *of, *oldof;
+	int result;
+
+	result = filetable_get(curproc->p_files, oldfd, &of);
+	if (result) {
+		return result;
+	}
+	if (oldfd == newfd) {
+		openfile_decref(of);
+		*retval = newfd;
+		return 0;
+	}
+
+	/* Our reference from the lookup becomes the new descriptor's. */
+	result = filetable_set(curproc->p_files, newfd, of, &oldof);
+	if (result) {
+		openfile_decref(of);
+		return result;
+	}
+	if (oldof != NULL) {
+		openfile_decref(oldof);
+	}
+	*retval = newfd;
+	return 0;
+}
+
+int
+sys_pipe(userptr_t fdsp)
+{
+	struct vnode *vn[2];
+	struct openfile *of[2];
+	int fds[2];
+	int i, result;
+
+	result = pipe_create(&vn[0], &vn[1]);
+	if (result) {
+		return result;
+	}
+
+	result = openfile_create(vn[0], O_RDONLY, &of[0]);
+	if (result) {
+		vfs_close(vn[0]);
+		vfs_close(vn[1]);
+		return result;
+	}
+	result = openfile_create(vn[1], O_WRONLY, &of[1]);
+	if (result) {
+		openfile_decref(of[0]);
+		vfs_close(vn[1]);
+		return result;
+	}
+
+	result = filetable_add(curproc->p_files, of[0], &fds[0]);
+	if (result) {
+		openfile_decref(of[0]);
+		openfile_decref(of[1]);
+		return result;
+	}
+	result = filetable_add(curproc->p_files, of[1], &fds[1]);
+	if (result) {
+		if (filetable_remove(curproc->p_files, fds[0], &of[0]) == 0) {
+			openfile_decref(of[0]);
+		}
+		openfile_decref(of[1]);
+		return result;
+	}
+
+	result = copyout(fds, fdsp, sizeof(fds));
+	if (result) {
+		for (i = 0; i < 2; i++) {
+			if (filetable_remove(curproc->p_files, fds[i],
+					     &of[i]) == 0) {
+				openfile_decref(of[i]);
+			}
+		}
+		return result;
+	}
+	return 0;
+}
+
+/*
+ * In-kernel copying between open files, for copy_file_range and
+ * sendfile. The data goes through a kernel buffer and never crosses
+ * into user space.
+ */
+
+/* Size of the kernel buffer used for copying. */
+#define COPY_BUFSIZE	(4 * PAGE_SIZE)
+
+/*
+ * Copy up to LEN bytes from IN at *INPOS to OUT at *OUTPOS, advancing
+ * both positions past what was copied. Stops early at end of file, or
+ * after a short read, as from a pipe with no more data yet. If some
+ * data was copied before an error, reports that instead of the error.
+ */
+static
+int
+file_copy(struct openfile *in, off_t *inpos, struct openfile *out,
+	  off_t *outpos, size_t len, size_t *done)
+{
+	struct iovec iov;
+	struct uio u;
+	char *buf;
+	size_t n, got, put;
+	int result;
+
+	buf = kmalloc(COPY_BUFSIZE);
+	if (buf == NULL) {
+		return ENOMEM;
+	}
+
+	*done = 0;
+	result = 0;
+	while (len > 0) {
+		n = len < COPY_BUFSIZE ? len : COPY_BUFSIZE;
+		uio_kinit(&iov, &u, buf, n, *inpos, UIO_READ);
+		result = VOP_READ(in->of_vnode, &u);
+		if (result) {
+			break;
+		}
+		got = n - u.uio_resid;
+		if (got == 0) {
+			break;
+		}
+
+		put = 0;
+		while (put < got) {
+			uio_kinit(&iov, &u, buf + put, got - put, *outpos,
+				  UIO_WRITE);
+			result = VOP_WRITE(out->of_vnode, &u);
+			*outpos += (got - put) - u.uio_resid;
+			*done += (got - put) - u.uio_resid;
+			put = got - u.uio_resid;
+			if (result) {
+				break;
+			}
+		}
+		/*
+		 * Only what was written counts as consumed, so that
+		 * after a short write the input position still points
+		 * at the first byte not copied.
+		 */
+		*inpos += put;
+		if (result || got < n) {
+			break;
+		}
+		len -= got;
+	}
+
+	kfree(buf);
+	return *done > 0 ? 0 : result;
+}
+
+/*
+ * Work out where in OF to copy from or to: at the user's offset at
+ * UPOS if it isn't NULL, and at the file's seek position otherwise
+ * (which for things that can't seek means nothing).
+ */
+static
+int
+file_copypos(struct openfile *of, bool seekable, userptr_t upos, off_t *pos)
+{
+	int result;
+
+	if (upos == NULL) {
+		*pos = seekable ? of->of_offset : 0;
+		return 0;
+	}
+	result = copyin(upos, pos, sizeof(*pos));
+	if (result) {
+		return result;
+	}
+	if (*pos < 0) {
+		return EINVAL;
+	}
+	return VOP_TRYSEEK(of->of_vnode, *pos);
+}
+
+/*
+ * Common code for copy_file_range and sendfile. Each seek position
+ * used is locked for the duration; when both are, the locks are
+ * taken in address order so that opposite copies cannot deadlock.
+ * As in file_doio, objects without a seek position are not locked,
+ * so a copy waiting on a pipe or the console holds nothing up.
+ */
+static
+int
+file_copyrange(int infd, userptr_t uinpos, int outfd, userptr_t uoutpos,
+	       size_t len, int *retval)
+{
+	struct openfile *in, *out;
+	struct lock *lk1, *lk2, *tmp;
+	bool inseek, outseek;
+	off_t inpos, outpos;
+	size_t done;
+	int result;
+
+	if (len > RW_MAX) {
+		len = RW_MAX;
+	}
+
+	result = filetable_get(curproc->p_files, infd, &in);
+	if (result) {
+		return result;
+	}
+	result = filetable_get(curproc->p_files, outfd, &out);
+	if (result) {
+		openfile_decref(in);
+		return result;
+	}
+
+	if ((in->of_flags & O_ACCMODE) == O_WRONLY ||
+	    (out->of_flags & O_ACCMODE) == O_RDONLY ||
+	    (out->of_flags & O_APPEND)) {
+		result = EBADF;
+		goto out;
+	}
+	inseek = file_seekable(in);
+	outseek = file_seekable(out);
+	if (in == out && inseek && uinpos == NULL && uoutpos == NULL) {
+		/* Both ends would be the one seek position. */
+		result = EINVAL;
+		goto out;
+	}
+
+	lk1 = uinpos == NULL && inseek ? in->of_lock : NULL;
+	lk2 = uoutpos == NULL && outseek ? out->of_lock : NULL;
+	if (lk1 == NULL || (lk2 != NULL && lk2 < lk1)) {
+		tmp = lk1;
+		lk1 = lk2;
+		lk2 = tmp;
+	}
+	if (lk1 != NULL) {
+		lock_acquire(lk1);
+	}
+	if (lk2 != NULL) {
+		lock_acquire(lk2);
+	}
+
+	result = file_copypos(in, inseek, uinpos, &inpos);
+	if (result) {
+		goto unlock;
+	}
+	result = file_copypos(out, outseek, uoutpos, &outpos);
+	if (result) {
+		goto unlock;
+	}
+
+	result = file_copy(in, &inpos, out, &outpos, len, &done);
+	if (result) {
+		goto unlock;
+	}
+
+	if (uinpos == NULL) {
+		if (inseek) {
+			in->of_offset = inpos;
+		}
+	}
+	else {
+		result = copyout(&inpos, uinpos, sizeof(inpos));
+	}
+	if (uoutpos == NULL) {
+		if (outseek) {
+			out->of_offset = outpos;
+		}
+	}
+	else if (result == 0) {
+		result = copyout(&outpos, uoutpos, sizeof(outpos));
+	}
+	if (result == 0) {
+		*retval = done;
+		curproc->p_usage.pu_inbytes += done;
+		curproc->p_usage.pu_outbytes += done;
+	}
+
+ unlock:
+	if (lk2 != NULL) {
+		lock_release(lk2);
+	}
+	if (lk1 != NULL) {
+		lock_release(lk1);
+	}
+ out:
+	openfile_decref(out);
+	openfile_decref(in);
+	return result;
+}
+
+int
+sys_copy_file_range(int infd, userptr_t inpos, int outfd, userptr_t outpos,
+		    size_t len, unsigned flags, int *retval)
+{
+	if (flags != 0) {
+		return EINVAL;
+	}
+	return file_copyrange(infd, inpos, outfd, outpos, len, retval);
+}
+
+int
+sys_sendfile(int outfd, int infd, userptr_t inpos, size_t len, int *retval)
+{
+	return file_copyrange(infd, inpos, outfd, NULL, len, retval);
+}
+
+int
+sys_remove(userptr_t upath)
+{
+	char *path;
+	int result;
+
+	result = file_copyinpath(upath, &path);
+	if (result) {
+		return result;
+	}
+	result = vfs_remove(path);
+	kfree(path);
+	return result;
+}
+
+int
+sys_rename(userptr_t uold, userptr_t unew)
+{
+	char *oldpath, *newpath;
+	int result;
+
+	result = file_copyinpath(uold, &oldpath);
+	if (result) {
+		return result;
+	}
+	result = file_copyinpath(unew, &newpath);
+	if (result) {
+		kfree(oldpath);
+		return result;
+	}
+	result = vfs_rename(oldpath, newpath);
+	kfree(newpath);
+	kfree(oldpath);
+	return result;
 }
@@ -0,0 +1,316 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Futex system calls.
+ *
+ * Each waiter puts a record on the list of one of a fixed number of
+ * hash buckets, chosen by its (address space, user address) key, and
+ * sleeps on the bucket's wait channel. Several keys can share a
+ * bucket, so futex_wake marks exactly the records it means to wake
+ * and then wakes the whole channel; the others see they weren't
+ * chosen and go back to sleep. Timeouts are callouts that mark the
+ * record in the same way.
+ *
+ * The bucket's sleep lock protects its list and is held while the
+ * user word is checked, so a wake that follows a change to the word
+ * can't slip in between the check and the sleep. (The check is a
+ * copyin, which may fault, so this can't be a spinlock.) The waiter
+ * locks the wait channel before dropping the bucket lock, in the same
+ * way wchan_sleep is used elsewhere.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
+#include <lib.h>
+#include <clock.h>
+#include <copyinout.h>
+#include <synch.h>
+#include <wchan.h>
+#include <proc.h>
+#include <futex.h>
+#include <syscall.h>
+
+#define FUTEX_HASHSIZE	64
+
+struct futex_waiter {
+	struct futex_waiter *fw_next;	/* Link in bucket list */
+	struct addrspace *fw_as;	/* Key: address space */
+	vaddr_t fw_addr;		/* Key: user address */
+	struct wchan *fw_wchan;		/* Bucket's channel, for timeout */
+	struct callout fw_callout;	/* Timeout */
+	volatile bool fw_woken;		/* Chosen by futex_wake */
+	volatile bool fw_timedout;	/* Timeout expired */
+};
+
+struct futex_bucket {
+	struct lock *fb_lock;		/* Protects fb_waiters */
+	struct wchan *fb_wchan;		/* Where the waiters sleep */
+	struct futex_waiter *fb_waiters; /* Waiters, oldest first */
+};
+
+static struct futex_bucket futex_table[FUTEX_HASHSIZE];
+
+/*
+ * Setup.
+ */
+void
+futex_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<FUTEX_HASHSIZE; i++) {
+		futex_table[i].fb_lock = lock_create("futex");
+		futex_table[i].fb_wchan = wchan_create("futex");
+		if (futex_table[i].fb_lock == NULL ||
+		    futex_table[i].fb_wchan == NULL) {
+			panic("futex_bootstrap: Out of memory\n");
+		}
+		futex_table[i].fb_waiters = NULL;
+	}
+}
+
+/*
+ * Find the bucket for a key. Addresses are word-aligned, so the low
+ * bits are dropped before mixing in the address space.
+ */
+static
+struct futex_bucket *
+futex_hash(struct addrspace *as, vaddr_t addr)
+{
+	uintptr_t h;
+
+	h = (addr >> 2) ^ ((uintptr_t)as >> 4);
+	h ^= h >> 11;
+	return &futex_table[h % FUTEX_HASHSIZE];
+}
+
+/*
+ * Take a waiter off its bucket's list. The bucket must be locked.
+ */
+static
+void
+futex_unlink(struct futex_bucket *fb, struct futex_waiter *fw)
+{
+	struct futex_waiter **fwp;
+
+	KASSERT(lock_do_i_hold(fb->fb_lock));
+
+	for (fwp = &fb->fb_waiters; *fwp != NULL; fwp = &(*fwp)->fw_next) {
+		if (*fwp == fw) {
+			*fwp = fw->fw_next;
+			fw->fw_next = NULL;
+			return;
+		}
+	}
+	panic("futex: waiter %p not on its bucket\n", fw);
+}
+
+/*
+ * Callout function for timeouts. As in clock_wakesleeper, the flag
+ * is set last and under the channel lock; after that the waiter may
+ * return and its record vanish.
+ */
+static
+void
+futex_timeout(void *vfw)
+{
+	struct futex_waiter *fw = vfw;
+	struct wchan *wc;
+
+	wc = fw->fw_wchan;
+	wchan_lock(wc);
+	fw->fw_timedout = true;
+	wchan_unlock(wc);
+	wchan_wakeall(wc);
+}
+
+/*
+ * futex_wait: if the int at USER_ADDR holds VAL, sleep until woken
+ * by futex_wake on the same address or until the relative timeout in
+ * *USER_TIMEOUT (if not null) runs out. Timeouts are rounded up to
+ * whole ticks and clamped to CALLOUT_MAXTICKS.
+ *
+ * Returns EAGAIN if the word didn't hold VAL, ETIMEDOUT on timeout.
+ */
+int
+sys_futex_wait(userptr_t user_addr, int val, const_userptr_t user_timeout)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter fw;
+	struct timespec ts;
+	uint64_t nsecs, ticks = 0;
+	int cur;
+	int result;
+
+	if ((vaddr_t)user_addr % sizeof(int) != 0) {
+		return EINVAL;
+	}
+
+	if (user_timeout != NULL) {
+		result = copyin(user_timeout, &ts, sizeof(ts));
+		if (result) {
+			return result;
+		}
+		if (ts.tv_sec < 0 || ts.tv_nsec < 0 ||
+		    ts.tv_nsec >= 1000000000) {
+			return EINVAL;
+		}
+		nsecs = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+		ticks = DIVROUNDUP(nsecs, 1000000000 / HZ);
+		if (ticks > CALLOUT_MAXTICKS) {
+			ticks = CALLOUT_MAXTICKS;
+		}
+	}
+
+	fw.fw_next = NULL;
+	fw.fw_as = curproc_getas();
+	fw.fw_addr = (vaddr_t)user_addr;
+	fw.fw_woken = false;
+	fw.fw_timedout = false;
+
+	fb = futex_hash(fw.fw_as, fw.fw_addr);
+	fw.fw_wchan = fb->fb_wchan;
+
+	lock_acquire(fb->fb_lock);
+
+	result = copyin(user_addr, &cur, sizeof(cur));
+	if (result) {
+		lock_release(fb->fb_lock);
+		return result;
+	}
+	if (cur != val) {
+		lock_release(fb->fb_lock);
+		return EAGAIN;
+	}
+	if (user_timeout != NULL && ticks == 0) {
+		/* Zero timeout: just a check */
+		lock_release(fb->fb_lock);
+		return ETIMEDOUT;
+	}
+
+	/* Join the end of the list, so wakeups are first come first served */
+	{
+		struct futex_waiter **fwp;
+
+		for (fwp = &fb->fb_waiters; *fwp != NULL;
+		     fwp = &(*fwp)->fw_next) {
+			/* nothing */
+		}
+		*fwp = &fw;
+	}
+
+	if (ticks > 0) {
+		callout_init(&fw.fw_callout, futex_timeout, &fw);
+		callout_schedule(&fw.fw_callout, ticks);
+	}
+
+	wchan_lock(fb->fb_wchan);
+	lock_release(fb->fb_lock);
+	while (!fw.fw_woken && !fw.fw_timedout) {
+		wchan_sleep(fb->fb_wchan);
+		wchan_lock(fb->fb_wchan);
+	}
+	wchan_unlock(fb->fb_wchan);
+
+	/*
+	 * If the timeout was already dispatched, its function may
+	 * still be about to run; wait for it to finish with FW.
+	 */
+	if (ticks > 0 && !callout_stop(&fw.fw_callout)) {
+		wchan_lock(fb->fb_wchan);
+		while (!fw.fw_timedout) {
+			wchan_sleep(fb->fb_wchan);
+			wchan_lock(fb->fb_wchan);
+		}
+		wchan_unlock(fb->fb_wchan);
+	}
+
+	/*
+	 * futex_wake takes chosen waiters off the list itself. If we
+	 * timed out, take ourselves off, unless a wake got to us
+	 * first - in which case it counted us, so report success.
+	 */
+	if (!fw.fw_woken) {
+		lock_acquire(fb->fb_lock);
+		if (!fw.fw_woken) {
+			futex_unlink(fb, &fw);
+		}
+		lock_release(fb->fb_lock);
+	}
+
+	return fw.fw_woken ? 0 : ETIMEDOUT;
+}
+
+/*
+ * futex_wake: wake up to NWAKE threads waiting on USER_ADDR in the
+ * current address space, oldest first. Hands back the number woken.
+ */
+int
+sys_futex_wake(userptr_t user_addr, int nwake, int *retval)
+{
+	struct futex_bucket *fb;
+	struct futex_waiter **fwp, *fw;
+	struct addrspace *as;
+	vaddr_t addr;
+	int count = 0;
+
+	if ((vaddr_t)user_addr % sizeof(int) != 0 || nwake < 0) {
+		return EINVAL;
+	}
+
+	as = curproc_getas();
+	addr = (vaddr_t)user_addr;
+	fb = futex_hash(as, addr);
+
+	lock_acquire(fb->fb_lock);
+	fwp = &fb->fb_waiters;
+	while (count < nwake && (fw = *fwp) != NULL) {
+		if (fw->fw_as != as || fw->fw_addr != addr) {
+			fwp = &fw->fw_next;
+			continue;
+		}
+		*fwp = fw->fw_next;
+		fw->fw_next = NULL;
+
+		/* Last touch of FW; the waiter may return after this. */
+		wchan_lock(fb->fb_wchan);
+		fw->fw_woken = true;
+		wchan_unlock(fb->fb_wchan);
+		count++;
+	}
+	if (count > 0) {
+		wchan_wakeall(fb->fb_wchan);
+	}
+	lock_release(fb->fb_lock);
+
+	*retval = count;
+	return 0;
+}
@@ -42,6 +42,11 @@
  * circumstances, as_prepare_load and as_complete_load probably don't
  * need to do anything.
  *
+ * The headers and the file contents of each segment are first read
+ * into a struct execimage, which is kept in the exec cache (see
+ * execcache.h); running the same file again loads from that instead
+ * of reading the file.
+ *
  * If you wanted to support memory-mapped executables you would need
  * to rearrange this to map each segment.
  *
@@ -59,15 +64,15 @@
 #include <addrspace.h>
 #include <vnode.h>
 #include <elf.h>
+#include <execcache.h>
 
 /*
- * Load a segment at virtual address VADDR. The segment in memory
- * extends from VADDR up to (but not including) VADDR+MEMSIZE. The
- * segment on disk is located at file offset OFFSET and has length
- * FILESIZE.
+ * Load segment ES into the address space AS. The segment in memory
+ * extends from es_vaddr up to (but not including) es_vaddr+es_memsize.
+ * Its contents from the file, es_filesize bytes, are in es_data.
  *
- * FILESIZE may be less than MEMSIZE; if so the remaining portion of
- * the in-memory segment should be zero-filled.
+ * es_filesize may be less than es_memsize; if so the remaining
+ * portion of the in-memory segment should be zero-filled.
  *
  * Note that uiomove will catch it if someone tries to load an
  * executable whose load address is in kernel space. If you should
@@ -76,44 +81,30 @@
  */
 static
 int
-load_segment(struct addrspace *as, struct vnode *v,
-	     off_t offset, vaddr_t vaddr, 
-	     size_t memsize, size_t filesize,
-	     int is_executable)
+load_segment(struct addrspace *as, const struct execseg *es)
 {
 	struct iovec iov;
 	struct uio u;
 	int result;
 
-	if (filesize > memsize) {
-		kprintf("ELF: warning: segment filesize > segment memsize\n");
-		filesize = memsize;
-	}
-
 	DEBUG(DB_EXEC, "ELF: Loading %lu bytes to 0x%lx\n", 
-	      (unsigned long) filesize, (unsigned long) vaddr);
+	      (unsigned long) es->es_filesize, (unsigned long) es->es_vaddr);
 
-	iov.iov_ubase = (userptr_t)vaddr;
-	iov.iov_len = memsize;		 // length of the memory space
+	iov.iov_ubase = (userptr_t)es->es_vaddr;
+	iov.iov_len = es->es_memsize;	 // length of the memory space
 	u.uio_iov = &iov;
 	u.uio_iovcnt = 1;
-	u.uio_resid = filesize;          // amount to read from the file
-	u.uio_offset = offset;
-	u.uio_segflg = is_executable ? UIO_USERISPACE : UIO_USERSPACE;
+	u.uio_resid = es->es_filesize;   // amount to copy in
+	u.uio_offset = 0;
+	u.uio_segflg = (es->es_flags & PF_X) ? UIO_USERISPACE : UIO_USERSPACE;
 	u.uio_rw = UIO_READ;
 	u.uio_space = as;
 
-	result = VOP_READ(v, &u);
+	result = uiomove(es->es_data, es->es_filesize, &u);
 	if (result) {
 		return result;
 	}
 
-	if (u.uio_resid != 0) {
-		/* short read; problem with executable? */
-		kprintf("ELF: short read on segment - file truncated?\n");
-		return ENOEXEC;
-	}
-
 	/*
 	 * If memsize > filesize, the remaining space should be
 	 * zero-filled. There is no need to do this explicitly,
@@ -132,7 +123,7 @@ load_segment(struct addrspace *as, struct vnode *v,
 	{
 		size_t fillamt;
 
-		fillamt = memsize - filesize;
+		fillamt = es->es_memsize - es->es_filesize;
 		if (fillamt > 0) {
 			DEBUG(DB_EXEC, "ELF: Zero-filling %lu more bytes\n", 
 			      (unsigned long) fillamt);
@@ -146,21 +137,55 @@ load_segment(struct addrspace *as, struct vnode *v,
 }
 
 /*
- * Load an ELF executable user program into the current address space.
- *
- * Returns the entry point (initial PC) for the program in ENTRYPOINT.
+ * Read the contents of segment ES from file offset OFFSET.
  */
+static
 int
-load_elf(struct vnode *v, vaddr_t *entrypoint)
+read_segment(struct vnode *v, off_t offset, struct execseg *es)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	if (es->es_filesize == 0) {
+		return 0;
+	}
+	es->es_data = kmalloc(es->es_filesize);
+	if (es->es_data == NULL) {
+		return ENOMEM;
+	}
+
+	uio_kinit(&iov, &ku, es->es_data, es->es_filesize, offset, UIO_READ);
+	result = VOP_READ(v, &ku);
+	if (result) {
+		return result;
+	}
+
+	if (ku.uio_resid != 0) {
+		/* short read; problem with executable? */
+		kprintf("ELF: short read on segment - file truncated?\n");
+		return ENOEXEC;
+	}
+	return 0;
+}
+
+/*
+ * Read and check the headers of the ELF executable V, and read in
+ * its loadable segments, to make an image for the exec cache.
+ */
+static
+int
+read_image(struct vnode *v, struct execimage **ret)
 {
 	Elf_Ehdr eh;   /* Executable header */
 	Elf_Phdr ph;   /* "Program header" = segment header */
+	struct execimage *ei;
+	struct execseg *es;
+	char *phdrs;
+	size_t phsize;
 	int result, i;
 	struct iovec iov;
 	struct uio ku;
-	struct addrspace *as;
-
-	as = curproc_getas();
 
 	/*
 	 * Read the executable header from offset 0 in the file.
@@ -203,12 +228,7 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	}
 
 	/*
-	 * Go through the list of segments and set up the address space.
-	 *
-	 * Ordinarily there will be one code segment, one read-only
-	 * data segment, and one data/bss segment, but there might
-	 * conceivably be more. You don't need to support such files
-	 * if it's unduly awkward to do so.
+	 * Read all the program headers at once.
 	 *
 	 * Note that the expression eh.e_phoff + i*eh.e_phentsize is 
 	 * mandated by the ELF standard - we use sizeof(ph) to load,
@@ -217,20 +237,49 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	 * to find where the phdr starts.
 	 */
 
-	for (i=0; i<eh.e_phnum; i++) {
-		off_t offset = eh.e_phoff + i*eh.e_phentsize;
-		uio_kinit(&iov, &ku, &ph, sizeof(ph), offset, UIO_READ);
+	if (eh.e_phentsize < sizeof(ph)) {
+		return ENOEXEC;
+	}
+	phsize = eh.e_phnum * eh.e_phentsize;
+	if (phsize > PAGE_SIZE) {
+		kprintf("ELF: too many program headers\n");
+		return ENOEXEC;
+	}
+	phdrs = kmalloc(phsize);
+	if (phdrs == NULL) {
+		return ENOMEM;
+	}
+	uio_kinit(&iov, &ku, phdrs, phsize, eh.e_phoff, UIO_READ);
+	result = VOP_READ(v, &ku);
+	if (result) {
+		kfree(phdrs);
+		return result;
+	}
+	if (ku.uio_resid != 0) {
+		/* short read; problem with executable? */
+		kprintf("ELF: short read on phdr - file truncated?\n");
+		kfree(phdrs);
+		return ENOEXEC;
+	}
 
-		result = VOP_READ(v, &ku);
-		if (result) {
-			return result;
-		}
+	ei = execimage_create(v);
+	if (ei == NULL) {
+		kfree(phdrs);
+		return ENOMEM;
+	}
+	ei->ei_entrypoint = eh.e_entry;
 
-		if (ku.uio_resid != 0) {
-			/* short read; problem with executable? */
-			kprintf("ELF: short read on phdr - file truncated?\n");
-			return ENOEXEC;
-		}
+	/*
+	 * Go through the list of segments and read in the loadable ones.
+	 *
+	 * Ordinarily there will be one code segment, one read-only
+	 * data segment, and one data/bss segment, but there might
+	 * conceivably be more. You don't need to support such files
+	 * if it's unduly awkward to do so.
+	 */
+
+	for (i=0; i<eh.e_phnum; i++) {
+		memcpy(&ph, phdrs + i*eh.e_phentsize, sizeof(ph));
 
 		switch (ph.p_type) {
 		    case PT_NULL: /* skip */ continue;
@@ -240,68 +289,106 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 		    default:
 			kprintf("loadelf: unknown segment type %d\n", 
 				ph.p_type);
-			return ENOEXEC;
+			result = ENOEXEC;
+			goto fail;
 		}
 
-		result = as_define_region(as,
-					  ph.p_vaddr, ph.p_memsz,
-					  ph.p_flags & PF_R,
-					  ph.p_flags & PF_W,
-					  ph.p_flags & PF_X);
+		if (ei->ei_nsegs == EXECIMAGE_MAXSEGS) {
+			kprintf("loadelf: too many segments\n");
+			result = ENOEXEC;
+			goto fail;
+		}
+		es = &ei->ei_segs[ei->ei_nsegs++];
+		es->es_vaddr = ph.p_vaddr;
+		es->es_memsize = ph.p_memsz;
+		es->es_filesize = ph.p_filesz;
+		es->es_flags = ph.p_flags;
+		if (es->es_filesize > es->es_memsize) {
+			kprintf("ELF: warning: segment filesize > segment memsize\n");
+			es->es_filesize = es->es_memsize;
+		}
+
+		result = read_segment(v, ph.p_offset, es);
 		if (result) {
-			return result;
+			goto fail;
 		}
+		ei->ei_bytes += es->es_filesize;
+		curproc->p_usage.pu_vmstats[VMSTAT_ELF_FILE_READ] +=
+			DIVROUNDUP(es->es_filesize, PAGE_SIZE);
 	}
 
-	result = as_prepare_load(as);
-	if (result) {
-		return result;
-	}
+	kfree(phdrs);
+	*ret = ei;
+	return 0;
 
-	/*
-	 * Now actually load each segment.
-	 */
+ fail:
+	kfree(phdrs);
+	execimage_release(ei);
+	return result;
+}
 
-	for (i=0; i<eh.e_phnum; i++) {
-		off_t offset = eh.e_phoff + i*eh.e_phentsize;
-		uio_kinit(&iov, &ku, &ph, sizeof(ph), offset, UIO_READ);
+/*
+ * Load an ELF executable user program into the current address space.
+ *
+ * Returns the entry point (initial PC) for the program in ENTRYPOINT.
+ */
+int
+load_elf(struct vnode *v, vaddr_t *entrypoint)
+{
+	struct execimage *ei;
+	const struct execseg *es;
+	struct addrspace *as;
+	unsigned gen, i;
+	int result;
+
+	as = curproc_getas();
 
-		result = VOP_READ(v, &ku);
+	ei = execcache_get(v, &gen);
+	if (ei == NULL) {
+		result = read_image(v, &ei);
 		if (result) {
 			return result;
 		}
+		execcache_put(ei, gen);
+	}
 
-		if (ku.uio_resid != 0) {
-			/* short read; problem with executable? */
-			kprintf("ELF: short read on phdr - file truncated?\n");
-			return ENOEXEC;
-		}
+	/*
+	 * Set up the address space, then copy each segment in.
+	 */
 
-		switch (ph.p_type) {
-		    case PT_NULL: /* skip */ continue;
-		    case PT_PHDR: /* skip */ continue;
-		    case PT_MIPS_REGINFO: /* skip */ continue;
-		    case PT_LOAD: break;
-		    default:
-			kprintf("loadelf: unknown segment type %d\n", 
-				ph.p_type);
-			return ENOEXEC;
+	for (i=0; i<ei->ei_nsegs; i++) {
+		es = &ei->ei_segs[i];
+		result = as_define_region(as,
+					  es->es_vaddr, es->es_memsize,
+					  es->es_flags & PF_R,
+					  es->es_flags & PF_W,
+					  es->es_flags & PF_X);
+		if (result) {
+			goto out;
 		}
+	}
 
-		result = load_segment(as, v, ph.p_offset, ph.p_vaddr, 
-				      ph.p_memsz, ph.p_filesz,
-				      ph.p_flags & PF_X);
+	result = as_prepare_load(as);
+	if (result) {
+		goto out;
+	}
+
+	for (i=0; i<ei->ei_nsegs; i++) {
+		result = load_segment(as, &ei->ei_segs[i]);
 		if (result) {
-			return result;
+			goto out;
 		}
 	}
 
 	result = as_complete_load(as);
 	if (result) {
-		return result;
+		goto out;
 	}
 
-	*entrypoint = eh.e_entry;
+	*entrypoint = ei->ei_entrypoint;
 	as->elf_done = 1;
-	return 0;
+
+ out:
+	execimage_release(ei);
+	return result;
 }
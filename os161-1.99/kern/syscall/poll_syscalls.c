@@ -0,0 +1,472 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * poll and select.
+ *
+ * A poll goes over the descriptors asking each vnode, with
+ * VOP_POLL, which of the events it wants are ready. If none are, it
+ * goes over them again, this time handing each one a pollent to
+ * queue on the object's pollq, and then sleeps until one of the
+ * objects calls pollq_wakeup or the timeout runs out, and starts
+ * over. The pollents stay queued until the call returns, so nothing
+ * that happens after the second pass can be missed.
+ *
+ * Pollers sleep on one of a fixed set of wait channels, chosen by
+ * the address of their pollwaiter record, and check their own flags
+ * on waking, as clock_sleepticks and the futex code do. Timeouts are
+ * callouts, so they come from the hardclock.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/limits.h>
+#include <kern/poll.h>
+#include <kern/select.h>
+#include <kern/time.h>
+#include <lib.h>
+#include <clock.h>
+#include <copyinout.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <proc.h>
+#include <current.h>
+#include <vnode.h>
+#include <file.h>
+#include <poll.h>
+#include <syscall.h>
+
+#define POLL_HASHSIZE	16
+
+struct pollwaiter {
+	struct wchan *pw_wchan;		/* Where we sleep */
+	struct callout pw_callout;	/* Timeout */
+	volatile bool pw_woken;		/* Something we polled changed */
+	volatile bool pw_timedout;	/* Timeout expired */
+};
+
+static struct wchan *poll_wchans[POLL_HASHSIZE];
+
+/*
+ * Setup.
+ */
+void
+poll_bootstrap(void)
+{
+	unsigned i;
+
+	for (i=0; i<POLL_HASHSIZE; i++) {
+		poll_wchans[i] = wchan_create("poll");
+		if (poll_wchans[i] == NULL) {
+			panic("poll_bootstrap: Out of memory\n");
+		}
+	}
+}
+
+////////////////////////////////////////////////////////////
+// Poll queues
+
+void
+pollq_init(struct pollq *pq)
+{
+	spinlock_init(&pq->pq_lock);
+	pq->pq_ents = NULL;
+}
+
+void
+pollq_cleanup(struct pollq *pq)
+{
+	KASSERT(pq->pq_ents == NULL);
+	spinlock_cleanup(&pq->pq_lock);
+}
+
+/*
+ * Queue PE on PQ, unless it is already queued (the same pollent
+ * comes back on each pass of a poll).
+ */
+void
+pollq_add(struct pollq *pq, struct pollent *pe)
+{
+	if (pe->pe_q != NULL) {
+		KASSERT(pe->pe_q == pq);
+		return;
+	}
+
+	spinlock_acquire(&pq->pq_lock);
+	pe->pe_next = pq->pq_ents;
+	pe->pe_prevp = &pq->pq_ents;
+	if (pq->pq_ents != NULL) {
+		pq->pq_ents->pe_prevp = &pe->pe_next;
+	}
+	pq->pq_ents = pe;
+	pe->pe_q = pq;
+	spinlock_release(&pq->pq_lock);
+}
+
+/*
+ * Take PE off whatever queue it is on.
+ */
+static
+void
+pollq_remove(struct pollent *pe)
+{
+	struct pollq *pq = pe->pe_q;
+
+	if (pq == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&pq->pq_lock);
+	*pe->pe_prevp = pe->pe_next;
+	if (pe->pe_next != NULL) {
+		pe->pe_next->pe_prevp = pe->pe_prevp;
+	}
+	spinlock_release(&pq->pq_lock);
+	pe->pe_q = NULL;
+}
+
+/*
+ * Wake everyone polling PQ. The waiters' records are touched only
+ * while PQ is locked, so once a poller has taken its pollents off
+ * the queue they are safe to throw away.
+ */
+void
+pollq_wakeup(struct pollq *pq)
+{
+	struct pollent *pe;
+	struct pollwaiter *pw;
+
+	spinlock_acquire(&pq->pq_lock);
+	for (pe = pq->pq_ents; pe != NULL; pe = pe->pe_next) {
+		pw = pe->pe_waiter;
+		wchan_lock(pw->pw_wchan);
+		pw->pw_woken = true;
+		wchan_unlock(pw->pw_wchan);
+		wchan_wakeall(pw->pw_wchan);
+	}
+	spinlock_release(&pq->pq_lock);
+}
+
+////////////////////////////////////////////////////////////
+// Polling
+
+/*
+ * Callout function for timeouts. As in clock_wakesleeper, the flag
+ * is set last and under the channel lock; after that the waiter may
+ * return and its record vanish.
+ */
+static
+void
+poll_timeout(void *vpw)
+{
+	struct pollwaiter *pw = vpw;
+	struct wchan *wc;
+
+	wc = pw->pw_wchan;
+	wchan_lock(wc);
+	pw->pw_timedout = true;
+	wchan_unlock(wc);
+	wchan_wakeall(wc);
+}
+
+/*
+ * Convert a timeout to ticks, rounding up and clamping to
+ * CALLOUT_MAXTICKS.
+ */
+static
+unsigned
+poll_ticks(uint64_t nsecs)
+{
+	uint64_t ticks;
+
+	ticks = DIVROUNDUP(nsecs, 1000000000 / HZ);
+	if (ticks > CALLOUT_MAXTICKS) {
+		ticks = CALLOUT_MAXTICKS;
+	}
+	return ticks;
+}
+
+/*
+ * The guts of poll and select: fill in the revents of the NFDS
+ * entries in FDS, waiting up to TICKS ticks (forever if FOREVER) for
+ * at least one to be ready. Hands back the number of entries with
+ * nonzero revents.
+ */
+static
+int
+poll_wait(struct pollfd *fds, unsigned nfds, bool forever, unsigned ticks,
+	  int *nready)
+{
+	struct pollwaiter pw;
+	struct pollent *pes;
+	struct openfile **ofs;
+	bool queued, armed;
+	int revents, n;
+	unsigned i;
+
+	pes = kmalloc(nfds * sizeof(*pes));
+	ofs = kmalloc(nfds * sizeof(*ofs));
+	if ((nfds > 0 && pes == NULL) || (nfds > 0 && ofs == NULL)) {
+		kfree(pes);
+		kfree(ofs);
+		return ENOMEM;
+	}
+
+	pw.pw_wchan = poll_wchans[((uintptr_t)&pw / sizeof(pw))
+				  % POLL_HASHSIZE];
+	pw.pw_woken = false;
+	pw.pw_timedout = false;
+
+	/* Hold a reference to each file for the duration. */
+	for (i = 0; i < nfds; i++) {
+		pes[i].pe_q = NULL;
+		pes[i].pe_waiter = &pw;
+		ofs[i] = NULL;
+		if (fds[i].fd >= 0) {
+			/* If this fails, it shows up as POLLNVAL below. */
+			filetable_get(curproc->p_files, fds[i].fd, &ofs[i]);
+		}
+	}
+
+	queued = false;
+	armed = false;
+	while (1) {
+		pw.pw_woken = false;
+		n = 0;
+		for (i = 0; i < nfds; i++) {
+			revents = 0;
+			if (fds[i].fd < 0) {
+				/* ignored */
+			}
+			else if (ofs[i] == NULL) {
+				revents = POLLNVAL;
+			}
+			else {
+				VOP_POLL(ofs[i]->of_vnode, fds[i].events,
+					 queued ? &pes[i] : NULL, &revents);
+			}
+			fds[i].revents = revents;
+			if (revents != 0) {
+				n++;
+			}
+		}
+		if (n > 0 || pw.pw_timedout || (!forever && ticks == 0)) {
+			break;
+		}
+		if (!queued) {
+			/* Check again with our pollents queued. */
+			queued = true;
+			continue;
+		}
+
+		if (!forever && !armed) {
+			callout_init(&pw.pw_callout, poll_timeout, &pw);
+			callout_schedule(&pw.pw_callout, ticks);
+			armed = true;
+		}
+		wchan_lock(pw.pw_wchan);
+		while (!pw.pw_woken && !pw.pw_timedout) {
+			wchan_sleep(pw.pw_wchan);
+			wchan_lock(pw.pw_wchan);
+		}
+		wchan_unlock(pw.pw_wchan);
+	}
+
+	/*
+	 * If the timeout was already dispatched, its function may
+	 * still be about to run; wait for it to finish with PW.
+	 */
+	if (armed && !callout_stop(&pw.pw_callout)) {
+		wchan_lock(pw.pw_wchan);
+		while (!pw.pw_timedout) {
+			wchan_sleep(pw.pw_wchan);
+			wchan_lock(pw.pw_wchan);
+		}
+		wchan_unlock(pw.pw_wchan);
+	}
+
+	for (i = 0; i < nfds; i++) {
+		pollq_remove(&pes[i]);
+		if (ofs[i] != NULL) {
+			openfile_decref(ofs[i]);
+		}
+	}
+	kfree(pes);
+	kfree(ofs);
+
+	*nready = n;
+	return 0;
+}
+
+/*
+ * poll: TIMEOUT is in milliseconds; negative means forever.
+ */
+int
+sys_poll(userptr_t user_fds, unsigned nfds, int timeout, int *retval)
+{
+	struct pollfd *fds;
+	int result;
+
+	if (nfds > OPEN_MAX) {
+		return EINVAL;
+	}
+
+	fds = kmalloc(nfds * sizeof(*fds));
+	if (nfds > 0 && fds == NULL) {
+		return ENOMEM;
+	}
+	result = copyin(user_fds, fds, nfds * sizeof(*fds));
+	if (result) {
+		kfree(fds);
+		return result;
+	}
+
+	result = poll_wait(fds, nfds, timeout < 0,
+			   timeout < 0 ? 0 :
+			   poll_ticks((uint64_t)timeout * 1000000), retval);
+	if (result == 0) {
+		result = copyout(fds, user_fds, nfds * sizeof(*fds));
+	}
+	kfree(fds);
+	return result;
+}
+
+#define FDSET_ISSET(set, fd) \
+	(((set)->fds_bits[(fd) / __NFDBITS] >> ((fd) % __NFDBITS)) & 1)
+#define FDSET_SET(set, fd) \
+	((set)->fds_bits[(fd) / __NFDBITS] |= 1U << ((fd) % __NFDBITS))
+
+/*
+ * select: done by turning the sets into an array of pollfds for
+ * poll_wait and back again. Readable includes hung up; an error
+ * counts as both readable and writeable, so that the caller goes on
+ * to find out what it is.
+ */
+int
+sys_select(int nfds, userptr_t user_rd, userptr_t user_wr, userptr_t user_ex,
+	   userptr_t user_timeout, int *retval)
+{
+	__fd_set sets[3], out[3];
+	userptr_t usersets[3] = { user_rd, user_wr, user_ex };
+	struct pollfd *fds;
+	struct timeval tv;
+	unsigned npoll, i, ticks;
+	int fd, result, n;
+
+	if (nfds < 0 || nfds > __FD_SETSIZE) {
+		return EINVAL;
+	}
+
+	for (i = 0; i < 3; i++) {
+		bzero(&sets[i], sizeof(sets[i]));
+		bzero(&out[i], sizeof(out[i]));
+		if (usersets[i] != NULL) {
+			result = copyin(usersets[i], &sets[i], sizeof(sets[i]));
+			if (result) {
+				return result;
+			}
+		}
+	}
+
+	ticks = 0;
+	if (user_timeout != NULL) {
+		result = copyin(user_timeout, &tv, sizeof(tv));
+		if (result) {
+			return result;
+		}
+		if (tv.tv_sec < 0 || tv.tv_usec < 0 || tv.tv_usec >= 1000000) {
+			return EINVAL;
+		}
+		ticks = poll_ticks((uint64_t)tv.tv_sec * 1000000000
+				   + (uint64_t)tv.tv_usec * 1000);
+	}
+
+	fds = kmalloc(nfds * sizeof(*fds));
+	if (nfds > 0 && fds == NULL) {
+		return ENOMEM;
+	}
+	npoll = 0;
+	for (fd = 0; fd < nfds; fd++) {
+		fds[npoll].fd = fd;
+		fds[npoll].events = 0;
+		if (FDSET_ISSET(&sets[0], fd)) {
+			fds[npoll].events |= POLLIN;
+		}
+		if (FDSET_ISSET(&sets[1], fd)) {
+			fds[npoll].events |= POLLOUT;
+		}
+		if (FDSET_ISSET(&sets[2], fd)) {
+			fds[npoll].events |= POLLPRI;
+		}
+		if (fds[npoll].events != 0) {
+			npoll++;
+		}
+	}
+
+	result = poll_wait(fds, npoll, user_timeout == NULL, ticks, &n);
+	if (result) {
+		kfree(fds);
+		return result;
+	}
+
+	n = 0;
+	for (i = 0; i < npoll; i++) {
+		fd = fds[i].fd;
+		if (fds[i].revents & POLLNVAL) {
+			kfree(fds);
+			return EBADF;
+		}
+		if ((fds[i].events & POLLIN) &&
+		    (fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+			FDSET_SET(&out[0], fd);
+			n++;
+		}
+		if ((fds[i].events & POLLOUT) &&
+		    (fds[i].revents & (POLLOUT | POLLERR))) {
+			FDSET_SET(&out[1], fd);
+			n++;
+		}
+		if ((fds[i].events & POLLPRI) && (fds[i].revents & POLLPRI)) {
+			FDSET_SET(&out[2], fd);
+			n++;
+		}
+	}
+	kfree(fds);
+
+	for (i = 0; i < 3; i++) {
+		if (usersets[i] != NULL) {
+			result = copyout(&out[i], usersets[i], sizeof(out[i]));
+			if (result) {
+				return result;
+			}
+		}
+	}
+	*retval = n;
+	return 0;
+}
@@ -3,6 +3,9 @@
 #include <kern/errno.h>
 #include <kern/unistd.h>
 #include <kern/wait.h>
+#include <kern/time.h>
+#include <kern/resource.h>
+#include <limits.h>
 #include <lib.h>
 #include <syscall.h>
 #include <current.h>
@@ -49,22 +52,7 @@ void sys__exit(int exitcode) {
 
   /* for now, just include this to keep the compiler from complaining about
      an unused variable */
-  global_process_array[curproc->pid - 2]->exit_code = _MKWAIT_EXIT(exitcode);
-  global_process_array[curproc->pid - 2]->ex = 1;
-
-  unsigned int x = array_num(curproc->children);
-  int z;
-  lock_acquire(glb_arr_lck);
-  for(unsigned int i = 0; i < x; i++){
-      z = (int)array_get(curproc->children, i) - 2;
-      if(global_process_array[z]->ex == 1){
-        global_process_array[z]->ex = 0;
-        global_process_array[z]->proc_id = -1;
-        global_process_array[z]->exists = 0;
-      }
-  }
-  V(global_process_array[curproc->pid - 2]->sm);
-  lock_release(glb_arr_lck);
+  proc_info_exit(curproc, _MKWAIT_EXIT(exitcode));
   DEBUG(DB_SYSCALL,"Syscall: _exit(%d)\n",exitcode);
 
   KASSERT(curproc->p_addrspace != NULL);
@@ -77,7 +65,7 @@ void sys__exit(int exitcode) {
    * messily fatal.
    */
   as = curproc_setas(NULL);
-  as_destroy(as);
+  curproc_putas(as);
 
   /* detach this thread from its process */
   /* note: curproc cannot be used after this call */
@@ -102,7 +90,7 @@ sys_getpid(pid_t *retval)
   return(0);
 }
 
-/* stub handler for waitpid() system call                */
+/* handler for waitpid() system call                */
 
 int
 sys_waitpid(pid_t pid,
@@ -110,99 +98,323 @@ sys_waitpid(pid_t pid,
 	    int options,
 	    pid_t *retval)
 {
+  return sys_wait4(pid, status, options, NULL, retval);
+}
+
+/*
+ * wait4: waitpid, plus the child's resource usage. STATUS and RUSAGE
+ * may both be null.
+ */
+int
+sys_wait4(pid_t pid,
+	  userptr_t status,
+	  int options,
+	  userptr_t rusage,
+	  pid_t *retval)
+{
+  struct rusage ru;
   int exitstatus;
   int result;
 
-  if(global_process_array[pid-2]->exists != 1){
-    return ESRCH;
+  result = proc_wait(pid, options, &exitstatus,
+		     rusage != NULL ? &ru : NULL, retval);
+  if (result) {
+    return result;
+  }
+  if (*retval == 0) {
+    /* WNOHANG, and nothing has exited yet */
+    return 0;
+  }
+
+  /*
+   * The child is already reaped; if copying out fails the status is
+   * lost, as on other systems.
+   */
+  if (status != NULL) {
+    result = copyout(&exitstatus, status, sizeof(int));
+    if (result) {
+      return result;
+    }
   }
-  else if(global_process_array[pid-2]->ex != 1){
-        P(global_process_array[pid-2]->sm);
+  if (rusage != NULL) {
+    result = copyout(&ru, rusage, sizeof(ru));
+    if (result) {
+      return result;
+    }
   }
-  exitstatus = global_process_array[pid-2]->exit_code;
-  //kprintf("exit: %d\n", exitstatus);
-  global_process_array[pid-2]->exists = 0;
-  global_process_array[pid-2]->proc_id = -1;
-  if (options != 0) {
-    return(EINVAL);
+  return 0;
+}
+
+
+
+
+/* handler for getrusage() system call                */
+
+int
+sys_getrusage(int who, userptr_t rusage)
+{
+  struct rusage ru;
+
+  switch (who) {
+  case RUSAGE_SELF:
+    proc_usage_get(&curproc->p_usage, &ru);
+    break;
+  case RUSAGE_CHILDREN:
+    proc_usage_get(&curproc->p_cusage, &ru);
+    break;
+  default:
+    return EINVAL;
   }
-  /* for now, just pretend the exitstatus is 0 */
-  result = copyout((void *)&exitstatus,status,sizeof(int));
+  return copyout(&ru, rusage, sizeof(ru));
+}
+
+/*
+ * Copy in the null-terminated argument vector UARGS. Hands back a
+ * kernel argv, in a single block that can be freed with kfree.
+ */
+static
+int
+args_copyin(userptr_t uargs, char ***ret, int *retargc)
+{
+  char *buf, *strs, **args;
+  userptr_t uarg;
+  size_t len, used;
+  int argc, i, result;
+
+  /* Gather the strings, back to back, in a scratch buffer. */
+  buf = kmalloc(ARG_MAX);
+  if (buf == NULL) {
+    return ENOMEM;
+  }
+  used = 0;
+  for (argc = 0; ; argc++) {
+    result = copyin(uargs + argc * sizeof(userptr_t), &uarg, sizeof(uarg));
+    if (result) {
+      goto out;
+    }
+    if (uarg == NULL) {
+      break;
+    }
+    result = copyinstr(uarg, buf + used, ARG_MAX - used, &len);
+    if (result) {
+      if (result == ENAMETOOLONG) {
+        result = E2BIG;
+      }
+      goto out;
+    }
+    used += len;
+  }
+
+  /* Then build the argv array and the strings it points to. */
+  args = kmalloc((argc + 1) * sizeof(char *) + used);
+  if (args == NULL) {
+    result = ENOMEM;
+    goto out;
+  }
+  strs = (char *)(args + argc + 1);
+  memcpy(strs, buf, used);
+  for (i = 0; i < argc; i++) {
+    args[i] = strs;
+    strs += strlen(strs) + 1;
+  }
+  args[argc] = NULL;
+
+  *ret = args;
+  *retargc = argc;
+  result = 0;
+ out:
+  kfree(buf);
+  return result;
+}
+
+int
+sys_execv(userptr_t program, userptr_t uargs)
+{
+  struct addrspace *oldas;
+  vaddr_t entrypoint, stackptr;
+  userptr_t argv;
+  char *path, **args;
+  int argc, result;
+
+  path = kmalloc(PATH_MAX);
+  if (path == NULL) {
+    return ENOMEM;
+  }
+  result = copyinstr(program, path, PATH_MAX, NULL);
+  if (result) {
+    kfree(path);
+    return result;
+  }
+  result = args_copyin(uargs, &args, &argc);
   if (result) {
-    return(result);
+    kfree(path);
+    return result;
   }
 
-  *retval = pid;
-  return(0);
+  result = program_load(path, args, argc, &oldas, &entrypoint,
+                        &argv, &stackptr);
+  kfree(path);
+  kfree(args);
+  if (result) {
+    return result;
+  }
+
+  /* Past the point of no return: drop (or give back) the old image. */
+  curproc_putas(oldas);
+
+  enter_new_process(argc, argv, stackptr, entrypoint);
+  panic("enter_new_process returned\n");
+  return EINVAL;
 }
 
+/*
+ * vfork: like fork, but the child borrows our address space rather
+ * than getting a copy, and we stay blocked until it execs or exits.
+ * The child starts from our trapframe, which stays put on our kernel
+ * stack until then.
+ */
+int
+sys_vfork(struct trapframe *tf, pid_t *retval)
+{
+  struct proc *child;
+  struct semaphore *done;
+  int result;
 
+  child = proc_create_runprogram(curproc->p_name);
+  if (child == NULL) {
+    return ENOMEM;
+  }
+  done = sem_create("vfork", 0);
+  if (done == NULL) {
+    proc_destroy(child);
+    return ENOMEM;
+  }
+  child->p_vfork = done;
+  child->p_addrspace = curproc->p_addrspace;
+  child->parent_pid = curproc->pid;
+  *retval = child->pid;
 
+  result = thread_fork(curthread->t_name, child, enter_forked_process,
+                       tf, (unsigned long)child->p_addrspace);
+  if (result) {
+    child->p_addrspace = NULL;
+    child->p_vfork = NULL;
+    sem_destroy(done);
+    proc_destroy(child);
+    return result;
+  }
 
-int sys_execv(const char *program, char **args){
-  int argc;
-  for (argc = 0; args[argc] != NULL; argc++) {}
-  struct addrspace *as;
-  struct vnode *v;
+  P(done);
+  sem_destroy(done);
+  return 0;
+}
+
+/*
+ * spawn: start PROGRAM with argument vector ARGS in a new child
+ * process, without ever copying or borrowing our address space. The
+ * child loads the program itself; we wait for that so that load
+ * failures come back to us as errors rather than as a dead child.
+ */
+struct spawn_args {
+  char *sa_path;
+  char **sa_args;
+  int sa_argc;
+  struct semaphore *sa_done;	/* V'd once the load is over */
+  int sa_result;
+};
+
+static
+void
+spawn_start(void *data, unsigned long unused)
+{
+  struct spawn_args *sa = data;
+  struct proc *p = curproc;
+  struct addrspace *oldas;
   vaddr_t entrypoint, stackptr;
+  userptr_t argv;
+  int argc = sa->sa_argc;
   int result;
-  char *fname_temp;
-  fname_temp = kstrdup(program);
-  result = vfs_open(fname_temp, O_RDONLY, 0, &v);
-  if(result){
-      return result;
+
+  (void)unused;
+
+  result = program_load(sa->sa_path, sa->sa_args, argc, &oldas,
+                        &entrypoint, &argv, &stackptr);
+  sa->sa_result = result;
+  if (result == 0) {
+    KASSERT(oldas == NULL);
+    /* SA belongs to the parent, and is gone once it wakes up. */
+    V(sa->sa_done);
+    enter_new_process(argc, argv, stackptr, entrypoint);
+    panic("enter_new_process returned\n");
   }
-  as = as_create();
-  if(as == NULL){
-      vfs_close(v);
-      return ENOMEM;
-  }
-  int bbb = (argc+1)*sizeof(char *);
-  int total_len = 0;
-  char **args_temp = kmalloc(bbb);
-  vaddr_t *args_temp_2 = kmalloc(bbb);
-  args_temp_2[argc] = 0;
-  args_temp[argc] = NULL;
-  int len;
-  for(int i = 0; i < argc; i++){
-    len = strlen(args[i]) + 1;
-    args_temp[i] = kmalloc(sizeof(char) * len);
-    copyin((const_userptr_t)args[i], (void *) args_temp[i], len);
-    total_len = total_len + ROUNDUP(len, 8);
+
+  /* Never made it to user mode; exit, for the parent to reap. */
+  proc_info_exit(p, _MKWAIT_EXIT(127));
+  V(sa->sa_done);
+  proc_remthread(curthread);
+  proc_destroy(p);
+  thread_exit();
+}
+
+int
+sys_spawn(userptr_t program, userptr_t uargs, pid_t *retval)
+{
+  struct spawn_args sa;
+  struct proc *child;
+  pid_t pid, reaped;
+  int status, result;
+
+  sa.sa_path = kmalloc(PATH_MAX);
+  if (sa.sa_path == NULL) {
+    return ENOMEM;
   }
-  as_deactivate();
-  as_destroy(curproc->p_addrspace);
-  curproc_setas(as);
-  as_activate();
-  result = load_elf(v, &entrypoint);
-  if(result){
-      vfs_close(v);
-      return result;
+  result = copyinstr(program, sa.sa_path, PATH_MAX, NULL);
+  if (result) {
+    kfree(sa.sa_path);
+    return result;
   }
-  
-  vfs_close(v);
-  kfree(fname_temp);
-  result = as_define_stack(as, &stackptr);
-  if(result){
-      return result;
+  result = args_copyin(uargs, &sa.sa_args, &sa.sa_argc);
+  if (result) {
+    kfree(sa.sa_path);
+    return result;
+  }
+  sa.sa_done = sem_create("spawn", 0);
+  if (sa.sa_done == NULL) {
+    result = ENOMEM;
+    goto out;
+  }
+
+  child = proc_create_runprogram(sa.sa_path);
+  if (child == NULL) {
+    result = ENOMEM;
+    goto out;
+  }
+  child->parent_pid = curproc->pid;
+  pid = child->pid;
+
+  result = thread_fork(sa.sa_path, child, spawn_start, &sa, 0);
+  if (result) {
+    proc_destroy(child);
+    goto out;
+  }
+
+  P(sa.sa_done);
+  result = sa.sa_result;
+  if (result) {
+    /* The child has already exited; collect it. */
+    if (proc_wait(pid, 0, &status, NULL, &reaped)) {
+      panic("spawn: cannot reap failed child %d\n", pid);
+    }
+  }
+  else {
+    *retval = pid;
+  }
+
+ out:
+  if (sa.sa_done != NULL) {
+    sem_destroy(sa.sa_done);
   }
-  stackptr -= total_len;
-  stackptr -= bbb;
-  paddr_t p = stackptr + bbb;
-  for(int i = 0; i < argc; i++){
-    len = strlen(args_temp[i]) + 1;
-    len = ROUNDUP(len, 8);
-    args_temp_2[i] = p;
-    copyout(args_temp[i], (userptr_t)p, len);
-    p = p + len;
-  }
-  copyout(args_temp_2, (userptr_t)stackptr, bbb);
-  /*for(int i = 0; i < argc; i++){
-    kfree(args_temp[i]);
-  }
-  kfree(args_temp);
-  kfree(args_temp_2);*/
-  enter_new_process(argc, (userptr_t)stackptr, stackptr, entrypoint);
-
-  return -1;
+  kfree(sa.sa_path);
+  kfree(sa.sa_args);
+  return result;
 }
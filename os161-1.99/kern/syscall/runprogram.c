@@ -46,80 +46,132 @@
 #include <test.h>
 #include <copyinout.h>
 /*
- * Load program "progname" and start running it in usermode.
- * Does not return except on error.
- *return EINVAL;
+ * Load program PROGNAME into a new address space, and copy the ARGC
+ * strings in ARGS (kernel copies) onto its stack as argv. On success
+ * the new address space is current and the one it replaced (maybe
+ * NULL) is handed back in *OLDAS for the caller to dispose of; the
+ * user argv and initial stack pointer go in *ARGV and *STACKPTR. On
+ * failure the old address space is left in place.
+ *
  * Calls vfs_open on progname and thus may destroy it.
  */
 int
-runprogram(char *progname, char **args, int argc)
+program_load(char *progname, char **args, int argc,
+	     struct addrspace **oldas, vaddr_t *entrypoint,
+	     userptr_t *argv, vaddr_t *stackptr)
 {
-	struct addrspace *as;
+	struct addrspace *as, *old;
 	struct vnode *v;
-	vaddr_t entrypoint, stackptr;
-	int result;
+	vaddr_t sp, *uargs;
+	size_t len, total_len, argvlen;
+	int i, result;
 
 	/* Open the file. */
 	result = vfs_open(progname, O_RDONLY, 0, &v);
 	if (result) {
 		return result;
 	}
-	int bbb = (argc+1)*sizeof(char *);
-	vaddr_t *args_temp_2 = kmalloc(bbb);
-	args_temp_2[argc] = 0;
-	/* We should be a new process. */
-	KASSERT(curproc_getas() == NULL);
 
 	/* Create a new address space. */
 	as = as_create();
-	if (as ==NULL) {
+	if (as == NULL) {
+		vfs_close(v);
+		return ENOMEM;
+	}
+
+	argvlen = (argc + 1) * sizeof(vaddr_t);
+	uargs = kmalloc(argvlen);
+	if (uargs == NULL) {
+		as_destroy(as);
 		vfs_close(v);
 		return ENOMEM;
 	}
 
 	/* Switch to it and activate it. */
-	int total_len = 0;
-	int len;
-	curproc_setas(as);
+	old = curproc_setas(as);
 	as_activate();
-	for(int i = 0; i < argc; i++){
-    	len = strlen(args[i]) + 1;
-    	total_len = total_len + ROUNDUP(len, 8);
-  	}
+
 	/* Load the executable. */
-	result = load_elf(v, &entrypoint);
-	if (result) {
-		/* p_addrspace will go away when curproc is destroyed */
-		vfs_close(v);
-		return result;
-	}
+	result = load_elf(v, entrypoint);
 
 	/* Done with the file now. */
 	vfs_close(v);
 
+	if (result) {
+		goto fail;
+	}
+
 	/* Define the user stack in the address space */
-	result = as_define_stack(as, &stackptr);
+	result = as_define_stack(as, &sp);
+	if (result) {
+		goto fail;
+	}
+
+	/* Strings first, then the argv array below them. */
+	total_len = 0;
+	for (i = 0; i < argc; i++) {
+		total_len += ROUNDUP(strlen(args[i]) + 1, 8);
+	}
+	sp -= total_len;
+	sp -= ROUNDUP(argvlen, 8);
+	*stackptr = sp;
+	sp += ROUNDUP(argvlen, 8);
+	for (i = 0; i < argc; i++) {
+		len = strlen(args[i]) + 1;
+		uargs[i] = sp;
+		result = copyout(args[i], (userptr_t)sp, len);
+		if (result) {
+			goto fail;
+		}
+		sp += ROUNDUP(len, 8);
+	}
+	uargs[argc] = 0;
+	result = copyout(uargs, (userptr_t)*stackptr, argvlen);
+	if (result) {
+		goto fail;
+	}
+	kfree(uargs);
+
+	*argv = (userptr_t)*stackptr;
+	*oldas = old;
+	return 0;
+
+ fail:
+	kfree(uargs);
+	curproc_setas(old);
+	as_activate();
+	as_destroy(as);
+	return result;
+}
+
+/*
+ * Load program "progname" and start running it in usermode.
+ * Does not return except on error.
+ *
+ * Calls vfs_open on progname and thus may destroy it.
+ */
+int
+runprogram(char *progname, char **args, int argc)
+{
+	struct addrspace *oldas;
+	vaddr_t entrypoint, stackptr;
+	userptr_t argv;
+	int result;
+
+	/* We should be a new process. */
+	KASSERT(curproc_getas() == NULL);
+
+	result = program_load(progname, args, argc, &oldas, &entrypoint,
+			      &argv, &stackptr);
 	if (result) {
-		/* p_addrspace will go away when curproc is destroyed */
 		return result;
 	}
+	KASSERT(oldas == NULL);
 
-	stackptr -= total_len;
-	stackptr -= bbb;
-  	paddr_t p = stackptr + bbb;
-  	for(int i = 0; i < argc; i++){
-    	len = strlen(args[i]) + 1;
-    	len = ROUNDUP(len, 8);
-    	args_temp_2[i] = p;
-    	copyout(args[i], (userptr_t)p, len);
-    	p = p + len;
-  	}
-  	copyout(args_temp_2, (userptr_t)stackptr, bbb);
-	enter_new_process(argc /*argc*/, (userptr_t)stackptr /*userspace addr of argv*/,
+	enter_new_process(argc /*argc*/, argv /*userspace addr of argv*/,
 			  stackptr, entrypoint);
 	
 	/* enter_new_process does not return. */
 	panic("enter_new_process returned\n");
 	return EINVAL;
 }
-
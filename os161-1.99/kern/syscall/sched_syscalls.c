@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/sched.h>
+#include <kern/schedstat.h>
+#include <lib.h>
+#include <clock.h>
+#include <copyinout.h>
+#include <thread.h>
+#include <current.h>
+#include <proc.h>
+#include <syscall.h>
+
+/*
+ * Scheduler-related system calls.
+ */
+
+/*
+ * schedstat: copy out scheduler statistics for one cpu, or for the
+ * calling thread if WHICH is SCHEDSTAT_SELF. At most BUFLEN bytes
+ * are copied, so older binaries keep working if the structures grow.
+ * Returns the number of cpus.
+ */
+int
+sys_schedstat(int which, userptr_t buf, size_t buflen, int *retval)
+{
+	struct schedstat_cpu sc;
+	struct schedstat_thread st;
+	void *src;
+	size_t len;
+	int result;
+
+	if (which == SCHEDSTAT_SELF) {
+		st = curthread->t_stats;
+		src = &st;
+		len = sizeof(st);
+	}
+	else if (which >= 0) {
+		result = thread_getcpustats(which, &sc);
+		if (result) {
+			return result;
+		}
+		src = &sc;
+		len = sizeof(sc);
+	}
+	else {
+		return EINVAL;
+	}
+
+	if (buflen < len) {
+		len = buflen;
+	}
+	result = copyout(src, buf, len);
+	if (result) {
+		return result;
+	}
+
+	*retval = thread_numcpus();
+	return 0;
+}
+
+/*
+ * Check that PID names the calling thread. Threads have no ids of
+ * their own, and processes here have one thread each, so PID 0 and
+ * the caller's own pid are the only ones accepted; setting another
+ * process's affinity isn't supported.
+ */
+static
+int
+sched_checkpid(pid_t pid)
+{
+	if (pid != 0 && (curproc == NULL || pid != curproc->pid)) {
+		return ESRCH;
+	}
+	return 0;
+}
+
+/*
+ * sched_setaffinity: restrict the calling thread to the cpus whose
+ * bits are set in MASK. If the current cpu isn't among them the
+ * thread moves to one that is before returning.
+ */
+int
+sys_sched_setaffinity(pid_t pid, uint32_t mask)
+{
+	int result;
+
+	result = sched_checkpid(pid);
+	if (result) {
+		return result;
+	}
+	return thread_setaffinity(mask);
+}
+
+/*
+ * sched_getaffinity: copy out the calling thread's affinity mask.
+ */
+int
+sys_sched_getaffinity(pid_t pid, userptr_t mask)
+{
+	uint32_t kmask;
+	int result;
+
+	result = sched_checkpid(pid);
+	if (result) {
+		return result;
+	}
+	kmask = thread_getaffinity();
+	return copyout(&kmask, mask, sizeof(kmask));
+}
+
+/*
+ * Convert microseconds to hardclock ticks, rounding up.
+ */
+static
+unsigned
+sched_ustoticks(uint32_t us)
+{
+	return DIVROUNDUP(us, 1000000 / HZ);
+}
+
+/*
+ * sched_setrt: put the calling thread in the real-time class with
+ * the parameters in PARAM, or take it out again if PARAM is NULL or
+ * its period is 0.
+ */
+int
+sys_sched_setrt(pid_t pid, const_userptr_t param)
+{
+	struct sched_rtparam p;
+	int result;
+
+	result = sched_checkpid(pid);
+	if (result) {
+		return result;
+	}
+	if (param == NULL) {
+		return thread_setrt(0, 0, 0);
+	}
+	result = copyin(param, &p, sizeof(p));
+	if (result) {
+		return result;
+	}
+	return thread_setrt(sched_ustoticks(p.rt_period),
+			    sched_ustoticks(p.rt_budget),
+			    sched_ustoticks(p.rt_deadline));
+}
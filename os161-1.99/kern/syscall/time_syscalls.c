@@ -28,6 +28,9 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
+#include <kern/time.h>
+#include <lib.h>
 #include <clock.h>
 #include <copyinout.h>
 #include <syscall.h>
@@ -56,3 +59,47 @@ sys___time(userptr_t user_seconds_ptr, userptr_t user_nanoseconds_ptr)
 
 	return 0;
 }
+
+/*
+ * nanosleep: sleep for the interval in *USER_REQ, rounded up to whole
+ * hardclock ticks. Nothing can interrupt the sleep, so if USER_REM
+ * is not null the remaining time written there is always zero.
+ */
+int
+sys_nanosleep(const_userptr_t user_req, userptr_t user_rem)
+{
+	struct timespec req;
+	uint64_t nsecs, ticks;
+	int result;
+
+	result = copyin(user_req, &req, sizeof(req));
+	if (result) {
+		return result;
+	}
+	if (req.tv_sec < 0 || req.tv_nsec < 0 || req.tv_nsec >= 1000000000) {
+		return EINVAL;
+	}
+
+	nsecs = (uint64_t)req.tv_sec * 1000000000 + req.tv_nsec;
+	ticks = DIVROUNDUP(nsecs, 1000000000 / HZ);
+	while (ticks > 0) {
+		if (ticks > CALLOUT_MAXTICKS) {
+			clock_sleepticks(CALLOUT_MAXTICKS);
+			ticks -= CALLOUT_MAXTICKS;
+		}
+		else {
+			clock_sleepticks(ticks);
+			ticks = 0;
+		}
+	}
+
+	if (user_rem != NULL) {
+		req.tv_sec = 0;
+		req.tv_nsec = 0;
+		result = copyout(&req, user_rem, sizeof(req));
+		if (result) {
+			return result;
+		}
+	}
+	return 0;
+}
@@ -32,10 +32,12 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <clock.h>
 #include <thread.h>
 #include <synch.h>
+#include <rcu.h>
 #include <test.h>
 
 #define NSEMLOOPS     63
@@ -248,6 +250,9 @@ locktest(int nargs, char **args)
 		P(donesem);
 	}
 
+	kprintf("Contended acquisitions: %u spun, %u slept\n",
+		testlock->lk_spins, testlock->lk_blocks);
+
 #ifdef UW
   cleanitems();
 #endif
@@ -347,3 +352,319 @@ cvtest(int nargs, char **args)
 
 	return 0;
 }
+
+////////////////////////////////////////////////////////////
+
+#define NRWLOOPS      200
+
+static struct rwlock *testrw;
+static struct semaphore *rwdonesem;
+static struct spinlock rwcountlock = SPINLOCK_INITIALIZER;
+static volatile unsigned rwreaders, rwwriters;
+static volatile bool rwfailed;
+
+static
+void
+rwfail(unsigned long num, const char *msg)
+{
+	kprintf("thread %lu: %s\n", num, msg);
+	rwfailed = true;
+}
+
+/*
+ * Even-numbered threads read; odd-numbered threads write. Readers
+ * check that no writer is in and that the test values are
+ * consistent; writers check that they are alone.
+ */
+static
+void
+rwtestthread(void *junk, unsigned long num)
+{
+	int i;
+	volatile int j;
+	bool writer;
+
+	(void)junk;
+
+	writer = (num % 2) == 1;
+	for (i=0; i<NRWLOOPS && !rwfailed; i++) {
+		if (writer) {
+			rwlock_acquire_write(testrw);
+			spinlock_acquire(&rwcountlock);
+			rwwriters++;
+			if (rwwriters != 1 || rwreaders != 0) {
+				rwfail(num, "writer not exclusive");
+			}
+			spinlock_release(&rwcountlock);
+
+			testval1 = num;
+			for (j=0; j<50; j++);
+			testval2 = num*num;
+			testval3 = num%3;
+
+			spinlock_acquire(&rwcountlock);
+			rwwriters--;
+			spinlock_release(&rwcountlock);
+			rwlock_release_write(testrw);
+		}
+		else {
+			rwlock_acquire_read(testrw);
+			spinlock_acquire(&rwcountlock);
+			rwreaders++;
+			if (rwwriters != 0) {
+				rwfail(num, "reader overlaps writer");
+			}
+			spinlock_release(&rwcountlock);
+
+			if (testval2 != testval1*testval1 ||
+			    testval3 != testval1%3) {
+				rwfail(num, "inconsistent values under "
+				       "read lock");
+			}
+			for (j=0; j<50; j++);
+
+			spinlock_acquire(&rwcountlock);
+			rwreaders--;
+			spinlock_release(&rwcountlock);
+			rwlock_release_read(testrw);
+		}
+	}
+	V(rwdonesem);
+}
+
+/*
+ * One run of the test, with a shared or per-cpu reader count.
+ * Returns true if it failed.
+ */
+static
+bool
+rwtest_run(bool percpu)
+{
+	int i, result;
+
+	testrw = percpu ? rwlock_create_percpu("testrw")
+		: rwlock_create("testrw");
+	if (testrw == NULL) {
+		panic("rwtest: rwlock_create failed\n");
+	}
+	rwreaders = rwwriters = 0;
+	rwfailed = false;
+	testval1 = testval2 = testval3 = 0;
+
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("rwtest", NULL, rwtestthread, NULL, i);
+		if (result) {
+			panic("rwtest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(rwdonesem);
+	}
+
+	rwlock_destroy(testrw);
+	testrw = NULL;
+	return rwfailed;
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	bool sharedfailed, percpufailed;
+
+	(void)nargs;
+	(void)args;
+
+	rwdonesem = sem_create("rwdonesem", 0);
+	if (rwdonesem == NULL) {
+		panic("rwtest: sem_create failed\n");
+	}
+
+	kprintf("Starting rwlock test...\n");
+	sharedfailed = rwtest_run(false);
+	kprintf("Shared reader count: %s\n", sharedfailed ? "FAILED" : "ok");
+	percpufailed = rwtest_run(true);
+	kprintf("Per-cpu reader counts: %s\n",
+		percpufailed ? "FAILED" : "ok");
+
+	sem_destroy(rwdonesem);
+	rwdonesem = NULL;
+	if (sharedfailed || percpufailed) {
+		kprintf("Rwlock test failed.\n");
+		return EIO;
+	}
+	kprintf("Rwlock test done.\n");
+	return 0;
+}
+
+////////////////////////////////////////////////////////////
+
+#define NRCULOOPS     300
+#define RCU_MAGIC     0x5eed1e55
+#define RCU_POISON    0xdeadbeef
+
+struct rcuobj {
+	struct rcu_head ro_rcu;
+	volatile unsigned ro_magic;
+	unsigned long ro_val;
+	unsigned long ro_valsq;
+};
+
+static struct rcuobj *volatile rcuptr;
+static struct lock *rcuwritelock;
+static struct semaphore *rcudonesem;
+static volatile bool rcufailed;
+static volatile unsigned rcuqueued, rcufreed;
+
+static
+struct rcuobj *
+rcuobj_create(unsigned long val)
+{
+	struct rcuobj *ro;
+
+	ro = kmalloc(sizeof(*ro));
+	if (ro == NULL) {
+		return NULL;
+	}
+	ro->ro_magic = RCU_MAGIC;
+	ro->ro_val = val;
+	ro->ro_valsq = val*val;
+	return ro;
+}
+
+/*
+ * Poison before freeing, so a reader that could still see the object
+ * notices even if the memory isn't reused right away.
+ */
+static
+void
+rcuobj_free(void *p)
+{
+	struct rcuobj *ro = p;
+
+	ro->ro_magic = RCU_POISON;
+	kfree(ro);
+}
+
+static
+void
+rcuobj_callback(void *p)
+{
+	rcuobj_free(p);
+	/* Only the RCU callback thread gets here. */
+	rcufreed++;
+}
+
+static
+void
+rcufail(unsigned long num, const char *msg)
+{
+	kprintf("thread %lu: %s\n", num, msg);
+	rcufailed = true;
+}
+
+/*
+ * One thread in four replaces the shared object, freeing the old one
+ * with call_rcu, or every so often with synchronize_rcu and kfree.
+ * The rest check inside a read section that the object they see
+ * stays intact for the whole section.
+ */
+static
+void
+rcutestthread(void *junk, unsigned long num)
+{
+	struct rcuobj *ro, *old;
+	int i;
+	volatile int j;
+
+	(void)junk;
+
+	for (i=0; i<NRCULOOPS && !rcufailed; i++) {
+		if (num % 4 == 1) {
+			ro = rcuobj_create(num + i);
+			if (ro == NULL) {
+				rcufail(num, "out of memory");
+				break;
+			}
+			lock_acquire(rcuwritelock);
+			old = rcuptr;
+			rcuptr = ro;
+			if (i % 16 != 0) {
+				rcuqueued++;
+			}
+			lock_release(rcuwritelock);
+
+			if (i % 16 != 0) {
+				call_rcu(&old->ro_rcu, rcuobj_callback, old);
+			}
+			else {
+				synchronize_rcu();
+				rcuobj_free(old);
+			}
+		}
+		else {
+			rcu_read_lock();
+			ro = rcuptr;
+			if (ro->ro_magic != RCU_MAGIC ||
+			    ro->ro_valsq != ro->ro_val*ro->ro_val) {
+				rcufail(num, "bad object at start of read");
+			}
+			/* Nest, and take long enough to see a tick. */
+			rcu_read_lock();
+			for (j=0; j<2000; j++);
+			rcu_read_unlock();
+			if (ro->ro_magic != RCU_MAGIC) {
+				rcufail(num, "object freed during read");
+			}
+			rcu_read_unlock();
+			thread_yield();
+		}
+	}
+	V(rcudonesem);
+}
+
+int
+rcutest(int nargs, char **args)
+{
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	rcudonesem = sem_create("rcudonesem", 0);
+	rcuwritelock = lock_create("rcuwritelock");
+	rcuptr = rcuobj_create(0);
+	if (rcudonesem == NULL || rcuwritelock == NULL || rcuptr == NULL) {
+		panic("rcutest: out of memory\n");
+	}
+	rcufailed = false;
+	rcuqueued = rcufreed = 0;
+
+	kprintf("Starting RCU test...\n");
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("rcutest", NULL, rcutestthread, NULL, i);
+		if (result) {
+			panic("rcutest: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	for (i=0; i<NTHREADS; i++) {
+		P(rcudonesem);
+	}
+
+	/* Wait for the callbacks, which run a little after the grace period. */
+	synchronize_rcu();
+	while (rcufreed != rcuqueued) {
+		clocksleep(1);
+	}
+	kprintf("%u objects freed by call_rcu\n", rcufreed);
+
+	rcuobj_free(rcuptr);
+	rcuptr = NULL;
+	lock_destroy(rcuwritelock);
+	rcuwritelock = NULL;
+	sem_destroy(rcudonesem);
+	rcudonesem = NULL;
+	kprintf("RCU test %s.\n", rcufailed ? "failed" : "done");
+	return 0;
+}
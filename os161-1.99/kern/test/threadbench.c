@@ -0,0 +1,593 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Thread benchmarks.
+ */
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <clock.h>
+#include <thread.h>
+#include <current.h>
+#include <synch.h>
+#include <test.h>
+
+#define FORKBENCH_DEFAULT_CYCLES  2000
+#define FORKBENCH_BATCH           16
+
+#define RTBENCH_DEFAULT_PERIODS   100
+#define RTBENCH_PERIOD            10	/* ticks */
+#define RTBENCH_BUDGET            2	/* ticks */
+#define RTBENCH_HOGS_PER_CPU      2
+
+#define SPINBENCH_DEFAULT_TICKS   25	/* per run */
+#define SPINBENCH_MAXCPUS         32
+#define SPINBENCH_HOLD            20	/* loop iterations */
+#define SPINBENCH_BACKOFF_MIN     4
+#define SPINBENCH_BACKOFF_MAX     1024
+
+/* Locks compared by spinbench. */
+#define SB_TAS          0	/* test-and-test-and-set */
+#define SB_TASBACKOFF   1	/* same, with exponential backoff */
+#define SB_TICKET       2	/* struct spinlock */
+#define SB_NKINDS       3
+
+#define PINGPONG_DEFAULT_TRIPS    500
+#define PINGPONG_HOGS             2
+
+/* Workers signal this when done; each benchmark creates its own. */
+static struct semaphore *benchsem;
+
+static volatile bool rtb_stop;
+static unsigned rtb_periods;
+static uint64_t rtb_maxlate_ns, rtb_totallate_ns;
+static unsigned rtb_misses, rtb_throttles;
+static int rtb_result;
+
+static const char *const sb_kindnames[SB_NKINDS] = {
+	"tas", "tas+backoff", "ticket",
+};
+static unsigned sb_kind;
+static volatile spinlock_data_t sb_tasword;
+static struct spinlock sb_spinlock = SPINLOCK_INITIALIZER;
+static volatile spinlock_data_t sb_ready;
+static volatile bool sb_go, sb_stop, sb_broken;
+static volatile unsigned long sb_owner;
+static unsigned sb_counts[SPINBENCH_MAXCPUS];
+
+static struct semaphore *pp_ping, *pp_pong;
+static unsigned pp_trips;
+static volatile bool pp_stop;
+
+static
+void
+forkbench_thread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	V(benchsem);
+}
+
+/*
+ * Fork/exit throughput: create threads that do nothing but exit, in
+ * batches of FORKBENCH_BATCH so several are in flight at once, and
+ * report how many fork/exit cycles complete per second.
+ *
+ * Usage: tb1 [cycles]
+ */
+int
+forkbench(int nargs, char **args)
+{
+	unsigned cycles, done, batch, i;
+	time_t s1, s2, secs;
+	uint32_t ns1, ns2, nsecs;
+	uint64_t totalns;
+	int result;
+
+	cycles = FORKBENCH_DEFAULT_CYCLES;
+	if (nargs > 1) {
+		cycles = atoi(args[1]);
+	}
+	if (cycles == 0) {
+		kprintf("Usage: tb1 [cycles]\n");
+		return EINVAL;
+	}
+
+	benchsem = sem_create("forkbench", 0);
+	if (benchsem == NULL) {
+		panic("forkbench: sem_create failed\n");
+	}
+
+	kprintf("Starting fork/exit benchmark (%u cycles)...\n", cycles);
+	gettime(&s1, &ns1);
+	for (done = 0; done < cycles; done += batch) {
+		batch = cycles - done;
+		if (batch > FORKBENCH_BATCH) {
+			batch = FORKBENCH_BATCH;
+		}
+		for (i=0; i<batch; i++) {
+			result = thread_fork("forkbench", NULL,
+					     forkbench_thread, NULL, i);
+			if (result) {
+				panic("forkbench: thread_fork failed: %s\n",
+				      strerror(result));
+			}
+		}
+		for (i=0; i<batch; i++) {
+			P(benchsem);
+		}
+	}
+	gettime(&s2, &ns2);
+	getinterval(s1, ns1, s2, ns2, &secs, &nsecs);
+
+	totalns = (uint64_t)secs * 1000000000 + nsecs;
+	kprintf("%u cycles in %lu.%09lu seconds: %u cycles/sec\n",
+		cycles, (unsigned long)secs, (unsigned long)nsecs,
+		totalns ? (unsigned)((uint64_t)cycles * 1000000000 / totalns)
+		: 0);
+
+	sem_destroy(benchsem);
+	benchsem = NULL;
+	kprintf("Fork/exit benchmark done.\n");
+	return 0;
+}
+
+static
+void
+rtbench_hog(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	while (!rtb_stop) {
+		/* spin */
+	}
+	V(benchsem);
+}
+
+static
+void
+rtbench_rtthread(void *junk, unsigned long num)
+{
+	uint64_t before, due, now, late;
+	unsigned i;
+
+	(void)junk;
+	(void)num;
+
+	/* A full cpu is more than admission control allows. */
+	if (thread_setrt(1, 1, 0) != EBUSY) {
+		kprintf("rtbench: overcommitted reservation admitted\n");
+		rtb_result = EINVAL;
+		V(benchsem);
+		return;
+	}
+
+	rtb_result = thread_setrt(RTBENCH_PERIOD, RTBENCH_BUDGET, 0);
+	if (rtb_result) {
+		kprintf("rtbench: thread_setrt: %s\n", strerror(rtb_result));
+		V(benchsem);
+		return;
+	}
+
+	for (i=0; i<rtb_periods; i++) {
+		before = gettime_ns();
+		clock_sleepticks(RTBENCH_PERIOD);
+		now = gettime_ns();
+		due = before + (uint64_t)RTBENCH_PERIOD * (1000000000 / HZ);
+		late = now > due ? now - due : 0;
+		rtb_totallate_ns += late;
+		if (late > rtb_maxlate_ns) {
+			rtb_maxlate_ns = late;
+		}
+	}
+
+	rtb_misses = curthread->t_stats.st_rt_misses;
+	rtb_throttles = curthread->t_stats.st_rt_throttles;
+	thread_setrt(0, 0, 0);
+	V(benchsem);
+}
+
+/*
+ * Real-time wakeup latency: a periodic real-time thread sleeps for
+ * one period at a time while RTBENCH_HOGS_PER_CPU cpu-bound threads
+ * per cpu compete with it. Reports how late the real-time thread got
+ * to run after each sleep, and its deadline misses.
+ *
+ * Usage: tb2 [periods]
+ */
+int
+rtbench(int nargs, char **args)
+{
+	unsigned i, nhogs;
+	int result;
+
+	rtb_periods = RTBENCH_DEFAULT_PERIODS;
+	if (nargs > 1) {
+		rtb_periods = atoi(args[1]);
+	}
+	if (rtb_periods == 0) {
+		kprintf("Usage: tb2 [periods]\n");
+		return EINVAL;
+	}
+
+	benchsem = sem_create("rtbench", 0);
+	if (benchsem == NULL) {
+		panic("rtbench: sem_create failed\n");
+	}
+	rtb_stop = false;
+	rtb_maxlate_ns = rtb_totallate_ns = 0;
+	rtb_misses = rtb_throttles = 0;
+	rtb_result = 0;
+
+	nhogs = thread_numcpus() * RTBENCH_HOGS_PER_CPU;
+	kprintf("Starting real-time latency benchmark (%u periods of %u "
+		"ticks, %u hogs)...\n", rtb_periods, RTBENCH_PERIOD, nhogs);
+	for (i=0; i<nhogs; i++) {
+		result = thread_fork("rtbench-hog", NULL,
+				     rtbench_hog, NULL, i);
+		if (result) {
+			panic("rtbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	result = thread_fork("rtbench-rt", NULL, rtbench_rtthread, NULL, 0);
+	if (result) {
+		panic("rtbench: thread_fork failed: %s\n", strerror(result));
+	}
+
+	P(benchsem);
+	rtb_stop = true;
+	for (i=0; i<nhogs; i++) {
+		P(benchsem);
+	}
+
+	if (rtb_result == 0) {
+		kprintf("wakeup lateness: max %llu us, avg %llu us; "
+			"%u deadline misses, %u throttles\n",
+			(unsigned long long)(rtb_maxlate_ns / 1000),
+			(unsigned long long)(rtb_totallate_ns / 1000
+					     / rtb_periods),
+			rtb_misses, rtb_throttles);
+	}
+
+	sem_destroy(benchsem);
+	benchsem = NULL;
+	kprintf("Real-time latency benchmark done.\n");
+	return rtb_result;
+}
+
+/*
+ * The critical section: hold the lock for a little while and check
+ * nobody else got in meanwhile.
+ */
+static
+void
+spinbench_critical(unsigned long num)
+{
+	volatile int j;
+
+	sb_owner = num;
+	for (j=0; j<SPINBENCH_HOLD; j++);
+	if (sb_owner != num) {
+		sb_broken = true;
+	}
+}
+
+static
+void
+spinbench_thread(void *junk, unsigned long num)
+{
+	unsigned count, backoff;
+	volatile unsigned i;
+	int spl;
+
+	(void)junk;
+
+	/* Get onto cpu NUM. */
+	thread_setaffinity((uint32_t)1 << num);
+	KASSERT(curcpu->c_number == num);
+	spinlock_data_fetchadd(&sb_ready, 1);
+	while (!sb_go) {
+		/* wait for the others */
+	}
+
+	count = 0;
+	while (!sb_stop) {
+		switch (sb_kind) {
+		    case SB_TAS:
+			spl = splhigh();
+			while (spinlock_data_get(&sb_tasword) != 0 ||
+			       spinlock_data_testandset(&sb_tasword) != 0) {
+				/* spin */
+			}
+			spinbench_critical(num);
+			spinlock_data_set(&sb_tasword, 0);
+			splx(spl);
+			break;
+		    case SB_TASBACKOFF:
+			spl = splhigh();
+			backoff = SPINBENCH_BACKOFF_MIN;
+			while (spinlock_data_get(&sb_tasword) != 0 ||
+			       spinlock_data_testandset(&sb_tasword) != 0) {
+				for (i=0; i<backoff; i++);
+				if (backoff < SPINBENCH_BACKOFF_MAX) {
+					backoff *= 2;
+				}
+			}
+			spinbench_critical(num);
+			spinlock_data_set(&sb_tasword, 0);
+			splx(spl);
+			break;
+		    case SB_TICKET:
+			spinlock_acquire(&sb_spinlock);
+			spinbench_critical(num);
+			spinlock_release(&sb_spinlock);
+			break;
+		}
+		count++;
+	}
+	sb_counts[num] = count;
+	V(benchsem);
+}
+
+/*
+ * Spinlock scaling: for each kind of lock, and for 1 up to all cpus,
+ * run one thread pinned to each cpu taking and releasing the same
+ * lock for TICKS ticks. Reports acquisitions per second, and the
+ * fewest and most any one cpu managed, which shows how fair the lock
+ * is. The plain test-and-set lock is what spinlocks used to be.
+ *
+ * Usage: tb3 [ticks]
+ */
+int
+spinbench(int nargs, char **args)
+{
+	unsigned ticks, ncpus, n, i, total, min, max;
+	int result;
+
+	ticks = SPINBENCH_DEFAULT_TICKS;
+	if (nargs > 1) {
+		ticks = atoi(args[1]);
+	}
+	if (ticks == 0) {
+		kprintf("Usage: tb3 [ticks]\n");
+		return EINVAL;
+	}
+
+	benchsem = sem_create("spinbench", 0);
+	if (benchsem == NULL) {
+		panic("spinbench: sem_create failed\n");
+	}
+
+	ncpus = thread_numcpus();
+	if (ncpus > SPINBENCH_MAXCPUS) {
+		ncpus = SPINBENCH_MAXCPUS;
+	}
+	kprintf("Starting spinlock benchmark (%u cpus, %u ticks per run)"
+		"...\n", ncpus, ticks);
+	sb_broken = false;
+	for (sb_kind = 0; sb_kind < SB_NKINDS; sb_kind++) {
+		for (n = 1; n <= ncpus; n++) {
+			spinlock_data_set(&sb_ready, 0);
+			sb_go = sb_stop = false;
+			for (i=0; i<n; i++) {
+				result = thread_fork("spinbench", NULL,
+						     spinbench_thread, NULL, i);
+				if (result) {
+					panic("spinbench: thread_fork "
+					      "failed: %s\n",
+					      strerror(result));
+				}
+			}
+			while (spinlock_data_get(&sb_ready) != n) {
+				clock_sleepticks(1);
+			}
+			sb_go = true;
+			clock_sleepticks(ticks);
+			sb_stop = true;
+			for (i=0; i<n; i++) {
+				P(benchsem);
+			}
+
+			total = 0;
+			min = max = sb_counts[0];
+			for (i=0; i<n; i++) {
+				total += sb_counts[i];
+				if (sb_counts[i] < min) {
+					min = sb_counts[i];
+				}
+				if (sb_counts[i] > max) {
+					max = sb_counts[i];
+				}
+			}
+			kprintf("%-11s %2u cpus: %9u acquires/sec, "
+				"per cpu %u to %u\n",
+				sb_kindnames[sb_kind], n,
+				(unsigned)((uint64_t)total * HZ / ticks),
+				min, max);
+		}
+	}
+
+	sem_destroy(benchsem);
+	benchsem = NULL;
+	if (sb_broken) {
+		kprintf("spinbench: mutual exclusion violated\n");
+		return EINVAL;
+	}
+	kprintf("Spinlock benchmark done.\n");
+	return 0;
+}
+
+/*
+ * Get onto cpu 0 and stay there, so everything in pingpong shares
+ * one run queue.
+ */
+static
+void
+pingpong_pin(void)
+{
+	thread_setaffinity(1);
+	KASSERT(curcpu->c_number == 0);
+}
+
+static
+void
+pingpong_hog(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	pingpong_pin();
+	while (!pp_stop) {
+		/* spin */
+	}
+	V(benchsem);
+}
+
+static
+void
+pingpong_ponger(void *junk, unsigned long num)
+{
+	unsigned i;
+
+	(void)junk;
+	(void)num;
+
+	pingpong_pin();
+	for (i=0; i<pp_trips; i++) {
+		P(pp_ping);
+		V(pp_pong);
+	}
+	V(benchsem);
+}
+
+/*
+ * One run of pingpong: returns the average round trip in ns.
+ */
+static
+uint64_t
+pingpong_run(bool handoff)
+{
+	uint64_t start, end;
+	unsigned i;
+	int result;
+
+	pp_ping = sem_create("pingpong-ping", 0);
+	pp_pong = sem_create("pingpong-pong", 0);
+	if (pp_ping == NULL || pp_pong == NULL) {
+		panic("pingpong: sem_create failed\n");
+	}
+	sem_sethandoff(pp_ping, handoff);
+	sem_sethandoff(pp_pong, handoff);
+	pp_stop = false;
+
+	for (i=0; i<PINGPONG_HOGS; i++) {
+		result = thread_fork("pingpong-hog", NULL,
+				     pingpong_hog, NULL, i);
+		if (result) {
+			panic("pingpong: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+	result = thread_fork("pingpong-pong", NULL,
+			     pingpong_ponger, NULL, 0);
+	if (result) {
+		panic("pingpong: thread_fork failed: %s\n", strerror(result));
+	}
+
+	start = gettime_ns();
+	for (i=0; i<pp_trips; i++) {
+		V(pp_ping);
+		P(pp_pong);
+	}
+	end = gettime_ns();
+
+	pp_stop = true;
+	for (i=0; i<PINGPONG_HOGS + 1; i++) {
+		P(benchsem);
+	}
+	sem_destroy(pp_ping);
+	sem_destroy(pp_pong);
+	pp_ping = pp_pong = NULL;
+
+	return (end - start) / pp_trips;
+}
+
+/*
+ * Wakeup latency between two threads on one cpu: bounce a pair of
+ * semaphores back and forth while PINGPONG_HOGS cpu-bound threads
+ * share the cpu, first with ordinary wakeups and then with direct
+ * handoff (see sem_sethandoff). Reports the average round trip.
+ *
+ * Usage: tb4 [trips]
+ */
+int
+pingpong(int nargs, char **args)
+{
+	uint32_t oldaffinity;
+	uint64_t plain, handoff;
+
+	pp_trips = PINGPONG_DEFAULT_TRIPS;
+	if (nargs > 1) {
+		pp_trips = atoi(args[1]);
+	}
+	if (pp_trips == 0) {
+		kprintf("Usage: tb4 [trips]\n");
+		return EINVAL;
+	}
+
+	benchsem = sem_create("pingpong", 0);
+	if (benchsem == NULL) {
+		panic("pingpong: sem_create failed\n");
+	}
+
+	kprintf("Starting ping-pong benchmark (%u round trips, %u hogs)"
+		"...\n", pp_trips, PINGPONG_HOGS);
+	oldaffinity = thread_getaffinity();
+	pingpong_pin();
+	plain = pingpong_run(false);
+	handoff = pingpong_run(true);
+	thread_setaffinity(oldaffinity);
+
+	kprintf("round trip: %llu us with plain wakeups, "
+		"%llu us with handoff\n",
+		(unsigned long long)(plain / 1000),
+		(unsigned long long)(handoff / 1000));
+
+	sem_destroy(benchsem);
+	benchsem = NULL;
+	kprintf("Ping-pong benchmark done.\n");
+	return 0;
+}
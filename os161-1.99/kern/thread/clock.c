@@ -30,17 +30,20 @@
 #include <types.h>
 #include <lib.h>
 #include <cpu.h>
+#include <spinlock.h>
 #include <wchan.h>
 #include <clock.h>
 #include <thread.h>
 #include <current.h>
+#include <proc.h>
+#include <rcu.h>
 
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution that one second.
+ * Kernel code that needs to do something later uses callouts, which
+ * are kept in a hierarchical timing wheel driven from hardclock().
+ * Sleeping for a period of time is built on top of that.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -51,12 +54,34 @@
  * the scheduler.
  */
 #define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
-#define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
 
 /*
- * Once a second, everything waiting on lbolt is awakened by CPU 0.
+ * The timing wheel.
+ *
+ * There are CALLOUT_WHEELLEVELS levels of CALLOUT_WHEELSIZE slots
+ * each. Level 0 has one slot per tick; each slot at level N covers
+ * CALLOUT_WHEELSIZE^N ticks. A callout due in fewer than
+ * CALLOUT_WHEELSIZE ticks goes straight into its level 0 slot;
+ * farther ones go into the first level that can hold them, and are
+ * cascaded down a level each time the level below wraps around.
+ *
+ * wheel_now is the next tick to be processed. Everything is
+ * protected by wheel_lock.
  */
-static struct wchan *lbolt;
+#define CALLOUT_WHEELSIZE	(1U << CALLOUT_WHEELBITS)
+#define CALLOUT_WHEELMASK	(CALLOUT_WHEELSIZE - 1)
+
+static struct callout *wheel[CALLOUT_WHEELLEVELS][CALLOUT_WHEELSIZE];
+static unsigned wheel_now;
+static struct spinlock wheel_lock = SPINLOCK_INITIALIZER;
+
+/*
+ * Sleeping threads wait on one of a small table of wait channels,
+ * hashed by the address of their sleep record, so that one expiring
+ * sleep only wakes up the few threads that share its channel.
+ */
+#define SLEEPHASH_SIZE		32
+static struct wchan *sleephash[SLEEPHASH_SIZE];
 
 /*
  * Setup.
@@ -64,12 +89,195 @@ static struct wchan *lbolt;
 void
 hardclock_bootstrap(void)
 {
-	lbolt = wchan_create("lbolt");
-	if (lbolt == NULL) {
-		panic("Couldn't create lbolt\n");
+	unsigned i;
+
+	for (i=0; i<SLEEPHASH_SIZE; i++) {
+		sleephash[i] = wchan_create("clocksleep");
+		if (sleephash[i] == NULL) {
+			panic("Couldn't create clocksleep wchans\n");
+		}
 	}
 }
 
+////////////////////////////////////////////////////////////
+//
+// Callouts
+
+/*
+ * Put a callout in the right wheel slot for its expiry time.
+ * The wheel must be locked.
+ */
+static
+void
+callout_insert(struct callout *co)
+{
+	unsigned delta, level, slot;
+	struct callout **head;
+
+	KASSERT(spinlock_do_i_hold(&wheel_lock));
+
+	delta = co->co_expire - wheel_now;
+	if (delta > CALLOUT_MAXTICKS) {
+		/* Already due (it's behind wheel_now): run next tick */
+		co->co_expire = wheel_now;
+		delta = 0;
+	}
+
+	for (level = 0; level < CALLOUT_WHEELLEVELS - 1; level++) {
+		if (delta < (1U << (CALLOUT_WHEELBITS * (level + 1)))) {
+			break;
+		}
+	}
+	slot = (co->co_expire >> (CALLOUT_WHEELBITS * level))
+		& CALLOUT_WHEELMASK;
+
+	head = &wheel[level][slot];
+	co->co_next = *head;
+	if (co->co_next != NULL) {
+		co->co_next->co_prevp = &co->co_next;
+	}
+	co->co_prevp = head;
+	*head = co;
+}
+
+/*
+ * Take a callout off whatever wheel slot it's on.
+ * The wheel must be locked.
+ */
+static
+void
+callout_remove(struct callout *co)
+{
+	KASSERT(spinlock_do_i_hold(&wheel_lock));
+	KASSERT(co->co_prevp != NULL);
+
+	*co->co_prevp = co->co_next;
+	if (co->co_next != NULL) {
+		co->co_next->co_prevp = co->co_prevp;
+	}
+	co->co_next = NULL;
+	co->co_prevp = NULL;
+}
+
+/*
+ * Move everything in slot SLOT of level LEVEL down to the levels
+ * below, now that its time has come. Returns SLOT, so the caller can
+ * tell whether this level has also wrapped around.
+ */
+static
+unsigned
+callout_cascade(unsigned level, unsigned slot)
+{
+	struct callout *list, *co;
+
+	list = wheel[level][slot];
+	wheel[level][slot] = NULL;
+	while ((co = list) != NULL) {
+		list = co->co_next;
+		co->co_next = NULL;
+		co->co_prevp = NULL;
+		callout_insert(co);
+	}
+	return slot;
+}
+
+void
+callout_init(struct callout *co, void (*func)(void *), void *arg)
+{
+	co->co_next = NULL;
+	co->co_prevp = NULL;
+	co->co_expire = 0;
+	co->co_func = func;
+	co->co_arg = arg;
+}
+
+void
+callout_schedule(struct callout *co, unsigned ticks)
+{
+	if (ticks == 0) {
+		ticks = 1;
+	}
+	if (ticks > CALLOUT_MAXTICKS) {
+		ticks = CALLOUT_MAXTICKS;
+	}
+
+	spinlock_acquire(&wheel_lock);
+	if (co->co_prevp != NULL) {
+		callout_remove(co);
+	}
+	/*
+	 * wheel_now is the tick about to be processed, which may be
+	 * almost no time away; skip it, so that at least TICKS whole
+	 * ticks pass before the callout runs.
+	 */
+	co->co_expire = wheel_now + ticks;
+	callout_insert(co);
+	spinlock_release(&wheel_lock);
+}
+
+bool
+callout_stop(struct callout *co)
+{
+	bool pending;
+
+	spinlock_acquire(&wheel_lock);
+	pending = (co->co_prevp != NULL);
+	if (pending) {
+		callout_remove(co);
+	}
+	spinlock_release(&wheel_lock);
+	return pending;
+}
+
+/*
+ * Advance the wheel by one tick and run whatever is due. Called from
+ * hardclock() on CPU 0.
+ *
+ * The due callouts are unhooked from the wheel before any of them
+ * is called, and the wheel is unlocked while calling them, so a
+ * callout function may reschedule itself or others.
+ */
+static
+void
+callout_tick(void)
+{
+	struct callout *list, *co;
+	unsigned slot, level;
+
+	spinlock_acquire(&wheel_lock);
+
+	slot = wheel_now & CALLOUT_WHEELMASK;
+	if (slot == 0) {
+		for (level = 1; level < CALLOUT_WHEELLEVELS; level++) {
+			if (callout_cascade(level,
+				(wheel_now >> (CALLOUT_WHEELBITS * level))
+				& CALLOUT_WHEELMASK) != 0) {
+				break;
+			}
+		}
+	}
+	wheel_now++;
+
+	list = wheel[0][slot];
+	wheel[0][slot] = NULL;
+	if (list != NULL) {
+		list->co_prevp = &list;
+	}
+
+	while ((co = list) != NULL) {
+		callout_remove(co);
+		spinlock_release(&wheel_lock);
+		co->co_func(co->co_arg);
+		spinlock_acquire(&wheel_lock);
+	}
+
+	spinlock_release(&wheel_lock);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Clock interrupts
+
 /*
  * This is called once per second, on one processor, by the timer
  * code.
@@ -77,8 +285,7 @@ hardclock_bootstrap(void)
 void
 timerclock(void)
 {
-	/* Just broadcast on lbolt */
-	wchan_wakeall(lbolt);
+	/* Nothing to do; timed events are handled by callouts. */
 }
 
 /*
@@ -88,29 +295,111 @@ timerclock(void)
 void
 hardclock(void)
 {
+	struct proc *p;
+
 	/*
-	 * Collect statistics here as desired.
+	 * Charge the tick to whatever it interrupted, and to its
+	 * process.
 	 */
+	p = curthread->t_proc;
+	if (p == kproc) {
+		p = NULL;
+	}
+	if (curcpu->c_isidle) {
+		curcpu->c_stats.sc_ticks_idle++;
+	}
+	else if (curcpu->c_irq_fromuser) {
+		curcpu->c_stats.sc_ticks_user++;
+		if (p != NULL) {
+			p->p_usage.pu_uticks++;
+		}
+	}
+	else {
+		curcpu->c_stats.sc_ticks_sys++;
+		if (p != NULL) {
+			p->p_usage.pu_sticks++;
+		}
+	}
+	/* Unlocked read; this is only a sample. */
+	curcpu->c_stats.sc_rqlen_sum += curcpu->c_runqueue.tl_count;
 
 	curcpu->c_hardclocks++;
+	if (curcpu->c_number == 0) {
+		callout_tick();
+	}
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
-	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
-		thread_consider_migration();
-	}
+	/* A tick outside an RCU read section is a quiescent state. */
+	rcu_quiescent();
+	thread_rttick();
 	thread_yield();
 }
 
+////////////////////////////////////////////////////////////
+//
+// Sleeping
+
+struct clocksleeper {
+	struct callout cs_callout;
+	struct wchan *cs_wchan;
+	volatile bool cs_done;
+};
+
+/*
+ * Callout function for clock_sleepticks. Once cs_done is set the
+ * sleeper may return and its (stack) record vanish, so it is set
+ * last, with the channel locked so the sleeper can't miss it.
+ */
+static
+void
+clock_wakesleeper(void *vcs)
+{
+	struct clocksleeper *cs = vcs;
+	struct wchan *wc;
+
+	wc = cs->cs_wchan;
+	wchan_lock(wc);
+	cs->cs_done = true;
+	wchan_unlock(wc);
+	wchan_wakeall(wc);
+}
+
+/*
+ * Suspend execution for at least TICKS hardclock ticks.
+ */
+void
+clock_sleepticks(unsigned ticks)
+{
+	struct clocksleeper cs;
+	unsigned chunk;
+
+	cs.cs_wchan = sleephash[((uintptr_t)&cs / sizeof(cs))
+				% SLEEPHASH_SIZE];
+	callout_init(&cs.cs_callout, clock_wakesleeper, &cs);
+
+	while (ticks > 0) {
+		chunk = ticks < CALLOUT_MAXTICKS ? ticks : CALLOUT_MAXTICKS;
+		ticks -= chunk;
+
+		cs.cs_done = false;
+		wchan_lock(cs.cs_wchan);
+		callout_schedule(&cs.cs_callout, chunk);
+		while (!cs.cs_done) {
+			wchan_sleep(cs.cs_wchan);
+			wchan_lock(cs.cs_wchan);
+		}
+		wchan_unlock(cs.cs_wchan);
+	}
+}
+
 /*
  * Suspend execution for n seconds.
  */
 void
 clocksleep(int num_secs)
 {
-	while (num_secs > 0) {
-		wchan_lock(lbolt);
-		wchan_sleep(lbolt);
-		num_secs--;
+	if (num_secs > 0) {
+		clock_sleepticks(num_secs * HZ);
 	}
 }
@@ -0,0 +1,262 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Lock contention statistics ("options lockstat").
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <clock.h>
+#include <lockstat.h>
+
+/*
+ * All records, newest first. Records are never freed, so walking the
+ * list without the lock is safe once a pointer has been read.
+ */
+static struct lockstat *lockstat_list;
+static struct spinlock lockstat_listlock = SPINLOCK_INITIALIZER;
+
+/*
+ * The counters are protected by a bare test-and-set word rather than
+ * a spinlock, as spinlock_acquire itself reports here. Callers have
+ * interrupts off (they hold, or have just released, a spinlock).
+ */
+static
+void
+lockstat_lock(struct lockstat *ls)
+{
+	while (spinlock_data_get(&ls->ls_busy) != 0 ||
+	       spinlock_data_testandset(&ls->ls_busy) != 0) {
+		/* spin */
+	}
+}
+
+static
+void
+lockstat_unlock(struct lockstat *ls)
+{
+	spinlock_data_set(&ls->ls_busy, 0);
+}
+
+static
+struct lockstat *
+lockstat_find(const char *name, unsigned kind)
+{
+	struct lockstat *ls;
+
+	for (ls = lockstat_list; ls != NULL; ls = ls->ls_next) {
+		if (ls->ls_kind == kind && !strcmp(ls->ls_name, name)) {
+			return ls;
+		}
+	}
+	return NULL;
+}
+
+struct lockstat *
+lockstat_get(const char *name, unsigned kind)
+{
+	struct lockstat *ls, *newls;
+	char *newname;
+
+	spinlock_acquire(&lockstat_listlock);
+	ls = lockstat_find(name, kind);
+	spinlock_release(&lockstat_listlock);
+	if (ls != NULL) {
+		return ls;
+	}
+
+	/* Can't kmalloc with a spinlock held; allocate and recheck. */
+	newls = kmalloc(sizeof(*newls));
+	newname = kstrdup(name);
+	if (newls == NULL || newname == NULL) {
+		kfree(newls);
+		kfree(newname);
+		return NULL;
+	}
+	newls->ls_name = newname;
+	newls->ls_kind = kind;
+	spinlock_data_set(&newls->ls_busy, 0);
+	newls->ls_acquires = newls->ls_contended = 0;
+	newls->ls_wait_ns = newls->ls_maxwait_ns = 0;
+	newls->ls_hold_ns = newls->ls_maxhold_ns = 0;
+
+	spinlock_acquire(&lockstat_listlock);
+	ls = lockstat_find(name, kind);
+	if (ls == NULL) {
+		newls->ls_next = lockstat_list;
+		lockstat_list = newls;
+		ls = newls;
+		newls = NULL;
+	}
+	spinlock_release(&lockstat_listlock);
+
+	if (newls != NULL) {
+		kfree(newname);
+		kfree(newls);
+	}
+	return ls;
+}
+
+uint64_t
+lockstat_now(void)
+{
+	return gettime_ns();
+}
+
+void
+lockstat_acquired(struct lockstat *ls, uint64_t waitstart, uint64_t now)
+{
+	uint64_t wait;
+
+	lockstat_lock(ls);
+	ls->ls_acquires++;
+	if (waitstart != 0) {
+		ls->ls_contended++;
+		wait = now > waitstart ? now - waitstart : 0;
+		ls->ls_wait_ns += wait;
+		if (wait > ls->ls_maxwait_ns) {
+			ls->ls_maxwait_ns = wait;
+		}
+	}
+	lockstat_unlock(ls);
+}
+
+void
+lockstat_released(struct lockstat *ls, uint64_t acquired)
+{
+	uint64_t now, hold;
+
+	if (acquired == 0) {
+		/* acquired before the clock was there */
+		return;
+	}
+	now = lockstat_now();
+	hold = now > acquired ? now - acquired : 0;
+
+	lockstat_lock(ls);
+	ls->ls_hold_ns += hold;
+	if (hold > ls->ls_maxhold_ns) {
+		ls->ls_maxhold_ns = hold;
+	}
+	lockstat_unlock(ls);
+}
+
+/*
+ * Does A rank above B? More contended acquisitions first, then more
+ * total wait time.
+ */
+static
+bool
+lockstat_before(const struct lockstat *a, const struct lockstat *b)
+{
+	if (a->ls_contended != b->ls_contended) {
+		return a->ls_contended > b->ls_contended;
+	}
+	return a->ls_wait_ns > b->ls_wait_ns;
+}
+
+void
+lockstat_print(unsigned topn)
+{
+	static const char *const kindnames[] = { "spin", "lock", "sem" };
+	struct lockstat **top, *ls;
+	unsigned i, j, n;
+
+	if (topn == 0) {
+		return;
+	}
+	top = kmalloc(topn * sizeof(*top));
+	if (top == NULL) {
+		kprintf("lockstat: out of memory\n");
+		return;
+	}
+
+	/* Insertion into a sorted array of the best TOPN so far. */
+	n = 0;
+	for (ls = lockstat_list; ls != NULL; ls = ls->ls_next) {
+		if (ls->ls_acquires == 0) {
+			continue;
+		}
+		for (i = n; i > 0 && lockstat_before(ls, top[i-1]); i--) {
+			/* find the slot */
+		}
+		if (i >= topn) {
+			continue;
+		}
+		if (n < topn) {
+			n++;
+		}
+		for (j = n-1; j > i; j--) {
+			top[j] = top[j-1];
+		}
+		top[i] = ls;
+	}
+
+	kprintf("%-16s %-4s %10s %10s %10s %10s %10s %10s\n",
+		"name", "kind", "acquires", "contended", "avgwait",
+		"maxwait", "avghold", "maxhold");
+	for (i=0; i<n; i++) {
+		ls = top[i];
+		kprintf("%-16s %-4s %10u %10u %8lluus %8lluus ",
+			ls->ls_name, kindnames[ls->ls_kind],
+			ls->ls_acquires, ls->ls_contended,
+			ls->ls_contended ?
+			ls->ls_wait_ns / ls->ls_contended / 1000 : 0ULL,
+			ls->ls_maxwait_ns / 1000);
+		if (ls->ls_kind == LOCKSTAT_SEM) {
+			kprintf("%10s %10s\n", "-", "-");
+		}
+		else {
+			kprintf("%8lluus %8lluus\n",
+				ls->ls_hold_ns / ls->ls_acquires / 1000,
+				ls->ls_maxhold_ns / 1000);
+		}
+	}
+	kfree(top);
+}
+
+void
+lockstat_reset(void)
+{
+	struct lockstat *ls;
+	int spl;
+
+	spl = splhigh();
+	for (ls = lockstat_list; ls != NULL; ls = ls->ls_next) {
+		lockstat_lock(ls);
+		ls->ls_acquires = ls->ls_contended = 0;
+		ls->ls_wait_ns = ls->ls_maxwait_ns = 0;
+		ls->ls_hold_ns = ls->ls_maxhold_ns = 0;
+		lockstat_unlock(ls);
+	}
+	splx(spl);
+}
@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Read-copy-update. See rcu.h for the interface.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <cpu.h>
+#include <spinlock.h>
+#include <wchan.h>
+#include <thread.h>
+#include <current.h>
+#include <rcu.h>
+
+/* True if grace period A is the same as or later than B. */
+#define GP_AFTEREQ(a, b)	((int)((a) - (b)) >= 0)
+
+/*
+ * Grace period state, protected by rcu_lock.
+ *
+ * rcu_gp_cur is the last grace period started and rcu_gp_done the
+ * last one finished; one is in progress when they differ.
+ * rcu_gp_want is the latest one anybody is waiting for.
+ * rcu_gp_waiting has a bit for each cpu that has yet to pass a
+ * quiescent state in the current grace period.
+ *
+ * Callbacks are queued in the order call_rcu was called, which is
+ * also the order of their rh_gp. Only the callback thread removes
+ * them.
+ */
+static struct spinlock rcu_lock = SPINLOCK_INITIALIZER;
+static volatile unsigned rcu_gp_cur;
+static volatile unsigned rcu_gp_done;
+static unsigned rcu_gp_want;
+static uint32_t rcu_gp_waiting;
+static struct rcu_head *rcu_cbhead;
+static struct rcu_head **rcu_cbtail = &rcu_cbhead;
+
+/*
+ * Signalled whenever a grace period ends. The callback thread and
+ * synchronize_rcu wait here.
+ */
+static struct wchan *rcu_wchan;
+
+/*
+ * Start a grace period if none is running and somebody wants one.
+ * If no cpu is busy it is over at once. Returns true if a grace
+ * period ended, in which case the caller should wake rcu_wchan once
+ * it has dropped rcu_lock.
+ */
+static
+bool
+rcu_startgp(void)
+{
+	KASSERT(spinlock_do_i_hold(&rcu_lock));
+
+	if (rcu_gp_cur != rcu_gp_done ||
+	    GP_AFTEREQ(rcu_gp_done, rcu_gp_want)) {
+		return false;
+	}
+	rcu_gp_cur++;
+	rcu_gp_waiting = thread_busycpus();
+	if (rcu_gp_waiting == 0) {
+		rcu_gp_done = rcu_gp_cur;
+		return true;
+	}
+	return false;
+}
+
+void
+rcu_read_lock(void)
+{
+	curthread->t_rcu_nesting++;
+}
+
+void
+rcu_read_unlock(void)
+{
+	KASSERT(curthread->t_rcu_nesting > 0);
+	curthread->t_rcu_nesting--;
+}
+
+/*
+ * Called from hardclock and the context switch code. This is on the
+ * path of every tick, so check without the lock first whether this
+ * cpu has anything to report.
+ */
+void
+rcu_quiescent(void)
+{
+	struct cpu *c;
+	uint32_t bit;
+	bool wake;
+
+	if (curthread->t_rcu_nesting > 0) {
+		return;
+	}
+	c = curcpu->c_self;
+	if (c->c_rcu_gpseen == rcu_gp_cur) {
+		return;
+	}
+
+	wake = false;
+	bit = (uint32_t)1 << c->c_number;
+
+	spinlock_acquire(&rcu_lock);
+	c->c_rcu_gpseen = rcu_gp_cur;
+	if (rcu_gp_waiting & bit) {
+		rcu_gp_waiting &= ~bit;
+		if (rcu_gp_waiting == 0) {
+			rcu_gp_done = rcu_gp_cur;
+			wake = true;
+			rcu_startgp();
+		}
+	}
+	spinlock_release(&rcu_lock);
+
+	if (wake) {
+		wchan_wakeall(rcu_wchan);
+	}
+}
+
+void
+call_rcu(struct rcu_head *rh, void (*func)(void *), void *arg)
+{
+	bool wake;
+
+	rh->rh_next = NULL;
+	rh->rh_func = func;
+	rh->rh_arg = arg;
+
+	spinlock_acquire(&rcu_lock);
+	/* Readers may be in the current grace period; wait out the next. */
+	rh->rh_gp = rcu_gp_cur + 1;
+	if (GP_AFTEREQ(rh->rh_gp, rcu_gp_want)) {
+		rcu_gp_want = rh->rh_gp;
+	}
+	*rcu_cbtail = rh;
+	rcu_cbtail = &rh->rh_next;
+	wake = rcu_startgp();
+	spinlock_release(&rcu_lock);
+
+	if (wake) {
+		wchan_wakeall(rcu_wchan);
+	}
+}
+
+void
+synchronize_rcu(void)
+{
+	unsigned target;
+	bool wake;
+
+	KASSERT(curthread->t_rcu_nesting == 0);
+
+	spinlock_acquire(&rcu_lock);
+	target = rcu_gp_cur + 1;
+	if (GP_AFTEREQ(target, rcu_gp_want)) {
+		rcu_gp_want = target;
+	}
+	wake = rcu_startgp();
+	spinlock_release(&rcu_lock);
+
+	if (wake) {
+		wchan_wakeall(rcu_wchan);
+	}
+
+	while (1) {
+		wchan_lock(rcu_wchan);
+		if (GP_AFTEREQ(rcu_gp_done, target)) {
+			wchan_unlock(rcu_wchan);
+			break;
+		}
+		wchan_sleep(rcu_wchan);
+	}
+}
+
+/*
+ * Check without the lock whether the first callback is ready. Only
+ * the callback thread removes callbacks, and call_rcu only queues
+ * callbacks that are not ready yet, so the answer can only change
+ * from false to true by a grace period ending, which wakes us.
+ */
+static
+bool
+rcu_cbready(void)
+{
+	struct rcu_head *rh;
+
+	rh = rcu_cbhead;
+	return rh != NULL && GP_AFTEREQ(rcu_gp_done, rh->rh_gp);
+}
+
+/*
+ * The callback thread. Callbacks may sleep and may call call_rcu, so
+ * they are run here rather than from the quiescent-state path, and
+ * without rcu_lock held.
+ */
+static
+void
+rcu_thread(void *data1, unsigned long data2)
+{
+	struct rcu_head *ready, *rh;
+	struct rcu_head **readytail;
+
+	(void)data1;
+	(void)data2;
+
+	while (1) {
+		wchan_lock(rcu_wchan);
+		if (!rcu_cbready()) {
+			wchan_sleep(rcu_wchan);
+			continue;
+		}
+		wchan_unlock(rcu_wchan);
+
+		/* Take everything whose grace period is over. */
+		ready = NULL;
+		readytail = &ready;
+		spinlock_acquire(&rcu_lock);
+		while (rcu_cbhead != NULL &&
+		       GP_AFTEREQ(rcu_gp_done, rcu_cbhead->rh_gp)) {
+			rh = rcu_cbhead;
+			rcu_cbhead = rh->rh_next;
+			*readytail = rh;
+			readytail = &rh->rh_next;
+		}
+		if (rcu_cbhead == NULL) {
+			rcu_cbtail = &rcu_cbhead;
+		}
+		*readytail = NULL;
+		spinlock_release(&rcu_lock);
+
+		while (ready != NULL) {
+			rh = ready;
+			ready = rh->rh_next;
+			rh->rh_func(rh->rh_arg);
+		}
+	}
+}
+
+void
+rcu_bootstrap(void)
+{
+	rcu_wchan = wchan_create("rcu");
+	if (rcu_wchan == NULL) {
+		panic("rcu_bootstrap: Out of memory\n");
+	}
+}
+
+void
+rcu_start(void)
+{
+	int result;
+
+	result = thread_fork("rcu", NULL, rcu_thread, NULL, 0);
+	if (result) {
+		panic("rcu_start: thread_fork failed: %s\n", strerror(result));
+	}
+}
@@ -35,12 +35,19 @@
 #include <cpu.h>
 #include <spl.h>
 #include <spinlock.h>
+#include <lockstat.h>
 #include <current.h>	/* for curcpu */
 
 /*
  * Spinlocks.
  */
 
+/*
+ * Iterations to wait, per cpu ahead of us in line, before looking at
+ * the lock again. About the length of a short critical section.
+ */
+#define SPINLOCK_BACKOFF	50
+
 
 /*
  * Initialize spinlock.
@@ -48,8 +55,27 @@
 void
 spinlock_init(struct spinlock *lk)
 {
-	spinlock_data_set(&lk->lk_lock, 0);
+	spinlock_data_set(&lk->lk_next, 0);
+	spinlock_data_set(&lk->lk_serving, 0);
 	lk->lk_holder = NULL;
+#if OPT_LOCKSTAT
+	lk->lk_stat = NULL;
+	lk->lk_acquired_ns = 0;
+#endif
+}
+
+/*
+ * Name a spinlock, so its contention is recorded.
+ */
+void
+spinlock_setname(struct spinlock *lk, const char *name)
+{
+#if OPT_LOCKSTAT
+	lk->lk_stat = lockstat_get(name, LOCKSTAT_SPINLOCK);
+#else
+	(void)lk;
+	(void)name;
+#endif
 }
 
 /*
@@ -59,7 +85,8 @@ void
 spinlock_cleanup(struct spinlock *lk)
 {
 	KASSERT(lk->lk_holder == NULL);
-	KASSERT(spinlock_data_get(&lk->lk_lock) == 0);
+	KASSERT(spinlock_data_get(&lk->lk_next) ==
+		spinlock_data_get(&lk->lk_serving));
 }
 
 /*
@@ -67,12 +94,18 @@ spinlock_cleanup(struct spinlock *lk)
  *
  * First disable interrupts (otherwise, if we get a timer interrupt we
  * might come back to this lock and deadlock), then use a machine-level
- * atomic operation to wait for the lock to be free.
+ * atomic operation to take a ticket, and wait for it to be served.
  */
 void
 spinlock_acquire(struct spinlock *lk)
 {
 	struct cpu *mycpu;
+	spinlock_data_t ticket, serving;
+	volatile unsigned i;
+	unsigned delay;
+#if OPT_LOCKSTAT
+	uint64_t waitstart = 0;
+#endif
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -87,27 +120,37 @@ spinlock_acquire(struct spinlock *lk)
 		mycpu = NULL;
 	}
 
+	/*
+	 * Fetch-and-add is the only atomic operation needed; after
+	 * that we only read lk_serving, which changes once per
+	 * release. Back off in proportion to the number of cpus ahead
+	 * of us, so a line of waiters doesn't all poll the lock word
+	 * while each of the others has its turn.
+	 */
+	ticket = spinlock_data_fetchadd(&lk->lk_next, 1);
 	while (1) {
-		/*
-		 * Do test-test-and-set, that is, read first before
-		 * doing test-and-set, to reduce bus contention.
-		 *
-		 * Test-and-set is a machine-level atomic operation
-		 * that writes 1 into the lock word and returns the
-		 * previous value. If that value was 0, the lock was
-		 * previously unheld and we now own it. If it was 1,
-		 * we don't.
-		 */
-		if (spinlock_data_get(&lk->lk_lock) != 0) {
-			continue;
+		serving = spinlock_data_get(&lk->lk_serving);
+		if (serving == ticket) {
+			break;
 		}
-		if (spinlock_data_testandset(&lk->lk_lock) != 0) {
-			continue;
+#if OPT_LOCKSTAT
+		if (waitstart == 0 && lk->lk_stat != NULL) {
+			waitstart = lockstat_now();
+		}
+#endif
+		delay = (ticket - serving) * SPINLOCK_BACKOFF;
+		for (i=0; i<delay; i++) {
+			/* spin */
 		}
-		break;
 	}
 
 	lk->lk_holder = mycpu;
+#if OPT_LOCKSTAT
+	if (lk->lk_stat != NULL) {
+		lk->lk_acquired_ns = lockstat_now();
+		lockstat_acquired(lk->lk_stat, waitstart, lk->lk_acquired_ns);
+	}
+#endif
 }
 
 /*
@@ -121,8 +164,15 @@ spinlock_release(struct spinlock *lk)
 		KASSERT(lk->lk_holder == curcpu->c_self);
 	}
 
+#if OPT_LOCKSTAT
+	if (lk->lk_stat != NULL) {
+		lockstat_released(lk->lk_stat, lk->lk_acquired_ns);
+	}
+#endif
 	lk->lk_holder = NULL;
-	spinlock_data_set(&lk->lk_lock, 0);
+	/* Only the holder writes lk_serving, so this needn't be atomic. */
+	spinlock_data_set(&lk->lk_serving,
+			  spinlock_data_get(&lk->lk_serving) + 1);
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
@@ -34,11 +34,14 @@
 
 #include <types.h>
 #include <lib.h>
+#include <cpu.h>
+#include <spl.h>
 #include <spinlock.h>
 #include <wchan.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <lockstat.h>
 
 ////////////////////////////////////////////////////////////
 //
@@ -71,6 +74,11 @@ sem_create(const char *name, int initial_count)
 
 	spinlock_init(&sem->sem_lock);
         sem->sem_count = initial_count;
+	sem->sem_handoff = false;
+#if OPT_LOCKSTAT
+	spinlock_setname(&sem->sem_lock, name);
+	sem->sem_stat = lockstat_get(name, LOCKSTAT_SEM);
+#endif
 
         return sem;
 }
@@ -87,9 +95,20 @@ sem_destroy(struct semaphore *sem)
         kfree(sem);
 }
 
+void
+sem_sethandoff(struct semaphore *sem, bool handoff)
+{
+	KASSERT(sem != NULL);
+	sem->sem_handoff = handoff;
+}
+
 void 
 P(struct semaphore *sem)
 {
+#if OPT_LOCKSTAT
+	uint64_t waitstart = 0;
+#endif
+
         KASSERT(sem != NULL);
 
         /*
@@ -102,6 +121,11 @@ P(struct semaphore *sem)
 
 	spinlock_acquire(&sem->sem_lock);
         while (sem->sem_count == 0) {
+#if OPT_LOCKSTAT
+		if (waitstart == 0 && sem->sem_stat != NULL) {
+			waitstart = lockstat_now();
+		}
+#endif
 		/*
 		 * Bridge to the wchan lock, so if someone else comes
 		 * along in V right this instant the wakeup can't go
@@ -126,21 +150,35 @@ P(struct semaphore *sem)
         }
         KASSERT(sem->sem_count > 0);
         sem->sem_count--;
+#if OPT_LOCKSTAT
+	if (sem->sem_stat != NULL) {
+		lockstat_acquired(sem->sem_stat, waitstart,
+				  waitstart ? lockstat_now() : 0);
+	}
+#endif
 	spinlock_release(&sem->sem_lock);
 }
 
 void
 V(struct semaphore *sem)
 {
+	struct thread *wakee = NULL;
+
         KASSERT(sem != NULL);
 
 	spinlock_acquire(&sem->sem_lock);
 
         sem->sem_count++;
         KASSERT(sem->sem_count > 0);
-	wchan_wakeone(sem->sem_wchan);
+	if (sem->sem_handoff) {
+		wakee = wchan_wakeone_handoff(sem->sem_wchan);
+	}
+	else {
+		wchan_wakeone(sem->sem_wchan);
+	}
 
 	spinlock_release(&sem->sem_lock);
+	thread_yield_to(wakee);
 }
 
 ////////////////////////////////////////////////////////////
@@ -172,6 +210,14 @@ lock_create(const char *name)
         spinlock_init(&lock->lk_lock);
         lock->cur_th = NULL;
         lock->initial_val = 0;
+        lock->lk_spins = 0;
+        lock->lk_blocks = 0;
+        lock->lk_handoff = false;
+#if OPT_LOCKSTAT
+        spinlock_setname(&lock->lk_lock, name);
+        lock->lk_stat = lockstat_get(name, LOCKSTAT_LOCK);
+        lock->lk_acquired_ns = 0;
+#endif
         return lock;
 }
 
@@ -186,13 +232,74 @@ lock_destroy(struct lock *lock)
         kfree(lock);
 }
 
+void
+lock_sethandoff(struct lock *lock, bool handoff)
+{
+        KASSERT(lock != NULL);
+        lock->lk_handoff = handoff;
+}
+
+/*
+ * Check if OWNER is running on some other cpu right now, and so
+ * likely to release the lock soon.
+ *
+ * This is read without locks and may be stale by the time we act on
+ * it; that only costs a wasted spin or an unneeded sleep. OWNER may
+ * even have exited, but thread structures are never unmapped, so
+ * looking at it is harmless.
+ */
+static
+bool
+lock_owner_running(struct thread *owner)
+{
+        return owner != NULL && owner->t_state == S_RUN &&
+                owner->t_cpu != curcpu->c_self;
+}
+
 void
 lock_acquire(struct lock *lock)
 {
+        struct thread *owner;
+        unsigned spins;
+        bool spun, blocked, spinout;
+#if OPT_LOCKSTAT
+        uint64_t waitstart = 0;
+#endif
+
         KASSERT(lock != NULL);
         KASSERT(curthread->t_in_interrupt == false);
+        spun = blocked = spinout = false;
         spinlock_acquire(&lock->lk_lock);
         while (lock->initial_val == 1) {
+#if OPT_LOCKSTAT
+            if (waitstart == 0 && lock->lk_stat != NULL) {
+                waitstart = lockstat_now();
+            }
+#endif
+            owner = lock->cur_th;
+            if (!spinout && lock_owner_running(owner)) {
+                /*
+                 * Spin, with interrupts on, until the lock is
+                 * released or changes hands or the owner stops
+                 * running. Then look again.
+                 */
+                spinlock_release(&lock->lk_lock);
+                for (spins = 0; spins < LOCK_SPIN_MAX; spins++) {
+                    if (lock->initial_val == 0 ||
+                        lock->cur_th != owner ||
+                        !lock_owner_running(owner)) {
+                        break;
+                    }
+                }
+                if (spins == LOCK_SPIN_MAX) {
+                    /* Long critical section; stop burning cpu. */
+                    spinout = true;
+                }
+                spun = true;
+                spinlock_acquire(&lock->lk_lock);
+                continue;
+            }
+            blocked = true;
             wchan_lock(lock->lk_wchan);
             spinlock_release(&lock->lk_lock);
             wchan_sleep(lock->lk_wchan);
@@ -201,19 +308,45 @@ lock_acquire(struct lock *lock)
         KASSERT(lock->initial_val != 1);
         lock->initial_val = 1;
         lock->cur_th = curthread;
+        if (blocked) {
+            lock->lk_blocks++;
+        }
+        else if (spun) {
+            lock->lk_spins++;
+        }
+#if OPT_LOCKSTAT
+        if (lock->lk_stat != NULL) {
+            lock->lk_acquired_ns = lockstat_now();
+            lockstat_acquired(lock->lk_stat, waitstart,
+                              lock->lk_acquired_ns);
+        }
+#endif
         spinlock_release(&lock->lk_lock);
 }
 
 void
 lock_release(struct lock *lock)
 {
+        struct thread *wakee = NULL;
+
         KASSERT(lock != NULL);
         KASSERT(curthread == lock->cur_th);
         spinlock_acquire(&lock->lk_lock);
+#if OPT_LOCKSTAT
+        if (lock->lk_stat != NULL) {
+            lockstat_released(lock->lk_stat, lock->lk_acquired_ns);
+        }
+#endif
         lock->initial_val = 0;
         KASSERT(lock->initial_val == 0);
-        wchan_wakeone(lock->lk_wchan);
+        if (lock->lk_handoff) {
+            wakee = wchan_wakeone_handoff(lock->lk_wchan);
+        }
+        else {
+            wchan_wakeone(lock->lk_wchan);
+        }
         spinlock_release(&lock->lk_lock);
+        thread_yield_to(wakee);
 }
 
 bool
@@ -276,20 +409,328 @@ cv_wait(struct cv *cv, struct lock *lock)
         lock_acquire(lock);
 }
 
+/*
+ * Wait morphing. A thread woken from cv_wait must get LOCK before it
+ * can do anything, and the waker normally still holds it, so waking
+ * it now would only have it go back to sleep on the lock. Instead,
+ * while LOCK is held, move the waiters straight onto the lock's wait
+ * channel; each lock_release then wakes one of them, which returns
+ * from wchan_sleep in cv_wait and takes the lock. If LOCK isn't held
+ * there is no release coming, so wake them in the ordinary way.
+ *
+ * Lock order is cv_wchan, then lk_lock, then lk_wchan, as in
+ * cv_wait (which calls lock_release with cv_wchan locked).
+ */
+static
 void
-cv_signal(struct cv *cv, struct lock *lock)
+cv_dowake(struct cv *cv, struct lock *lock, bool all)
 {
+        bool held;
+
         KASSERT(cv != NULL);
         KASSERT(lock != NULL);
-	    lock_do_i_hold(lock);
-        wchan_wakeone(cv->cv_wchan);
+
+        wchan_lock(cv->cv_wchan);
+        spinlock_acquire(&lock->lk_lock);
+        held = lock->initial_val == 1;
+        if (held) {
+            wchan_requeue(cv->cv_wchan, lock->lk_wchan, all);
+        }
+        spinlock_release(&lock->lk_lock);
+        wchan_unlock(cv->cv_wchan);
+
+        if (!held) {
+            if (all) {
+                wchan_wakeall(cv->cv_wchan);
+            }
+            else {
+                wchan_wakeone(cv->cv_wchan);
+            }
+        }
+}
+
+void
+cv_signal(struct cv *cv, struct lock *lock)
+{
+        cv_dowake(cv, lock, false);
 }
 
 void
 cv_broadcast(struct cv *cv, struct lock *lock)
 {
-        KASSERT(cv != NULL);
-        KASSERT(lock != NULL);
-	    lock_do_i_hold(lock);
-        wchan_wakeall(cv->cv_wchan);
+        cv_dowake(cv, lock, true);
+}
+
+////////////////////////////////////////////////////////////
+//
+// Reader-writer lock
+//
+// In per-cpu mode a reader that sees no writer holding or waiting
+// just bumps its own cpu's count; it then rechecks for writers, and
+// backs out to the slow path if one arrived. A writer announces
+// itself in rw_writewaiters before summing the counts, so between
+// them one of the two always sees the other. (This relies on
+// stores becoming visible in program order, as they do on System/161;
+// a weaker memory model would need barriers here.) Readers that
+// release while a writer waits take the spinlock and wake it if
+// they were the last.
+
+/* Cpu numbers are below this (as for affinity masks). */
+#define RWLOCK_MAXCPUS 32
+
+/* Pad each per-cpu count to its own cache line. */
+#define RWLOCK_PCPU_SIZE 32
+
+struct rwlock_pcpu {
+	volatile int rp_count;
+	char rp_pad[RWLOCK_PCPU_SIZE - sizeof(int)];
+};
+
+static
+struct rwlock *
+rwlock_docreate(const char *name, bool percpu)
+{
+	struct rwlock *rw;
+	unsigned i;
+
+	rw = kmalloc(sizeof(*rw));
+	if (rw == NULL) {
+		return NULL;
+	}
+
+	rw->rw_name = kstrdup(name);
+	if (rw->rw_name == NULL) {
+		kfree(rw);
+		return NULL;
+	}
+
+	rw->rw_readwchan = wchan_create(rw->rw_name);
+	if (rw->rw_readwchan == NULL) {
+		kfree(rw->rw_name);
+		kfree(rw);
+		return NULL;
+	}
+
+	rw->rw_writewchan = wchan_create(rw->rw_name);
+	if (rw->rw_writewchan == NULL) {
+		wchan_destroy(rw->rw_readwchan);
+		kfree(rw->rw_name);
+		kfree(rw);
+		return NULL;
+	}
+
+	rw->rw_pcpu = NULL;
+	if (percpu) {
+		rw->rw_pcpu = kmalloc(RWLOCK_MAXCPUS * sizeof(*rw->rw_pcpu));
+		if (rw->rw_pcpu == NULL) {
+			wchan_destroy(rw->rw_writewchan);
+			wchan_destroy(rw->rw_readwchan);
+			kfree(rw->rw_name);
+			kfree(rw);
+			return NULL;
+		}
+		for (i=0; i<RWLOCK_MAXCPUS; i++) {
+			rw->rw_pcpu[i].rp_count = 0;
+		}
+	}
+
+	spinlock_init(&rw->rw_lock);
+	rw->rw_readers = 0;
+	rw->rw_writewaiters = 0;
+	rw->rw_writer = NULL;
+	return rw;
+}
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	return rwlock_docreate(name, false);
+}
+
+struct rwlock *
+rwlock_create_percpu(const char *name)
+{
+	return rwlock_docreate(name, true);
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(rw->rw_writer == NULL);
+	KASSERT(rw->rw_writewaiters == 0);
+
+	spinlock_cleanup(&rw->rw_lock);
+	wchan_destroy(rw->rw_writewchan);
+	wchan_destroy(rw->rw_readwchan);
+	if (rw->rw_pcpu != NULL) {
+		kfree(rw->rw_pcpu);
+	}
+	kfree(rw->rw_name);
+	kfree(rw);
+}
+
+/*
+ * Count the readers. In per-cpu mode individual counts can go
+ * negative, as a reader may release on a different cpu from the one
+ * it acquired on; only the sum means anything.
+ */
+static
+unsigned
+rwlock_readers(struct rwlock *rw)
+{
+	unsigned i;
+	int sum;
+
+	if (rw->rw_pcpu == NULL) {
+		return rw->rw_readers;
+	}
+	sum = 0;
+	for (i=0; i<RWLOCK_MAXCPUS; i++) {
+		sum += rw->rw_pcpu[i].rp_count;
+	}
+	KASSERT(sum >= 0);
+	return sum;
+}
+
+/*
+ * Add DELTA to this cpu's reader count. Interrupts must be off so
+ * we stay on this cpu.
+ */
+static
+void
+rwlock_pcpu_add(struct rwlock *rw, int delta)
+{
+	KASSERT(curthread->t_curspl > 0);
+	rw->rw_pcpu[curcpu->c_number].rp_count += delta;
+}
+
+/*
+ * A reader has left; wake a waiting writer if it was the last.
+ * Call with the spinlock held.
+ */
+static
+void
+rwlock_reader_gone(struct rwlock *rw)
+{
+	KASSERT(spinlock_do_i_hold(&rw->rw_lock));
+	if (rw->rw_writewaiters > 0 && rwlock_readers(rw) == 0) {
+		wchan_wakeone(rw->rw_writewchan);
+	}
+}
+
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+	int spl;
+
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+	KASSERT(rw->rw_writer != curthread);
+
+	if (rw->rw_pcpu != NULL) {
+		/* Fast path: no writer around. */
+		spl = splhigh();
+		rwlock_pcpu_add(rw, 1);
+		if (rw->rw_writer == NULL && rw->rw_writewaiters == 0) {
+			splx(spl);
+			return;
+		}
+		rwlock_pcpu_add(rw, -1);
+		splx(spl);
+	}
+
+	spinlock_acquire(&rw->rw_lock);
+	if (rw->rw_pcpu != NULL) {
+		/* A writer may have seen our count and gone to sleep. */
+		rwlock_reader_gone(rw);
+	}
+	while (rw->rw_writer != NULL || rw->rw_writewaiters > 0) {
+		wchan_lock(rw->rw_readwchan);
+		spinlock_release(&rw->rw_lock);
+		wchan_sleep(rw->rw_readwchan);
+		spinlock_acquire(&rw->rw_lock);
+	}
+	if (rw->rw_pcpu != NULL) {
+		/* Holding a spinlock keeps interrupts off. */
+		rwlock_pcpu_add(rw, 1);
+	}
+	else {
+		rw->rw_readers++;
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	int spl;
+
+	KASSERT(rw != NULL);
+	KASSERT(rw->rw_writer == NULL);
+
+	if (rw->rw_pcpu != NULL) {
+		spl = splhigh();
+		rwlock_pcpu_add(rw, -1);
+		splx(spl);
+		if (rw->rw_writewaiters == 0) {
+			return;
+		}
+		spinlock_acquire(&rw->rw_lock);
+	}
+	else {
+		spinlock_acquire(&rw->rw_lock);
+		KASSERT(rw->rw_readers > 0);
+		rw->rw_readers--;
+	}
+	rwlock_reader_gone(rw);
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+	KASSERT(rw->rw_writer != curthread);
+
+	spinlock_acquire(&rw->rw_lock);
+	rw->rw_writewaiters++;
+	while (rw->rw_writer != NULL || rwlock_readers(rw) > 0) {
+		wchan_lock(rw->rw_writewchan);
+		spinlock_release(&rw->rw_lock);
+		wchan_sleep(rw->rw_writewchan);
+		spinlock_acquire(&rw->rw_lock);
+	}
+	/*
+	 * Set rw_writer before dropping rw_writewaiters, so a
+	 * fast-path reader never sees neither.
+	 */
+	rw->rw_writer = curthread;
+	rw->rw_writewaiters--;
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(rw->rw_writer == curthread);
+
+	spinlock_acquire(&rw->rw_lock);
+	rw->rw_writer = NULL;
+	if (rw->rw_writewaiters > 0) {
+		/* Writer preference: the next writer goes first. */
+		wchan_wakeone(rw->rw_writewchan);
+	}
+	else {
+		wchan_wakeall(rw->rw_readwchan);
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+	return rw->rw_writer == curthread;
 }
@@ -50,6 +50,8 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <clock.h>
+#include <rcu.h>
 
 #include "opt-synchprobs.h"
 
@@ -72,6 +74,20 @@ static struct cpuarray allcpus;
 /* Used to wait for secondary CPUs to come online. */
 static struct semaphore *cpu_startup_sem;
 
+static struct thread *thread_steal(void);
+static void thread_switch(threadstate_t newstate, struct wchan *wc);
+static void thread_idle(void *unused1, unsigned long unused2);
+static void thread_handoff(void);
+static void thread_make_runnable(struct thread *target, bool already_have_lock,
+				 bool athead);
+static void thread_rt_leave(struct thread *t);
+
+/* Protects real-time admission control (c_rt_util on every cpu). */
+static struct spinlock thread_rt_lock = SPINLOCK_INITIALIZER;
+
+/* Steal cache-hot threads only from run queues longer than this. */
+#define THREAD_STEAL_HOTQUEUE 2
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -112,37 +128,76 @@ thread_checkstack(struct thread *thread)
 }
 
 /*
- * Create a thread. This is used both to create a first thread
- * for each CPU and to create subsequent forked threads.
+ * Set the name of a thread. Short names are kept in the thread
+ * structure itself so that creating (or recycling) a thread usually
+ * doesn't need a separate allocation.
  */
 static
-struct thread *
-thread_create(const char *name)
+int
+thread_setname(struct thread *thread, const char *name)
 {
-	struct thread *thread;
-
-	DEBUGASSERT(name != NULL);
-
-	thread = kmalloc(sizeof(*thread));
-	if (thread == NULL) {
-		return NULL;
+	if (strlen(name) < sizeof(thread->t_namebuf)) {
+		strcpy(thread->t_namebuf, name);
+		thread->t_name = thread->t_namebuf;
 	}
+	else {
+		thread->t_name = kstrdup(name);
+		if (thread->t_name == NULL) {
+			return ENOMEM;
+		}
+	}
+	return 0;
+}
 
-	thread->t_name = kstrdup(name);
-	if (thread->t_name == NULL) {
-		kfree(thread);
-		return NULL;
+/*
+ * Release the thread's name, if it was allocated separately.
+ */
+static
+void
+thread_freename(struct thread *thread)
+{
+	if (thread->t_name != thread->t_namebuf) {
+		kfree(thread->t_name);
 	}
+	thread->t_name = NULL;
+}
+
+/*
+ * (Re)initialize the fields of a thread that has just been allocated
+ * or pulled out of the thread cache. Does not touch t_name or
+ * t_stack.
+ */
+static
+void
+thread_initfields(struct thread *thread)
+{
 	thread->t_wchan_name = "NEW";
 	thread->t_state = S_READY;
 
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
+	thread->t_affinity = THREAD_AFFINITY_ALL;
+	thread->t_lastran = 0;
+	thread->t_rcu_nesting = 0;
+	thread->t_rt = false;
+	thread->t_rt_throttled = false;
+	thread->t_rt_missed = false;
+	thread->t_rt_cpu = NULL;
+	thread->t_rt_util = 0;
+	thread->t_rt_period = 0;
+	thread->t_rt_budget = 0;
+	thread->t_rt_deadline = 0;
+	thread->t_rt_release = 0;
+	thread->t_rt_absdeadline = 0;
+	thread->t_rt_left = 0;
+
+	/* Scheduler statistics */
+	thread->t_runnable_ns = 0;
+	bzero(&thread->t_stats, sizeof(thread->t_stats));
 
 	/* Interrupt state fields */
 	thread->t_in_interrupt = false;
@@ -150,6 +205,31 @@ thread_create(const char *name)
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
 	/* If you add to struct thread, be sure to initialize here */
+}
+
+/*
+ * Create a thread. This is used both to create a first thread
+ * for each CPU and to create subsequent forked threads.
+ */
+static
+struct thread *
+thread_create(const char *name)
+{
+	struct thread *thread;
+
+	DEBUGASSERT(name != NULL);
+
+	thread = kmalloc(sizeof(*thread));
+	if (thread == NULL) {
+		return NULL;
+	}
+
+	if (thread_setname(thread, name)) {
+		kfree(thread);
+		return NULL;
+	}
+	thread->t_stack = NULL;
+	thread_initfields(thread);
 
 	return thread;
 }
@@ -179,15 +259,31 @@ cpu_create(unsigned hardware_number)
 
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
+	threadlist_init(&c->c_threadcache);
+	c->c_handoff = NULL;
+	c->c_idlethread = NULL;
+	c->c_yieldto = NULL;
 	c->c_hardclocks = 0;
+	c->c_steal_seed = hardware_number * 2654435761U + 1;
+	c->c_steals = 0;
+	c->c_steal_misses = 0;
+	c->c_irq_fromuser = false;
+	bzero(&c->c_stats, sizeof(c->c_stats));
+	c->c_rcu_gpseen = 0;
 
 	c->c_isidle = false;
+	c->c_rt_preempt = false;
 	threadlist_init(&c->c_runqueue);
+	threadlist_init(&c->c_rtqueue);
+	threadlist_init(&c->c_rtthrottled);
+	c->c_rt_util = 0;
 	spinlock_init(&c->c_runqueue_lock);
+	spinlock_setname(&c->c_runqueue_lock, "runqueue");
 
 	c->c_ipi_pending = 0;
 	c->c_numshootdown = 0;
 	spinlock_init(&c->c_ipi_lock);
+	spinlock_setname(&c->c_ipi_lock, "ipi");
 
 	result = cpuarray_add(&allcpus, c, &c->c_number);
 	if (result != 0) {
@@ -222,6 +318,26 @@ cpu_create(unsigned hardware_number)
 	}
 	c->c_curthread->t_cpu = c;
 
+	snprintf(namebuf, sizeof(namebuf), "<idle #%d>", c->c_number);
+	c->c_idlethread = thread_create(namebuf);
+	if (c->c_idlethread == NULL) {
+		panic("cpu_create: thread_create failed\n");
+	}
+	c->c_idlethread->t_stack = kmalloc(STACK_SIZE);
+	if (c->c_idlethread->t_stack == NULL) {
+		panic("cpu_create: couldn't allocate stack");
+	}
+	thread_checkstack_init(c->c_idlethread);
+	c->c_idlethread->t_cpu = c;
+	c->c_idlethread->t_affinity = (uint32_t)1 << c->c_number;
+	result = proc_addthread(kproc, c->c_idlethread);
+	if (result) {
+		panic("cpu_create: proc_addthread:: %s\n", strerror(result));
+	}
+	/* As in thread_fork; new threads start holding the runqueue lock. */
+	c->c_idlethread->t_iplhigh_count++;
+	switchframe_init(c->c_idlethread, thread_idle, NULL, 0);
+
 	cpu_machdep_init(c);
 
 	return c;
@@ -258,13 +374,89 @@ thread_destroy(struct thread *thread)
 	/* sheer paranoia */
 	thread->t_wchan_name = "DESTROYED";
 
-	kfree(thread->t_name);
+	thread_freename(thread);
 	kfree(thread);
 }
 
+/*
+ * Thread cache.
+ *
+ * Rather than freeing exited threads, exorcise() keeps up to
+ * THREAD_CACHE_MAX of them, stack and all, on a per-cpu list, and
+ * thread_fork() takes from there before falling back to kmalloc.
+ * This saves two or three kmalloc/kfree pairs per thread lifetime.
+ *
+ * The cache is only touched by its own cpu, with interrupts off so
+ * the current thread can't be preempted or migrated mid-operation.
+ */
+
+/*
+ * Park a dead thread in the current cpu's cache, or destroy it if
+ * the cache is full or the thread isn't reusable. Interrupts must be
+ * off.
+ */
+static
+void
+thread_recycle(struct thread *thread)
+{
+	KASSERT(curthread->t_curspl > 0);
+	KASSERT(thread->t_proc == NULL);
+
+	if (thread->t_stack == NULL ||
+	    curcpu->c_threadcache.tl_count >= THREAD_CACHE_MAX) {
+		thread_destroy(thread);
+		return;
+	}
+
+	thread_machdep_cleanup(&thread->t_machdep);
+	thread_freename(thread);
+	thread->t_wchan_name = "CACHED";
+	threadlist_addhead(&curcpu->c_threadcache, thread);
+}
+
+/*
+ * Get a thread with a stack, from the cache if possible.
+ */
+static
+struct thread *
+thread_create_withstack(const char *name)
+{
+	struct thread *thread;
+	int spl;
+
+	spl = splhigh();
+	thread = threadlist_remhead(&curcpu->c_threadcache);
+	splx(spl);
+
+	if (thread != NULL) {
+		if (thread_setname(thread, name)) {
+			spl = splhigh();
+			threadlist_addhead(&curcpu->c_threadcache, thread);
+			splx(spl);
+			return NULL;
+		}
+		thread_initfields(thread);
+		thread_checkstack_init(thread);
+		return thread;
+	}
+
+	thread = thread_create(name);
+	if (thread == NULL) {
+		return NULL;
+	}
+	thread->t_stack = kmalloc(STACK_SIZE);
+	if (thread->t_stack == NULL) {
+		thread_destroy(thread);
+		return NULL;
+	}
+	thread_checkstack_init(thread);
+	return thread;
+}
+
 /*
  * Clean up zombies. (Zombies are threads that have exited but still
- * need to have thread_destroy called on them.)
+ * need to have thread_destroy called on them.) Those that can be
+ * reused go into the thread cache instead.
  *
  * The list of zombies is per-cpu.
  */
@@ -277,7 +469,47 @@ exorcise(void)
 	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
 		KASSERT(z != curthread);
 		KASSERT(z->t_state == S_ZOMBIE);
-		thread_destroy(z);
+		thread_recycle(z);
+	}
+}
+
+/*
+ * The idle thread. There is one per cpu, and it is never on a run
+ * queue; thread_switch runs it when the current thread has to leave
+ * the cpu and there is nothing else to switch to, since a thread
+ * cannot be sent on until it has been switched away from. Each time
+ * it runs it sends the departing thread on (see thread_handoff) and
+ * then switches away again, idling in the usual way if need be.
+ */
+static
+void
+thread_idle(void *unused1, unsigned long unused2)
+{
+	(void)unused1;
+	(void)unused2;
+
+	while (1) {
+		thread_switch(S_READY, NULL);
+	}
+}
+
+/*
+ * Finish moving a thread that switched away from this cpu because
+ * it is no longer allowed to run here. Called after the switch, in
+ * the context of the thread that was switched to, by which point the
+ * departing thread's context has been saved.
+ */
+static
+void
+thread_handoff(void)
+{
+	struct thread *t;
+
+	t = curcpu->c_handoff;
+	if (t != NULL) {
+		KASSERT(t != curthread);
+		curcpu->c_handoff = NULL;
+		thread_make_runnable(t, false, false);
 	}
 }
 
@@ -306,6 +538,9 @@ thread_panic(void)
 	curcpu->c_runqueue.tl_count = 0;
 	curcpu->c_runqueue.tl_head.tln_next = NULL;
 	curcpu->c_runqueue.tl_tail.tln_prev = NULL;
+	curcpu->c_rtqueue.tl_count = 0;
+	curcpu->c_rtqueue.tl_head.tln_next = NULL;
+	curcpu->c_rtqueue.tl_tail.tln_prev = NULL;
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -426,14 +661,159 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Wake up one idle CPU other than BUSYCPU so it can steal work.
+ *
+ * c_isidle is read without the other CPUs' run queue locks; it is
+ * only a hint. A wrong guess costs either a spurious IPI (the CPU
+ * finds nothing to steal and goes back to sleep) or a slightly later
+ * steal (the CPU will look again at its next interrupt).
+ */
+static
+void
+thread_kick_idle_cpu(struct cpu *busycpu)
+{
+	unsigned i, numcpus;
+	struct cpu *c;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != busycpu && c != curcpu->c_self && c->c_isidle) {
+			ipi_send(c, IPI_UNIDLE);
+			return;
+		}
+	}
+}
+
+/*
+ * Choose a cpu for a thread that may not run where it last did:
+ * an idle cpu in its affinity mask if there is one, otherwise the
+ * allowed cpu with the shortest run queue. The queue lengths and
+ * idle flags are read unlocked, as hints.
+ */
+static
+struct cpu *
+thread_pick_cpu(struct thread *t)
+{
+	unsigned i, numcpus, count, bestcount;
+	struct cpu *c, *best;
+
+	best = NULL;
+	bestcount = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (!THREAD_CPU_ALLOWED(t, c)) {
+			continue;
+		}
+		if (c->c_isidle) {
+			return c;
+		}
+		count = c->c_runqueue.tl_count;
+		if (best == NULL || count < bestcount) {
+			best = c;
+			bestcount = count;
+		}
+	}
+	/* thread_setaffinity doesn't allow masks with no cpus in them */
+	KASSERT(best != NULL);
+	return best;
+}
+
+/*
+ * Compare two tick counts, allowing for wraparound: true if A is
+ * before B.
+ */
+#define TICK_BEFORE(a, b) ((int)((a) - (b)) < 0)
+
+/*
+ * Start a new period for real-time thread T at tick NOW.
+ */
+static
+void
+thread_rt_newperiod(struct thread *t, unsigned now)
+{
+	t->t_rt_release = now;
+	t->t_rt_absdeadline = now + t->t_rt_deadline;
+	t->t_rt_left = t->t_rt_budget;
+	t->t_rt_throttled = false;
+	t->t_rt_missed = false;
+}
+
+/*
+ * Put real-time thread T on cpu C's EDF queue, behind any threads
+ * with the same or an earlier deadline, or on its throttled list if
+ * it has used up its budget. If its period has ended, a new one is
+ * started first. Requires C's run queue lock.
+ */
+static
+void
+thread_rt_enqueue(struct cpu *c, struct thread *t)
+{
+	struct threadlistnode *tln;
+	unsigned now;
+
+	KASSERT(spinlock_do_i_hold(&c->c_runqueue_lock));
+
+	now = c->c_hardclocks;
+	if (!TICK_BEFORE(now, t->t_rt_release + t->t_rt_period)) {
+		thread_rt_newperiod(t, now);
+	}
+
+	if (t->t_rt_throttled) {
+		threadlist_addtail(&c->c_rtthrottled, t);
+		return;
+	}
+
+	for (tln = c->c_rtqueue.tl_tail.tln_prev;
+	     tln->tln_prev != NULL;
+	     tln = tln->tln_prev) {
+		if (!TICK_BEFORE(t->t_rt_absdeadline,
+				 tln->tln_self->t_rt_absdeadline)) {
+			threadlist_insertafter(&c->c_rtqueue,
+					       tln->tln_self, t);
+			return;
+		}
+	}
+	threadlist_addhead(&c->c_rtqueue, t);
+}
+
+/*
+ * Check if newly queued real-time thread T should preempt whatever
+ * cpu C is running. Requires C's run queue lock.
+ */
+static
+bool
+thread_rt_preempts(struct cpu *c, struct thread *t)
+{
+	struct thread *running;
+
+	if (t->t_rt_throttled || c->c_isidle) {
+		/* An idle cpu gets IPI_UNIDLE instead. */
+		return false;
+	}
+	running = c->c_curthread;
+	if (!running->t_rt || running->t_rt_throttled) {
+		return true;
+	}
+	return TICK_BEFORE(t->t_rt_absdeadline, running->t_rt_absdeadline);
+}
+
 /*
  * Make a thread runnable.
  *
- * targetcpu might be curcpu; it might not be, too. 
+ * targetcpu might be curcpu; it might not be, too. Normally it is the
+ * cpu the thread last ran on, but if that cpu isn't in the thread's
+ * affinity mask the thread is sent somewhere it's allowed.
+ *
+ * If ATHEAD is set, a thread that isn't real-time goes to the front
+ * of the run queue rather than the back.
  */
 static
 void
-thread_make_runnable(struct thread *target, bool already_have_lock)
+thread_make_runnable(struct thread *target, bool already_have_lock,
+		     bool athead)
 {
 	struct cpu *targetcpu;
 	bool isidle;
@@ -447,10 +827,49 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 	}
 	else {
 		spinlock_acquire(&targetcpu->c_runqueue_lock);
+
+		/*
+		 * If the thread is no longer allowed on its cpu, move
+		 * it. But not if it is still that cpu's curthread
+		 * (woken before the cpu finished switching away from
+		 * it; see thread_steal) as its context isn't saved
+		 * yet. Nobody else can be making it runnable, so it's
+		 * safe to drop the lock while choosing.
+		 */
+		if (!THREAD_CPU_ALLOWED(target, targetcpu) &&
+		    target != targetcpu->c_curthread) {
+			spinlock_release(&targetcpu->c_runqueue_lock);
+			targetcpu = thread_pick_cpu(target);
+			target->t_cpu = targetcpu;
+			spinlock_acquire(&targetcpu->c_runqueue_lock);
+		}
 	}
 
+	target->t_runnable_ns = gettime_ns();
+
 	isidle = targetcpu->c_isidle;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	if (target->t_rt) {
+		thread_rt_enqueue(targetcpu, target);
+		if (target != targetcpu->c_curthread &&
+		    thread_rt_preempts(targetcpu, target)) {
+			/*
+			 * Make the cpu reschedule as soon as it can:
+			 * on return from the IPI's interrupt if it's
+			 * another cpu, otherwise when we next leave a
+			 * trap or system call.
+			 */
+			targetcpu->c_rt_preempt = true;
+			if (targetcpu != curcpu->c_self) {
+				ipi_send(targetcpu, IPI_RESCHED);
+			}
+		}
+	}
+	else if (athead) {
+		threadlist_addhead(&targetcpu->c_runqueue, target);
+	}
+	else {
+		threadlist_addtail(&targetcpu->c_runqueue, target);
+	}
 	if (isidle) {
 		/*
 		 * Other processor is idle; send interrupt to make
@@ -458,6 +877,15 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		 */
 		ipi_send(targetcpu, IPI_UNIDLE);
 	}
+	else if (targetcpu->c_runqueue.tl_count > 1) {
+		/*
+		 * The target is busy and now has work queued behind
+		 * it. If some other processor is idle, poke it so it
+		 * comes and steals the surplus instead of waiting for
+		 * its next timer interrupt.
+		 */
+		thread_kick_idle_cpu(targetcpu);
+	}
 
 	if (!already_have_lock) {
 		spinlock_release(&targetcpu->c_runqueue_lock);
@@ -487,25 +915,19 @@ thread_fork(const char *name,
 	DEBUG(DB_THREADS,"Forking thread: %s\n",name);
 #endif // UW
 
-	newthread = thread_create(name);
+	/* Get a thread and stack, preferably recycled */
+	newthread = thread_create_withstack(name);
 	if (newthread == NULL) {
 		return ENOMEM;
 	}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
-	}
-	thread_checkstack_init(newthread);
-
 	/*
 	 * Now we clone various fields from the parent thread.
 	 */
 
 	/* Thread subsystem fields */
 	newthread->t_cpu = curthread->t_cpu;
+	newthread->t_affinity = curthread->t_affinity;
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -529,11 +951,39 @@ thread_fork(const char *name,
 	switchframe_init(newthread, entrypoint, data1, data2);
 
 	/* Lock the current cpu's run queue and make the new thread runnable */
-	thread_make_runnable(newthread, false);
+	thread_make_runnable(newthread, false, false);
 
 	return 0;
 }
 
+/*
+ * Record the runnable-to-running latency of thread T, which is about
+ * to be switched to on the current cpu.
+ */
+static
+void
+thread_account_run(struct thread *t)
+{
+	uint64_t now, usecs;
+	unsigned bucket;
+
+	t->t_stats.st_runs++;
+	if (t->t_runnable_ns == 0) {
+		return;
+	}
+	now = gettime_ns();
+	usecs = (now - t->t_runnable_ns) / 1000;
+	t->t_runnable_ns = 0;
+
+	for (bucket = 0; bucket < SCHEDSTAT_NBUCKETS - 1; bucket++) {
+		if (usecs < ((uint64_t)1 << bucket)) {
+			break;
+		}
+	}
+	t->t_stats.st_latency[bucket]++;
+	curcpu->c_stats.sc_latency[bucket]++;
+}
+
 /*
  * High level, machine-independent context switch code.
  *
@@ -547,7 +997,7 @@ static
 void
 thread_switch(threadstate_t newstate, struct wchan *wc)
 {
-	struct thread *cur, *next;
+	struct thread *cur, *next, *yieldto;
 	int spl;
 
 	DEBUGASSERT(curcpu->c_curthread == curthread);
@@ -558,6 +1008,10 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 
 	cur = curthread;
 
+	/* A thread we're handing the cpu to; see thread_yield_to. */
+	yieldto = curcpu->c_yieldto;
+	curcpu->c_yieldto = NULL;
+
 	/*
 	 * If we're idle, return without doing anything. This happens
 	 * when the timer interrupt interrupts the idle loop.
@@ -567,14 +1021,31 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 		return;
 	}
 
+	/*
+	 * A thread inside an RCU read section keeps the cpu: a
+	 * preemptive yield is dropped (the next tick will try again)
+	 * and sleeping is not allowed.
+	 */
+	if (cur->t_rcu_nesting > 0) {
+		KASSERT(newstate == S_READY);
+		splx(spl);
+		return;
+	}
+
 	/* Check the stack guard band. */
 	thread_checkstack(cur);
 
 	/* Lock the run queue. */
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
-	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	/*
+	 * Micro-optimization: if nothing to do, just return. But a
+	 * real-time thread that has used up its budget must stop.
+	 */
+	curcpu->c_rt_preempt = false;
+	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue) &&
+	    threadlist_isempty(&curcpu->c_rtqueue) && !cur->t_rt_throttled &&
+	    THREAD_CPU_ALLOWED(cur, curcpu) && cur != curcpu->c_idlethread) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -585,7 +1056,35 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	    case S_RUN:
 		panic("Illegal S_RUN in thread_switch\n");
 	    case S_READY:
-		thread_make_runnable(cur, true /*have lock*/);
+		if (cur == curcpu->c_idlethread) {
+			/* The idle thread just stops; see thread_idle. */
+			break;
+		}
+		if (!THREAD_CPU_ALLOWED(cur, curcpu)) {
+			/*
+			 * We may not stay on this cpu. We can't be
+			 * put on another cpu's run queue until our
+			 * context has been saved, so leave ourselves
+			 * for the next thread to send on (see
+			 * thread_handoff). If there's no next
+			 * thread, the idle thread does it.
+			 */
+			KASSERT(curcpu->c_handoff == NULL);
+			curcpu->c_handoff = cur;
+			break;
+		}
+		thread_make_runnable(cur, true /*have lock*/, false);
+		if (yieldto != NULL && !cur->t_rt &&
+		    curcpu->c_runqueue.tl_head.tln_next->tln_self == yieldto) {
+			/*
+			 * YIELDTO is still first in line, so it runs
+			 * next; we go right after it instead of behind
+			 * everything else.
+			 */
+			threadlist_remove(&curcpu->c_runqueue, cur);
+			threadlist_insertafter(&curcpu->c_runqueue,
+					       yieldto, cur);
+		}
 		break;
 	    case S_SLEEP:
 		cur->t_wchan_name = wc->wc_name;
@@ -632,15 +1131,49 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		/* Real-time threads first, earliest deadline first. */
+		next = threadlist_remhead(&curcpu->c_rtqueue);
 		if (next == NULL) {
+			next = threadlist_remhead(&curcpu->c_runqueue);
+		}
+		if (next == NULL && curcpu->c_handoff != NULL) {
+			/* We're leaving; don't idle on our stack. */
+			next = curcpu->c_idlethread;
+		}
+		if (next == NULL) {
+			/*
+			 * Nothing of our own to run; try to take
+			 * something from another cpu before idling.
+			 * thread_steal must not be called with our
+			 * run queue locked, as it locks the victim's.
+			 */
 			spinlock_release(&curcpu->c_runqueue_lock);
-			cpu_idle();
+			next = thread_steal();
+			if (next == NULL) {
+				/* Going idle is a quiescent state. */
+				rcu_quiescent();
+				cpu_idle();
+			}
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
 
+	if (next != cur) {
+		curcpu->c_stats.sc_switches++;
+		/* Blocking is voluntary; preemption or a yield isn't. */
+		if (cur->t_proc != NULL && cur->t_proc != kproc) {
+			if (newstate == S_SLEEP) {
+				cur->t_proc->p_usage.pu_nvcsw++;
+			}
+			else if (newstate == S_READY) {
+				cur->t_proc->p_usage.pu_nivcsw++;
+			}
+		}
+	}
+	cur->t_lastran = curcpu->c_hardclocks;
+	thread_account_run(next);
+
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
 	 * curthread and it may not be, depending on how curthread and
@@ -714,6 +1247,12 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	/* Clean up dead threads. */
 	exorcise();
 
+	/* Send on a thread that had to leave this cpu. */
+	thread_handoff();
+
+	/* We have context-switched, so RCU readers on this cpu are done. */
+	rcu_quiescent();
+
 	/* Turn interrupts back on. */
 	splx(spl);
 }
@@ -747,6 +1286,12 @@ thread_startup(void (*entrypoint)(void *data1, unsigned long data2),
 	/* Clean up dead threads. */
 	exorcise();
 
+	/* Send on a thread that had to leave this cpu. */
+	thread_handoff();
+
+	/* Report the context switch to RCU, as in thread_switch. */
+	rcu_quiescent();
+
 	/* Enable interrupts. */
 	spl0();
 
@@ -799,6 +1344,9 @@ thread_exit(void)
 	/* Make sure we *are* detached (move this only if you're sure!) */
 	KASSERT(cur->t_proc == NULL);
 
+	/* Give back any real-time reservation. */
+	thread_rt_leave(cur);
+
 	/* Check the stack guard band. */
 	thread_checkstack(cur);
 
@@ -817,6 +1365,247 @@ thread_yield(void)
 	thread_switch(S_READY, NULL);
 }
 
+/*
+ * Yield the cpu to TARGET, a thread just woken with
+ * wchan_wakeone_handoff, and run again right after it. Does nothing
+ * if TARGET is NULL, from an interrupt handler, or with interrupts
+ * off or a spinlock held; in the last case the caller is usually
+ * about to sleep anyway, as in cv_wait.
+ */
+void
+thread_yield_to(struct thread *target)
+{
+	if (target == NULL || curthread->t_in_interrupt ||
+	    curthread->t_iplhigh_count > 0) {
+		return;
+	}
+	splhigh();
+	curcpu->c_yieldto = target;
+	thread_switch(S_READY, NULL);
+	spl0();
+}
+
+/*
+ * Set the current thread's cpu affinity mask.
+ */
+int
+thread_setaffinity(uint32_t mask)
+{
+	unsigned numcpus;
+	uint32_t allcpumask;
+
+	numcpus = cpuarray_num(&allcpus);
+	allcpumask = numcpus >= 32 ? THREAD_AFFINITY_ALL
+		: ((uint32_t)1 << numcpus) - 1;
+	if ((mask & allcpumask) == 0) {
+		return EINVAL;
+	}
+	if (curthread->t_rt_cpu != NULL &&
+	    (mask & ((uint32_t)1 << curthread->t_rt_cpu->c_number)) == 0) {
+		/* Would strand the real-time reservation. */
+		return EBUSY;
+	}
+
+	curthread->t_affinity = mask;
+	if (!THREAD_CPU_ALLOWED(curthread, curcpu)) {
+		/* Move now; thread_switch sends us on. */
+		thread_yield();
+	}
+	KASSERT(THREAD_CPU_ALLOWED(curthread, curcpu));
+	return 0;
+}
+
+uint32_t
+thread_getaffinity(void)
+{
+	return curthread->t_affinity;
+}
+
+/*
+ * Drop thread T's real-time reservation, if any, and return it to
+ * ordinary scheduling. T must be curthread.
+ */
+static
+void
+thread_rt_leave(struct thread *t)
+{
+	int spl;
+
+	KASSERT(t == curthread);
+	if (t->t_rt_cpu == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&thread_rt_lock);
+	KASSERT(t->t_rt_cpu->c_rt_util >= t->t_rt_util);
+	t->t_rt_cpu->c_rt_util -= t->t_rt_util;
+	spinlock_release(&thread_rt_lock);
+
+	/* Keep thread_rttick from seeing a half-changed thread. */
+	spl = splhigh();
+	t->t_rt = false;
+	t->t_rt_throttled = false;
+	t->t_rt_cpu = NULL;
+	t->t_rt_util = 0;
+	splx(spl);
+}
+
+/*
+ * Put the current thread in the real-time class. Admission control
+ * is per cpu (partitioned EDF): the thread's density, budget over
+ * deadline, must fit under THREAD_RT_UTILMAX on some cpu it's allowed
+ * on. We prefer the current cpu, then the least-loaded one.
+ */
+int
+thread_setrt(unsigned period, unsigned budget, unsigned deadline)
+{
+	struct thread *cur = curthread;
+	struct cpu *c, *best;
+	unsigned i, numcpus, util;
+	int spl;
+
+	if (period == 0) {
+		thread_rt_leave(cur);
+		return 0;
+	}
+	if (deadline == 0) {
+		deadline = period;
+	}
+	if (budget == 0 || budget > deadline || deadline > period) {
+		return EINVAL;
+	}
+	util = DIVROUNDUP(budget * THREAD_RT_UTILSCALE, deadline);
+
+	spinlock_acquire(&thread_rt_lock);
+
+	/* Our old reservation, if any, doesn't count against us. */
+	if (cur->t_rt_cpu != NULL) {
+		cur->t_rt_cpu->c_rt_util -= cur->t_rt_util;
+	}
+
+	best = NULL;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if ((cur->t_affinity & ((uint32_t)1 << c->c_number)) == 0 ||
+		    c->c_rt_util + util > THREAD_RT_UTILMAX) {
+			continue;
+		}
+		if (c == curcpu->c_self) {
+			best = c;
+			break;
+		}
+		if (best == NULL || c->c_rt_util < best->c_rt_util) {
+			best = c;
+		}
+	}
+	if (best == NULL) {
+		if (cur->t_rt_cpu != NULL) {
+			cur->t_rt_cpu->c_rt_util += cur->t_rt_util;
+		}
+		spinlock_release(&thread_rt_lock);
+		return EBUSY;
+	}
+	best->c_rt_util += util;
+	spinlock_release(&thread_rt_lock);
+
+	spl = splhigh();
+	cur->t_rt = true;
+	cur->t_rt_cpu = best;
+	cur->t_rt_util = util;
+	cur->t_rt_period = period;
+	cur->t_rt_budget = budget;
+	cur->t_rt_deadline = deadline;
+	thread_rt_newperiod(cur, best->c_hardclocks);
+	splx(spl);
+
+	/*
+	 * Get onto the chosen cpu, and into the EDF queue. If it
+	 * isn't this one, thread_switch moves us even when there is
+	 * nothing else to run here, so we never run (and get charged)
+	 * on a cpu whose admission control doesn't know about us.
+	 */
+	thread_yield();
+	KASSERT(curcpu->c_self == best);
+	return 0;
+}
+
+/*
+ * Real-time accounting, called from hardclock on every cpu.
+ *
+ * Charges the tick to the running real-time thread and throttles it
+ * if its budget is gone; counts a deadline miss for each real-time
+ * thread still waiting for budget when its deadline passes; and
+ * releases throttled threads whose next period has begun. The
+ * hardclock's thread_yield then does the actual rescheduling.
+ */
+void
+thread_rttick(void)
+{
+	struct thread *cur = curthread;
+	struct threadlistnode *tln, *nexttln;
+	struct thread *t;
+	unsigned now;
+
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	now = curcpu->c_hardclocks;
+
+	for (tln = curcpu->c_rtthrottled.tl_head.tln_next;
+	     tln->tln_next != NULL;
+	     tln = nexttln) {
+		nexttln = tln->tln_next;
+		t = tln->tln_self;
+		if (!TICK_BEFORE(now, t->t_rt_release + t->t_rt_period)) {
+			threadlist_remove(&curcpu->c_rtthrottled, t);
+			thread_rt_enqueue(curcpu, t);
+		}
+	}
+
+	/* The EDF queue is sorted, so stop at the first future deadline. */
+	for (tln = curcpu->c_rtqueue.tl_head.tln_next;
+	     tln->tln_next != NULL;
+	     tln = tln->tln_next) {
+		t = tln->tln_self;
+		if (TICK_BEFORE(now, t->t_rt_absdeadline)) {
+			break;
+		}
+		if (!t->t_rt_missed) {
+			t->t_rt_missed = true;
+			t->t_stats.st_rt_misses++;
+			curcpu->c_stats.sc_rt_misses++;
+		}
+	}
+
+	if (!curcpu->c_isidle && cur->t_rt && !cur->t_rt_throttled) {
+		if (cur->t_rt_left > 0) {
+			cur->t_rt_left--;
+		}
+		if (!TICK_BEFORE(now, cur->t_rt_release + cur->t_rt_period)) {
+			/* Still running at the end of the period. */
+			if (!cur->t_rt_missed && cur->t_rt_left > 0) {
+				cur->t_stats.st_rt_misses++;
+				curcpu->c_stats.sc_rt_misses++;
+			}
+			thread_rt_newperiod(cur, now);
+		}
+		else {
+			if (!TICK_BEFORE(now, cur->t_rt_absdeadline) &&
+			    !cur->t_rt_missed && cur->t_rt_left > 0) {
+				cur->t_rt_missed = true;
+				cur->t_stats.st_rt_misses++;
+				curcpu->c_stats.sc_rt_misses++;
+			}
+			if (cur->t_rt_left == 0) {
+				cur->t_rt_throttled = true;
+				cur->t_stats.st_rt_throttles++;
+				curcpu->c_stats.sc_rt_throttles++;
+			}
+		}
+	}
+
+	spinlock_release(&curcpu->c_runqueue_lock);
+}
+
 ////////////////////////////////////////////////////////////
 
 /*
@@ -836,125 +1625,240 @@ schedule(void)
 }
 
 /*
- * Thread migration.
+ * Work stealing.
+ *
+ * Rather than have busy CPUs periodically push threads elsewhere,
+ * CPUs with nothing to do pull threads from other CPUs' run queues.
+ * thread_switch() calls this when the current CPU's run queue is
+ * empty, before idling; since the idle loop comes back here after
+ * every interrupt, an idle CPU keeps looking for work for as long as
+ * it stays idle, and thread_make_runnable() pokes idle CPUs when a
+ * run queue starts to back up.
+ *
+ * The victim is the CPU with the longest run queue. The lengths are
+ * read without locking, as a hint only. The scan starts from a
+ * pseudo-random CPU so that when several queues are equally long,
+ * the idle CPUs don't all converge on the same one.
  *
- * This is also called periodically from hardclock(). If the current
- * CPU is busy and other CPUs are idle, or less busy, it should move
- * threads across to those other other CPUs.
+ * We take from the tail of the victim's queue, the thread that would
+ * otherwise run last there, skipping threads whose affinity mask
+ * excludes us and, unless the victim's queue is longer than
+ * THREAD_STEAL_HOTQUEUE, threads that ran on the victim within the
+ * last THREAD_CACHEHOT_TICKS ticks.
  *
- * Migrating threads isn't free because of cache affinity; a thread's
- * working cache set will end up having to be moved to the other CPU,
- * which is fairly slow. The tradeoff between this performance loss
- * and the performance loss due to underutilization of some CPUs is
- * something that needs to be tuned and probably is workload-specific.
+ * Migrating threads isn't free because of cache affinity; however,
+ * System/161 does not (yet) model such cache effects, and a thread
+ * that would otherwise wait behind others is not getting any cache
+ * benefit anyway.
  *
- * For here and now, because we know we're running on System/161 and
- * System/161 does not (yet) model such cache effects, we'll be very
- * aggressive.
+ * Must be called with the current CPU's run queue lock *not* held,
+ * since we take the victim's, and with interrupts off. Returns the
+ * stolen thread, now belonging to this CPU, or NULL.
  */
-void
-thread_consider_migration(void)
+static
+struct thread *
+thread_steal(void)
 {
-	unsigned my_count, total_count, one_share, to_send;
-	unsigned i, numcpus;
-	struct cpu *c;
-	struct threadlist victims;
-	struct thread *t;
+	unsigned i, start, numcpus, count, bestcount;
+	struct cpu *c, *victim;
+	struct threadlistnode *tln;
+	struct thread *t, *hot;
+
+	KASSERT(!spinlock_do_i_hold(&curcpu->c_runqueue_lock));
 
-	my_count = total_count = 0;
 	numcpus = cpuarray_num(&allcpus);
+	if (numcpus < 2) {
+		return NULL;
+	}
+
+	/* Simple LCG; we only need the start point to wander. */
+	curcpu->c_steal_seed = curcpu->c_steal_seed * 1103515245 + 12345;
+	start = (curcpu->c_steal_seed >> 16) % numcpus;
+
+	victim = NULL;
+	bestcount = 0;
 	for (i=0; i<numcpus; i++) {
-		c = cpuarray_get(&allcpus, i);
-		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
+		c = cpuarray_get(&allcpus, (start + i) % numcpus);
 		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+			continue;
 		}
-		spinlock_release(&c->c_runqueue_lock);
+		count = c->c_runqueue.tl_count;
+		if (count > bestcount) {
+			victim = c;
+			bestcount = count;
+		}
+	}
+	if (victim == NULL) {
+		curcpu->c_steal_misses++;
+		return NULL;
 	}
 
-	one_share = DIVROUNDUP(total_count, numcpus);
-	if (my_count < one_share) {
-		return;
+	t = hot = NULL;
+	spinlock_acquire(&victim->c_runqueue_lock);
+	for (tln = victim->c_runqueue.tl_tail.tln_prev;
+	     tln->tln_prev != NULL;
+	     tln = tln->tln_prev) {
+		/*
+		 * Ordinarily, a cpu's curthread will not appear on
+		 * its run queue. However, it can if it went to sleep,
+		 * the cpu went idle (so it remained curthread), and
+		 * it was reawakened before the cpu finished
+		 * unidling. Its context has not been saved, so taking
+		 * it would be disastrous; leave it alone.
+		 */
+		if (tln->tln_self == victim->c_curthread) {
+			continue;
+		}
+		/* Hard affinity: never take a thread pinned elsewhere. */
+		if (!THREAD_CPU_ALLOWED(tln->tln_self, curcpu)) {
+			continue;
+		}
+		/*
+		 * Soft affinity: prefer threads that haven't run on
+		 * the victim recently, as those that have probably
+		 * still have a warm cache there.
+		 */
+		if (victim->c_hardclocks - tln->tln_self->t_lastran
+		    < THREAD_CACHEHOT_TICKS) {
+			if (hot == NULL) {
+				hot = tln->tln_self;
+			}
+			continue;
+		}
+		t = tln->tln_self;
+		break;
+	}
+	/* Take a cache-hot thread only if the victim is really backed up. */
+	if (t == NULL && bestcount > THREAD_STEAL_HOTQUEUE) {
+		t = hot;
+	}
+	if (t != NULL) {
+		threadlist_remove(&victim->c_runqueue, t);
+		t->t_cpu = curcpu->c_self;
 	}
+	spinlock_release(&victim->c_runqueue_lock);
 
-	to_send = my_count - one_share;
-	threadlist_init(&victims);
-	spinlock_acquire(&curcpu->c_runqueue_lock);
-	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
-		threadlist_addhead(&victims, t);
+	if (t == NULL) {
+		curcpu->c_steal_misses++;
+		return NULL;
 	}
-	spinlock_release(&curcpu->c_runqueue_lock);
 
-	for (i=0; i < numcpus && to_send > 0; i++) {
+	curcpu->c_steals++;
+	curcpu->c_stats.sc_migrations++;
+	DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u\n",
+	      t->t_name, victim->c_number, curcpu->c_number);
+	return t;
+}
+
+/*
+ * Print the per-cpu work stealing counters. The counters are only
+ * updated by their own cpu and are read here without locking.
+ */
+void
+thread_printstealstats(void)
+{
+	unsigned i;
+	struct cpu *c;
+
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
 		c = cpuarray_get(&allcpus, i);
-		if (c == curcpu->c_self) {
-			continue;
-		}
-		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
-			t = threadlist_remhead(&victims);
-			/*
-			 * Ordinarily, curthread will not appear on
-			 * the run queue. However, it can under the
-			 * following circumstances:
-			 *   - it went to sleep;
-			 *   - the processor became idle, so it
-			 *     remained curthread;
-			 *   - it was reawakened, so it was put on the
-			 *     run queue;
-			 *   - and the processor hasn't fully unidled
-			 *     yet, so all these things are still true.
-			 *
-			 * If the timer interrupt happens at (almost)
-			 * exactly the proper moment, we can come here
-			 * while things are in this state and see
-			 * curthread. However, *migrating* curthread
-			 * can cause bad things to happen (Exercise:
-			 * Why? And what?) so shuffle it to the end of
-			 * the list and decrement to_send in order to
-			 * skip it. Then it goes back on our own run
-			 * queue below.
-			 */
-			if (t == curthread) {
-				threadlist_addtail(&victims, t);
-				to_send--;
-				continue;
-			}
+		kprintf("cpu%u: %u threads stolen, %u empty passes\n",
+			c->c_number, c->c_steals, c->c_steal_misses);
+	}
+}
 
-			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
-			DEBUG(DB_THREADS,
-			      "Migrated thread %s: cpu %u -> %u",
-			      t->t_name, curcpu->c_number, c->c_number);
-			to_send--;
-			if (c->c_isidle) {
-				/*
-				 * Other processor is idle; send
-				 * interrupt to make sure it unidles.
-				 */
-				ipi_send(c, IPI_UNIDLE);
-			}
+////////////////////////////////////////////////////////////
+
+/*
+ * Scheduler statistics.
+ *
+ * The per-cpu counters are only written by their own cpu; readers
+ * here take a snapshot without locking, which may be slightly torn
+ * but is good enough for statistics.
+ */
+
+unsigned
+thread_numcpus(void)
+{
+	return cpuarray_num(&allcpus);
+}
+
+/*
+ * Return a mask of the cpus that are not idle. Read without the run
+ * queue locks, so it is only a snapshot; a cpu that becomes busy
+ * afterwards starts out with no RCU readers, which is all RCU needs.
+ */
+uint32_t
+thread_busycpus(void)
+{
+	struct cpu *c;
+	uint32_t mask;
+	unsigned i;
+
+	KASSERT(cpuarray_num(&allcpus) <= 32);
+	mask = 0;
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (!c->c_isidle) {
+			mask |= (uint32_t)1 << c->c_number;
 		}
-		spinlock_release(&c->c_runqueue_lock);
 	}
+	return mask;
+}
 
-	/*
-	 * Because the code above isn't atomic, the thread counts may have
-	 * changed while we were working and we may end up with leftovers.
-	 * Don't panic; just put them back on our own run queue.
-	 */
-	if (!threadlist_isempty(&victims)) {
-		spinlock_acquire(&curcpu->c_runqueue_lock);
-		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
-		}
-		spinlock_release(&curcpu->c_runqueue_lock);
+int
+thread_getcpustats(unsigned cpunum, struct schedstat_cpu *ret)
+{
+	struct cpu *c;
+
+	if (cpunum >= cpuarray_num(&allcpus)) {
+		return EINVAL;
 	}
+	c = cpuarray_get(&allcpus, cpunum);
+	*ret = c->c_stats;
+	ret->sc_rt_util = c->c_rt_util;
+	return 0;
+}
 
-	KASSERT(threadlist_isempty(&victims));
-	threadlist_cleanup(&victims);
+void
+thread_printschedstats(void)
+{
+	struct schedstat_cpu sc;
+	unsigned i, j, ticks, busy;
+
+	for (i=0; i < cpuarray_num(&allcpus); i++) {
+		thread_getcpustats(i, &sc);
+		ticks = sc.sc_ticks_user + sc.sc_ticks_sys + sc.sc_ticks_idle;
+		busy = sc.sc_ticks_user + sc.sc_ticks_sys;
+		kprintf("cpu%u: %u ticks: %u user, %u sys, %u idle "
+			"(%u%% busy)\n", i, ticks,
+			sc.sc_ticks_user, sc.sc_ticks_sys, sc.sc_ticks_idle,
+			ticks ? busy * 100 / ticks : 0);
+		kprintf("      %u irqs, %u switches, %u migrations, "
+			"avg runqueue %u.%02u\n",
+			sc.sc_irqs, sc.sc_switches, sc.sc_migrations,
+			ticks ? sc.sc_rqlen_sum / ticks : 0,
+			ticks ? (sc.sc_rqlen_sum * 100 / ticks) % 100 : 0);
+		if (sc.sc_rt_util > 0 || sc.sc_rt_misses > 0) {
+			kprintf("      real-time: %u.%u%% reserved, "
+				"%u deadline misses, %u throttles\n",
+				sc.sc_rt_util / 10, sc.sc_rt_util % 10,
+				sc.sc_rt_misses, sc.sc_rt_throttles);
+		}
+		kprintf("      wakeup latency (us):");
+		for (j=0; j<SCHEDSTAT_NBUCKETS; j++) {
+			if (sc.sc_latency[j] == 0) {
+				continue;
+			}
+			if (j == SCHEDSTAT_NBUCKETS - 1) {
+				kprintf(" >=%u:%u", 1U << (j-1), sc.sc_latency[j]);
+			}
+			else {
+				kprintf(" <%u:%u", 1U << j, sc.sc_latency[j]);
+			}
+		}
+		kprintf("\n");
+	}
 }
 
 ////////////////////////////////////////////////////////////
@@ -981,6 +1885,7 @@ wchan_create(const char *name)
 		return NULL;
 	}
 	spinlock_init(&wc->wc_lock);
+	spinlock_setname(&wc->wc_lock, "wchan");
 	threadlist_init(&wc->wc_threads);
 	wc->wc_name = name;
 	return wc;
@@ -1050,7 +1955,34 @@ wchan_wakeone(struct wchan *wc)
 		return;
 	}
 
-	thread_make_runnable(target, false);
+	thread_make_runnable(target, false, false);
+}
+
+/*
+ * Wake up one thread, like wchan_wakeone, but if it is to run on
+ * this cpu put it at the front of the run queue and return it so the
+ * caller can pass it to thread_yield_to once it has dropped its
+ * spinlocks. Otherwise (or if nobody was sleeping) return NULL.
+ */
+struct thread *
+wchan_wakeone_handoff(struct wchan *wc)
+{
+	struct thread *target;
+	bool here;
+
+	spinlock_acquire(&wc->wc_lock);
+	target = threadlist_remhead(&wc->wc_threads);
+	spinlock_release(&wc->wc_lock);
+
+	if (target == NULL) {
+		return NULL;
+	}
+
+	/* t_cpu is stable: nobody else can be waking the thread. */
+	here = target->t_cpu == curcpu->c_self && !target->t_rt &&
+		THREAD_CPU_ALLOWED(target, curcpu);
+	thread_make_runnable(target, false, here);
+	return here ? target : NULL;
 }
 
 /*
@@ -1084,12 +2016,35 @@ wchan_wakeall(struct wchan *wc)
 	 * make each thread runnable.
 	 */
 	while ((target = threadlist_remhead(&list)) != NULL) {
-		thread_make_runnable(target, false);
+		thread_make_runnable(target, false, false);
 	}
 
 	threadlist_cleanup(&list);
 }
 
+/*
+ * Move sleeping threads from one wait channel to another. Nothing is
+ * made runnable, so this needs no run queue locks.
+ */
+void
+wchan_requeue(struct wchan *from, struct wchan *to, bool all)
+{
+	struct thread *target;
+
+	KASSERT(from != to);
+	KASSERT(spinlock_do_i_hold(&from->wc_lock));
+
+	spinlock_acquire(&to->wc_lock);
+	while ((target = threadlist_remhead(&from->wc_threads)) != NULL) {
+		target->t_wchan_name = to->wc_name;
+		threadlist_addtail(&to->wc_threads, target);
+		if (!all) {
+			break;
+		}
+	}
+	spinlock_release(&to->wc_lock);
+}
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
@@ -1192,6 +2147,12 @@ interprocessor_interrupt(void)
 		 * interrupt; don't need to do anything else.
 		 */
 	}
+	if (bits & (1U << IPI_RESCHED)) {
+		/*
+		 * The sender set c_rt_preempt; mips_trap does the
+		 * switch once the interrupt has been handled.
+		 */
+	}
 	if (bits & (1U << IPI_TLBSHOOTDOWN)) {
 		if (curcpu->c_numshootdown == TLBSHOOTDOWN_ALL) {
 			vm_tlbshootdown_all();
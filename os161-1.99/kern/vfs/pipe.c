@@ -0,0 +1,655 @@
+/*
+ * Copyright (c) 2003, 2008
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Pipes. See pipe.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <kern/poll.h>
+#include <stat.h>
+#include <limits.h>
+#include <lib.h>
+#include <uio.h>
+#include <synch.h>
+#include <vm.h>
+#include <addrspace.h>
+#include <proc.h>
+#include <vnode.h>
+#include <poll.h>
+#include <pipe.h>
+
+/*
+ * Size of the ring buffer. Must be a power of two, and at least
+ * PIPE_BUF so that atomic writes can fit.
+ */
+#define PIPE_SIZE	(2 * PIPE_BUF)
+#define PIPE_MASK	(PIPE_SIZE - 1)
+
+/*
+ * A reader waiting on an empty pipe, offering its buffer to the next
+ * large write. The writer fills in pr_moved, or pr_result if the
+ * reader's buffer turns out to be bad.
+ */
+struct pipe_reader {
+	struct uio *pr_uio;
+	struct addrspace *pr_as;
+	size_t pr_moved;
+	int pr_result;
+};
+
+/*
+ * pp_head and pp_tail count the bytes ever written and read; they
+ * wrap freely, and their difference is the number of bytes in the
+ * buffer. Everything but the vnodes and the pollq is protected by
+ * pp_lock. Every change that wakes readers or writers also wakes
+ * pollers, of both ends alike.
+ */
+struct pipe {
+	struct lock *pp_lock;
+	struct cv *pp_readcv;		/* Readers wait here for data */
+	struct cv *pp_writecv;		/* Writers wait here for space */
+	char *pp_buf;
+	unsigned pp_head;
+	unsigned pp_tail;
+	bool pp_readers;		/* Read end still open */
+	bool pp_writers;		/* Write end still open */
+	struct pipe_reader *pp_waiting;	/* Reader taking data directly */
+	struct pollq pp_pollq;		/* Pollers of either end */
+	unsigned pp_nends;		/* Vnodes not yet reclaimed */
+	struct vnode pp_readvn;
+	struct vnode pp_writevn;
+};
+
+#define PIPE_COUNT(pp) ((pp)->pp_head - (pp)->pp_tail)
+
+static
+void
+pipe_destroy(struct pipe *pp)
+{
+	pollq_cleanup(&pp->pp_pollq);
+	kfree(pp->pp_buf);
+	cv_destroy(pp->pp_writecv);
+	cv_destroy(pp->pp_readcv);
+	lock_destroy(pp->pp_lock);
+	kfree(pp);
+}
+
+/*
+ * Move N bytes between the ring and UIO, starting at ring position
+ * *POS (pp_head for writes, pp_tail for reads) and advancing it. The
+ * data may wrap around the end of the buffer, so this takes at most
+ * two uiomoves.
+ */
+static
+int
+pipe_ringio(struct pipe *pp, unsigned *pos, size_t n, struct uio *uio)
+{
+	unsigned off;
+	size_t chunk;
+	int result;
+
+	while (n > 0) {
+		off = *pos & PIPE_MASK;
+		chunk = PIPE_SIZE - off;
+		if (chunk > n) {
+			chunk = n;
+		}
+		result = uiomove(pp->pp_buf + off, chunk, uio);
+		if (result) {
+			return result;
+		}
+		*pos += chunk;
+		n -= chunk;
+	}
+	return 0;
+}
+
+/*
+ * Copy from the writer's UIO straight into the waiting reader's
+ * buffer, a page at a time, through the kernel's direct mapping of
+ * the reader's memory. Fails only if the writer's buffer is bad.
+ */
+static
+int
+pipe_direct(struct pipe *pp, struct uio *uio)
+{
+	struct pipe_reader *pr;
+	struct uio *ruio;
+	struct iovec *iov;
+	paddr_t pa;
+	size_t n;
+	int result;
+
+	pr = pp->pp_waiting;
+	pp->pp_waiting = NULL;
+	ruio = pr->pr_uio;
+
+	result = 0;
+	while (uio->uio_resid > 0 && ruio->uio_resid > 0) {
+		iov = ruio->uio_iov;
+		if (iov->iov_len == 0) {
+			ruio->uio_iov++;
+			ruio->uio_iovcnt--;
+			continue;
+		}
+		if (as_translate(pr->pr_as, (vaddr_t)iov->iov_ubase, true,
+				 &pa)) {
+			/* The reader's problem, not ours. */
+			if (pr->pr_moved == 0) {
+				pr->pr_result = EFAULT;
+			}
+			break;
+		}
+		n = PAGE_SIZE - (pa & ~PAGE_FRAME);
+		if (n > iov->iov_len) {
+			n = iov->iov_len;
+		}
+		if (n > uio->uio_resid) {
+			n = uio->uio_resid;
+		}
+		result = uiomove((void *)PADDR_TO_KVADDR(pa), n, uio);
+		if (result) {
+			break;
+		}
+		iov->iov_ubase += n;
+		iov->iov_len -= n;
+		ruio->uio_resid -= n;
+		ruio->uio_offset += n;
+		pr->pr_moved += n;
+	}
+
+	cv_broadcast(pp->pp_readcv, pp->pp_lock);
+	pollq_wakeup(&pp->pp_pollq);
+	return result;
+}
+
+////////////////////////////////////////////////////////////
+// vnode operations
+
+/*
+ * Nothing to do; pipes are only opened by pipe_create.
+ */
+static
+int
+pipe_open(struct vnode *v, int flags)
+{
+	(void)v;
+	(void)flags;
+	return 0;
+}
+
+/*
+ * Last close of one end: wake up whoever is waiting on the other,
+ * to see EOF or EPIPE.
+ */
+static
+int
+pipe_close(struct vnode *v)
+{
+	struct pipe *pp = v->vn_data;
+
+	lock_acquire(pp->pp_lock);
+	if (v == &pp->pp_readvn) {
+		pp->pp_readers = false;
+		cv_broadcast(pp->pp_writecv, pp->pp_lock);
+		pollq_wakeup(&pp->pp_pollq);
+	}
+	else {
+		pp->pp_writers = false;
+		cv_broadcast(pp->pp_readcv, pp->pp_lock);
+		pollq_wakeup(&pp->pp_pollq);
+	}
+	lock_release(pp->pp_lock);
+	return 0;
+}
+
+/*
+ * Last reference to one end; the pipe goes with the second.
+ * Nothing can look up a pipe vnode, so unlike a file system we need
+ * not recheck the reference count.
+ */
+static
+int
+pipe_reclaim(struct vnode *v)
+{
+	struct pipe *pp = v->vn_data;
+	bool last;
+
+	VOP_CLEANUP(v);
+
+	lock_acquire(pp->pp_lock);
+	KASSERT(pp->pp_nends > 0);
+	pp->pp_nends--;
+	last = pp->pp_nends == 0;
+	lock_release(pp->pp_lock);
+
+	if (last) {
+		pipe_destroy(pp);
+	}
+	return 0;
+}
+
+/*
+ * Read: wait until there is data or no writer is left, then take
+ * what there is, up to the size of the request. While the pipe is
+ * empty, offer our buffer to writers to fill directly.
+ */
+static
+int
+pipe_read(struct vnode *v, struct uio *uio)
+{
+	struct pipe *pp = v->vn_data;
+	struct pipe_reader pr;
+	size_t n;
+	int result;
+
+	if (v != &pp->pp_readvn) {
+		return EBADF;
+	}
+	if (uio->uio_resid == 0) {
+		return 0;
+	}
+
+	lock_acquire(pp->pp_lock);
+	while (PIPE_COUNT(pp) == 0 && pp->pp_writers) {
+		if (pp->pp_waiting != NULL || uio->uio_segflg != UIO_USERSPACE) {
+			cv_wait(pp->pp_readcv, pp->pp_lock);
+			continue;
+		}
+		pr.pr_uio = uio;
+		pr.pr_as = curproc_getas();
+		pr.pr_moved = 0;
+		pr.pr_result = 0;
+		pp->pp_waiting = &pr;
+		cv_wait(pp->pp_readcv, pp->pp_lock);
+		if (pp->pp_waiting == &pr) {
+			pp->pp_waiting = NULL;
+		}
+		if (pr.pr_moved > 0 || pr.pr_result) {
+			lock_release(pp->pp_lock);
+			return pr.pr_result;
+		}
+	}
+
+	n = PIPE_COUNT(pp);
+	if (n > uio->uio_resid) {
+		n = uio->uio_resid;
+	}
+	result = pipe_ringio(pp, &pp->pp_tail, n, uio);
+	cv_broadcast(pp->pp_writecv, pp->pp_lock);
+	pollq_wakeup(&pp->pp_pollq);
+	lock_release(pp->pp_lock);
+	return result;
+}
+
+/*
+ * Write: copy everything in, waiting for space as needed. A write of
+ * up to PIPE_BUF bytes waits until it fits and goes in all at once,
+ * so it is never interleaved with other writes. Larger writes go in
+ * as space allows, and straight to a waiting reader when the ring is
+ * empty. A short write is reported as such rather than as an error.
+ */
+static
+int
+pipe_write(struct vnode *v, struct uio *uio)
+{
+	struct pipe *pp = v->vn_data;
+	size_t start, space, n;
+	bool atomic;
+	int result;
+
+	if (v != &pp->pp_writevn) {
+		return EBADF;
+	}
+
+	start = uio->uio_resid;
+	atomic = start <= PIPE_BUF;
+	result = 0;
+
+	lock_acquire(pp->pp_lock);
+	while (uio->uio_resid > 0) {
+		if (!pp->pp_readers) {
+			result = EPIPE;
+			break;
+		}
+		if (!atomic && PIPE_COUNT(pp) == 0 && pp->pp_waiting != NULL) {
+			result = pipe_direct(pp, uio);
+			if (result) {
+				break;
+			}
+			continue;
+		}
+		space = PIPE_SIZE - PIPE_COUNT(pp);
+		if (space == 0 || (atomic && space < uio->uio_resid)) {
+			cv_wait(pp->pp_writecv, pp->pp_lock);
+			continue;
+		}
+		n = uio->uio_resid < space ? uio->uio_resid : space;
+		result = pipe_ringio(pp, &pp->pp_head, n, uio);
+		cv_broadcast(pp->pp_readcv, pp->pp_lock);
+		pollq_wakeup(&pp->pp_pollq);
+		if (result) {
+			break;
+		}
+	}
+	lock_release(pp->pp_lock);
+
+	if (uio->uio_resid < start) {
+		return 0;
+	}
+	return result;
+}
+
+static
+int
+pipe_stat(struct vnode *v, struct stat *statbuf)
+{
+	struct pipe *pp = v->vn_data;
+
+	bzero(statbuf, sizeof(struct stat));
+	statbuf->st_mode = S_IFIFO | 0600;
+	statbuf->st_nlink = 1;
+	lock_acquire(pp->pp_lock);
+	statbuf->st_size = PIPE_COUNT(pp);
+	lock_release(pp->pp_lock);
+	statbuf->st_blksize = PIPE_BUF;
+	return 0;
+}
+
+static
+int
+pipe_gettype(struct vnode *v, mode_t *ret)
+{
+	(void)v;
+	*ret = S_IFIFO;
+	return 0;
+}
+
+static
+int
+pipe_tryseek(struct vnode *v, off_t pos)
+{
+	(void)v;
+	(void)pos;
+	return ESPIPE;
+}
+
+/*
+ * The read end is ready when there is data, or when no writer is
+ * left (POLLHUP; a read will see EOF). The write end is ready when
+ * an atomic write would fit, and gets POLLERR once no reader is left.
+ */
+static
+int
+pipe_poll(struct vnode *v, int events, struct pollent *pe, int *revents)
+{
+	struct pipe *pp = v->vn_data;
+
+	if (pe != NULL) {
+		pollq_add(&pp->pp_pollq, pe);
+	}
+
+	*revents = 0;
+	lock_acquire(pp->pp_lock);
+	if (v == &pp->pp_readvn) {
+		if (PIPE_COUNT(pp) > 0) {
+			*revents |= events & POLLIN;
+		}
+		if (!pp->pp_writers) {
+			*revents |= POLLHUP;
+		}
+	}
+	else {
+		if (PIPE_SIZE - PIPE_COUNT(pp) >= PIPE_BUF) {
+			*revents |= events & POLLOUT;
+		}
+		if (!pp->pp_readers) {
+			*revents |= POLLERR;
+		}
+	}
+	lock_release(pp->pp_lock);
+	return 0;
+}
+
+static
+int
+pipe_ioctl(struct vnode *v, int op, userptr_t data)
+{
+	(void)v;
+	(void)op;
+	(void)data;
+	return EIOCTL;
+}
+
+/*
+ * Operations that make no sense on a pipe.
+ */
+static
+int
+pipe_inval(struct vnode *v)
+{
+	(void)v;
+	return EINVAL;
+}
+
+static
+int
+pipe_uioinval(struct vnode *v, struct uio *uio)
+{
+	(void)v;
+	(void)uio;
+	return EINVAL;
+}
+
+static
+int
+pipe_truncate(struct vnode *v, off_t len)
+{
+	(void)v;
+	(void)len;
+	return EINVAL;
+}
+
+/*
+ * Directory operations, of which a pipe is not one.
+ */
+static
+int
+pipe_creat(struct vnode *v, const char *name, bool excl, mode_t mode,
+	   struct vnode **result)
+{
+	(void)v;
+	(void)name;
+	(void)excl;
+	(void)mode;
+	(void)result;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_symlink(struct vnode *v, const char *contents, const char *name)
+{
+	(void)v;
+	(void)contents;
+	(void)name;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_mkdir(struct vnode *v, const char *name, mode_t mode)
+{
+	(void)v;
+	(void)name;
+	(void)mode;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_link(struct vnode *v, const char *name, struct vnode *file)
+{
+	(void)v;
+	(void)name;
+	(void)file;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_nameop(struct vnode *v, const char *name)
+{
+	(void)v;
+	(void)name;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_rename(struct vnode *v, const char *n1, struct vnode *v2, const char *n2)
+{
+	(void)v;
+	(void)n1;
+	(void)v2;
+	(void)n2;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_lookup(struct vnode *v, char *pathname, struct vnode **result)
+{
+	(void)v;
+	(void)pathname;
+	(void)result;
+	return ENOTDIR;
+}
+
+static
+int
+pipe_lookparent(struct vnode *v, char *pathname, struct vnode **result,
+		char *namebuf, size_t buflen)
+{
+	(void)v;
+	(void)pathname;
+	(void)result;
+	(void)namebuf;
+	(void)buflen;
+	return ENOTDIR;
+}
+
+/*
+ * Function table for pipe vnodes.
+ */
+static const struct vnode_ops pipe_vnode_ops = {
+	VOP_MAGIC,
+
+	pipe_open,
+	pipe_close,
+	pipe_reclaim,
+	pipe_read,
+	pipe_uioinval,	/* readlink */
+	pipe_uioinval,	/* getdirentry */
+	pipe_write,
+	pipe_ioctl,
+	pipe_stat,
+	pipe_gettype,
+	pipe_tryseek,
+	pipe_poll,
+	pipe_inval,	/* fsync */
+	pipe_inval,	/* mmap */
+	pipe_truncate,
+	pipe_uioinval,	/* namefile */
+	pipe_creat,
+	pipe_symlink,
+	pipe_mkdir,
+	pipe_link,
+	pipe_nameop,	/* remove */
+	pipe_nameop,	/* rmdir */
+	pipe_rename,
+	pipe_lookup,
+	pipe_lookparent,
+};
+
+////////////////////////////////////////////////////////////
+
+int
+pipe_create(struct vnode **readend, struct vnode **writeend)
+{
+	struct pipe *pp;
+
+	pp = kmalloc(sizeof(*pp));
+	if (pp == NULL) {
+		return ENOMEM;
+	}
+	pp->pp_buf = kmalloc(PIPE_SIZE);
+	if (pp->pp_buf == NULL) {
+		kfree(pp);
+		return ENOMEM;
+	}
+	pp->pp_lock = lock_create("pipe");
+	if (pp->pp_lock == NULL) {
+		kfree(pp->pp_buf);
+		kfree(pp);
+		return ENOMEM;
+	}
+	pp->pp_readcv = cv_create("pipe read");
+	if (pp->pp_readcv == NULL) {
+		lock_destroy(pp->pp_lock);
+		kfree(pp->pp_buf);
+		kfree(pp);
+		return ENOMEM;
+	}
+	pp->pp_writecv = cv_create("pipe write");
+	if (pp->pp_writecv == NULL) {
+		cv_destroy(pp->pp_readcv);
+		lock_destroy(pp->pp_lock);
+		kfree(pp->pp_buf);
+		kfree(pp);
+		return ENOMEM;
+	}
+	pp->pp_head = pp->pp_tail = 0;
+	pp->pp_readers = pp->pp_writers = true;
+	pp->pp_waiting = NULL;
+	pollq_init(&pp->pp_pollq);
+	pp->pp_nends = 2;
+
+	VOP_INIT(&pp->pp_readvn, &pipe_vnode_ops, NULL, pp);
+	VOP_INIT(&pp->pp_writevn, &pipe_vnode_ops, NULL, pp);
+	VOP_INCOPEN(&pp->pp_readvn);
+	VOP_INCOPEN(&pp->pp_writevn);
+
+	*readend = &pp->pp_readvn;
+	*writeend = &pp->pp_writevn;
+	return 0;
+}
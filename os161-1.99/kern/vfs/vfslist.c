@@ -37,12 +37,13 @@
 #include <types.h>
 #include <kern/errno.h>
 #include <lib.h>
-#include <array.h>
 #include <synch.h>
+#include <rcu.h>
 #include <vfs.h>
 #include <fs.h>
 #include <vnode.h>
 #include <device.h>
+#include <execcache.h>
 
 /*
  * Structure for a single named device.
@@ -82,25 +83,90 @@ struct knowndev {
 	struct fs *kd_fs;
 };
 
-DECLARRAY(knowndev);
-DEFARRAY(knowndev, /*no inline*/);
+/*
+ * The table of known devices. It is read without locks, using RCU:
+ * the table is never changed once published, and adding a device
+ * (serialized by vfs_biglock) installs a copy with the new entry and
+ * frees the old one after a grace period. Entries are never removed
+ * or freed, so a struct knowndev pointer stays valid after the read
+ * section ends. Use knowndev_get to fetch entries.
+ */
+struct knowndevtab {
+	struct rcu_head kt_rcu;		/* For freeing once replaced */
+	unsigned kt_num;		/* Number of entries */
+	struct knowndev **kt_devs;	/* Entries; follows the header */
+};
+
+static struct knowndevtab *volatile knowndevs;
 
-static struct knowndevarray *knowndevs;
+/*
+ * Protects the kd_fs fields against vfs_getroot, which doesn't take
+ * vfs_biglock: it holds this for reading so the filesystem it finds
+ * can't be unmounted while it sleeps in FSOP_GETROOT. Mount and
+ * unmount change kd_fs with it held for writing, and are serialized
+ * by vfs_biglock, so kd_fs can't change under a thread holding that.
+ */
+static struct rwlock *knowndevs_lock;
 
-/* The big lock for all FS ops. Remove for filesystem assignment. */
+/*
+ * The big lock. Filesystems do their own locking now (see sfs.h);
+ * this only serializes mount, unmount, and changing the boot
+ * filesystem, and covers emufs, which still relies on it.
+ */
 static struct lock *vfs_biglock;
 static unsigned vfs_biglock_depth;
 
 
+/*
+ * Allocate a device table with room for NUM entries.
+ */
+static
+struct knowndevtab *
+knowndevtab_create(unsigned num)
+{
+	struct knowndevtab *kt;
+
+	kt = kmalloc(sizeof(*kt) + num * sizeof(struct knowndev *));
+	if (kt == NULL) {
+		return NULL;
+	}
+	kt->kt_num = num;
+	kt->kt_devs = (struct knowndev **)(kt + 1);
+	return kt;
+}
+
+/*
+ * Return entry I of the device table, or NULL if there are only I
+ * entries. Devices added meanwhile may or may not be seen.
+ */
+static
+struct knowndev *
+knowndev_get(unsigned i)
+{
+	struct knowndevtab *kt;
+	struct knowndev *kd;
+
+	rcu_read_lock();
+	kt = knowndevs;
+	kd = i < kt->kt_num ? kt->kt_devs[i] : NULL;
+	rcu_read_unlock();
+	return kd;
+}
+
 /*
  * Setup function
  */
 void
 vfs_bootstrap(void)
 {
-	knowndevs = knowndevarray_create();
+	knowndevs = knowndevtab_create(0);
 	if (knowndevs==NULL) {
-		panic("vfs: Could not create knowndevs array\n");
+		panic("vfs: Could not create knowndevs table\n");
+	}
+
+	knowndevs_lock = rwlock_create_percpu("knowndevs");
+	if (knowndevs_lock==NULL) {
+		panic("vfs: Could not create knowndevs lock\n");
 	}
 
 	vfs_biglock = lock_create("vfs_biglock");
@@ -152,13 +218,11 @@ int
 vfs_sync(void)
 {
 	struct knowndev *dev;
-	unsigned i, num;
+	unsigned i;
 
 	vfs_biglock_acquire();
 
-	num = knowndevarray_num(knowndevs);
-	for (i=0; i<num; i++) {
-		dev = knowndevarray_get(knowndevs, i);
+	for (i=0; (dev = knowndev_get(i)) != NULL; i++) {
 		if (dev->kd_fs != NULL) {
 			/*result =*/ FSOP_SYNC(dev->kd_fs);
 		}
@@ -171,20 +235,16 @@ vfs_sync(void)
 
 /*
  * Given a device name (lhd0, emu0, somevolname, null, etc.), hand
- * back an appropriate vnode.
+ * back an appropriate vnode. Call with knowndevs_lock held.
  */
+static
 int
-vfs_getroot(const char *devname, struct vnode **result)
+dogetroot(const char *devname, struct vnode **result)
 {
 	struct knowndev *kd;
-	unsigned i, num;
-
-	KASSERT(vfs_biglock_do_i_hold());
-
-	num = knowndevarray_num(knowndevs);
-	for (i=0; i<num; i++) {
-		kd = knowndevarray_get(knowndevs, i);
+	unsigned i;
 
+	for (i=0; (kd = knowndev_get(i)) != NULL; i++) {
 		/*
 		 * If this device has a mounted filesystem, and
 		 * DEVNAME names either the filesystem or the device,
@@ -250,35 +310,48 @@ vfs_getroot(const char *devname, struct vnode **result)
 	return ENODEV;
 }
 
+int
+vfs_getroot(const char *devname, struct vnode **result)
+{
+	int err;
+
+	rwlock_acquire_read(knowndevs_lock);
+	err = dogetroot(devname, result);
+	rwlock_release_read(knowndevs_lock);
+	return err;
+}
+
 /*
  * Given a filesystem, hand back the name of the device it's mounted on.
  */
 const char *
 vfs_getdevname(struct fs *fs)
 {
+	struct knowndevtab *kt;
 	struct knowndev *kd;
-	unsigned i, num;
+	const char *name;
+	unsigned i;
 
 	KASSERT(fs != NULL);
 
-	KASSERT(vfs_biglock_do_i_hold());
-
-	num = knowndevarray_num(knowndevs);
-	for (i=0; i<num; i++) {
-		kd = knowndevarray_get(knowndevs, i);
-
+	/*
+	 * This is not a race condition: as long as the guy calling us
+	 * holds a reference to the fs, the fs cannot go away, so the
+	 * kd_fs that matches it can't change either.
+	 */
+	name = NULL;
+	rcu_read_lock();
+	kt = knowndevs;
+	for (i=0; i<kt->kt_num; i++) {
+		kd = kt->kt_devs[i];
 		if (kd->kd_fs == fs) {
-			/*
-			 * This is not a race condition: as long as the
-			 * guy calling us holds a reference to the fs,
-			 * the fs cannot go away, and the device can't
-			 * go away until the fs goes away.
-			 */
-			return kd->kd_name;
+			name = kd->kd_name;
+			break;
 		}
 	}
+	rcu_read_unlock();
 
-	return NULL;
+	return name;
 }
 
 /*
@@ -335,15 +408,12 @@ int
 badnames(const char *n1, const char *n2, const char *n3)
 {
 	const char *volname;
-	unsigned i, num;
+	unsigned i;
 	struct knowndev *kd;
 
 	KASSERT(vfs_biglock_do_i_hold());
 
-	num = knowndevarray_num(knowndevs);
-	for (i=0; i<num; i++) {
-		kd = knowndevarray_get(knowndevs, i);
-
+	for (i=0; (kd = knowndev_get(i)) != NULL; i++) {
 		if (kd->kd_fs) {
 			volname = FSOP_GETVOLNAME(kd->kd_fs);
 			if (samestring3(volname, n1, n2, n3)) {
@@ -374,11 +444,12 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 	char *name=NULL, *rawname=NULL;
 	struct knowndev *kd=NULL;
 	struct vnode *vnode=NULL;
+	struct knowndevtab *oldkt, *newkt=NULL;
 	const char *volname=NULL;
-	unsigned index;
-	int result;
+	unsigned i, index;
 
 	vfs_biglock_acquire();
+	oldkt = knowndevs;
 
 	name = kstrdup(dname);
 	if (name==NULL) {
@@ -401,6 +472,11 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 		goto nomem;
 	}
 
+	newkt = knowndevtab_create(oldkt->kt_num + 1);
+	if (newkt==NULL) {
+		goto nomem;
+	}
+
 	kd->kd_name = name;
 	kd->kd_rawname = rawname;
 	kd->kd_device = dev;
@@ -412,19 +488,27 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 	}
 
 	if (badnames(name, rawname, volname)) {
+		kfree(newkt);
 		vfs_biglock_release();
 		return EEXIST;
 	}
 
-	result = knowndevarray_add(knowndevs, kd, &index);
+	/* Publish the new table; free the old one once nobody sees it. */
+	index = oldkt->kt_num;
+	for (i=0; i<index; i++) {
+		newkt->kt_devs[i] = oldkt->kt_devs[i];
+	}
+	newkt->kt_devs[index] = kd;
+	knowndevs = newkt;
+	call_rcu(&oldkt->kt_rcu, kfree, oldkt);
 
-	if (result == 0 && dev != NULL) {
+	if (dev != NULL) {
 		/* use index+1 as the device number, so 0 is reserved */
 		dev->d_devnumber = index+1;
 	}
 
 	vfs_biglock_release();
-	return result;
+	return 0;
 
  nomem:
 
@@ -440,6 +524,9 @@ vfs_doadd(const char *dname, int mountable, struct device *dev, struct fs *fs)
 	if (kd) {
 		kfree(kd);
 	}
+	if (newkt) {
+		kfree(newkt);
+	}
 	
 	vfs_biglock_release();
 	return ENOMEM;
@@ -470,21 +557,19 @@ vfs_addfs(const char *devname, struct fs *fs)
 
 /*
  * Look for a mountable device named DEVNAME.
- * Should already hold knowndevs_lock.
+ * Should already hold vfs_biglock, so the result's kd_fs stays put.
  */
 static
 int
 findmount(const char *devname, struct knowndev **result)
 {
 	struct knowndev *dev;
-	unsigned i, num;
+	unsigned i;
 	bool found = false;
 
 	KASSERT(vfs_biglock_do_i_hold());
 
-	num = knowndevarray_num(knowndevs);
-	for (i=0; !found && i<num; i++) {
-		dev = knowndevarray_get(knowndevs, i);
+	for (i=0; !found && (dev = knowndev_get(i)) != NULL; i++) {
 		if (dev->kd_rawname==NULL) {
 			/* not mountable/unmountable */
 			continue;
@@ -537,7 +622,9 @@ vfs_mount(const char *devname, void *data,
 
 	KASSERT(fs != NULL);
 
+	rwlock_acquire_write(knowndevs_lock);
 	kd->kd_fs = fs;
+	rwlock_release_write(knowndevs_lock);
 
 	volname = FSOP_GETVOLNAME(fs);
 	kprintf("vfs: Mounted %s: on %s\n",
@@ -571,20 +658,31 @@ vfs_unmount(const char *devname)
 	KASSERT(kd->kd_rawname != NULL);
 	KASSERT(kd->kd_device != NULL);
 
+	/* Cached executables hold vnodes open; let them go. */
+	execcache_flush(kd->kd_fs);
+
 	result = FSOP_SYNC(kd->kd_fs);
 	if (result) {
 		goto fail;
 	}
 
+	/*
+	 * Hold knowndevs_lock for writing across FSOP_UNMOUNT so that
+	 * vfs_getroot, which doesn't take the big lock, can't get at
+	 * the filesystem while it is being torn down.
+	 */
+	rwlock_acquire_write(knowndevs_lock);
 	result = FSOP_UNMOUNT(kd->kd_fs);
 	if (result) {
+		rwlock_release_write(knowndevs_lock);
 		goto fail;
 	}
 
-	kprintf("vfs: Unmounted %s:\n", kd->kd_name);
-
 	/* now drop the filesystem */
 	kd->kd_fs = NULL;
+	rwlock_release_write(knowndevs_lock);
+
+	kprintf("vfs: Unmounted %s:\n", kd->kd_name);
 
 	KASSERT(result==0);
 
@@ -600,14 +698,12 @@ int
 vfs_unmountall(void)
 {
 	struct knowndev *dev;
-	unsigned i, num;
+	unsigned i;
 	int result;
 
 	vfs_biglock_acquire();
 
-	num = knowndevarray_num(knowndevs);
-	for (i=0; i<num; i++) {
-		dev = knowndevarray_get(knowndevs, i);
+	for (i=0; (dev = knowndev_get(i)) != NULL; i++) {
 		if (dev->kd_rawname == NULL) {
 			/* not mountable/unmountable */
 			continue;
@@ -619,6 +715,8 @@ vfs_unmountall(void)
 
 		kprintf("vfs: Unmounting %s:\n", dev->kd_name);
 
+		execcache_flush(dev->kd_fs);
+
 		result = FSOP_SYNC(dev->kd_fs);
 		if (result) {
 			kprintf("vfs: Warning: sync failed for %s: %s, trying "
@@ -633,7 +731,15 @@ vfs_unmountall(void)
 			}
 		}
 
+		/* As in vfs_unmount, keep vfs_getroot out meanwhile */
+		rwlock_acquire_write(knowndevs_lock);
 		result = FSOP_UNMOUNT(dev->kd_fs);
+		if (result == 0) {
+			/* now drop the filesystem */
+			dev->kd_fs = NULL;
+		}
+		rwlock_release_write(knowndevs_lock);
+
 		if (result == EBUSY) {
 			kprintf("vfs: Cannot unmount %s: (busy)\n", 
 				dev->kd_name);
@@ -645,9 +751,6 @@ vfs_unmountall(void)
 				dev->kd_name, strerror(result));
 			continue;
 		}
-
-		/* now drop the filesystem */
-		dev->kd_fs = NULL;
 	}
 
 	vfs_biglock_release();
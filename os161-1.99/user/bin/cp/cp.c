@@ -33,8 +33,14 @@
 /*
  * cp - copy a file.
  * Usage: cp oldfile newfile
+ *
+ * The data is copied by the kernel with copy_file_range, so it never
+ * comes up into our address space.
  */
 
+/* How much to ask copy_file_range for at once. */
+#define COPYCHUNK (1024*1024)
+
 
 /* Copy one file to another. */
 static
@@ -43,8 +49,7 @@ copy(const char *from, const char *to)
 {
 	int fromfd;
 	int tofd;
-	char buf[1024];
-	int len, wr, wrtot;
+	int len;
 
 	/*
 	 * Open the files, and give up if they won't open
@@ -61,28 +66,18 @@ copy(const char *from, const char *to)
 	/*
 	 * As long as we get more than zero bytes, we haven't hit EOF.
 	 * Zero means EOF. Less than zero means an error occurred.
-	 * We may read less than we asked for, though, in various cases
-	 * for various reasons.
+	 * We may get less than we asked for, in various cases for
+	 * various reasons, so just keep going.
 	 */
-	while ((len = read(fromfd, buf, sizeof(buf)))>0) {
-		/*
-		 * Likewise, we may actually write less than we attempted
-		 * to. So loop until we're done.
-		 */
-		wrtot = 0;
-		while (wrtot < len) {
-			wr = write(tofd, buf+wrtot, len-wrtot);
-			if (wr<0) {
-				err(1, "%s", to);
-			}
-			wrtot += wr;
-		}
+	while ((len = copy_file_range(fromfd, NULL, tofd, NULL,
+				      COPYCHUNK, 0))>0) {
+		/* nothing */
 	}
 	/*
-	 * If we got a read error, print it and exit.
+	 * If we got an error, print it and exit.
 	 */
 	if (len<0) {
-		err(1, "%s", from);
+		err(1, "%s to %s", from, to);
 	}
 
 	if (close(fromfd) < 0) {
@@ -37,6 +37,7 @@
 
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <assert.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -71,16 +72,16 @@ static pid_t bgpids[MAXBG];
 
 /*
  * can_bg
- * just checks for an open slot.
+ * just checks for enough open slots for NJOBS processes.
  */
 static
 int
-can_bg(void)
+can_bg(int njobs)
 {
 	int i;
 	
 	for (i = 0; i < MAXBG; i++) {
-		if (bgpids[i] == 0) {
+		if (bgpids[i] == 0 && --njobs == 0) {
 			return 1;
 		}
 	}
@@ -277,6 +278,79 @@ cmd_exit(int ac, char *av[])
 	return 0; /* quell the compiler warning */
 }
 
+static int runcommand(int nargs, char **args);
+
+/*
+ * tvsub
+ * subtract timeval B from timeval A.
+ */
+static
+void
+tvsub(struct timeval *a, const struct timeval *b)
+{
+	a->tv_sec -= b->tv_sec;
+	a->tv_usec -= b->tv_usec;
+	if (a->tv_usec < 0) {
+		a->tv_usec += 1000000;
+		a->tv_sec--;
+	}
+}
+
+/*
+ * time
+ * runs a command and reports the wall-clock time it took and the user and
+ * system time it used.  the latter come from getrusage(RUSAGE_CHILDREN),
+ * which counts children once they have been waited for, so a command put
+ * in the background shows up as using none.
+ */
+static
+int
+cmd_time(int ac, char *av[])
+{
+	struct rusage before, after;
+	struct timeval start, real;
+	time_t startsecs, endsecs;
+	unsigned long startnsecs, endnsecs;
+	int status;
+
+	if (ac < 2) {
+		printf("Usage: time command [args...]\n");
+		return 1;
+	}
+
+	if (getrusage(RUSAGE_CHILDREN, &before) < 0) {
+		warn("getrusage");
+		return 1;
+	}
+	__time(&startsecs, &startnsecs);
+
+	status = runcommand(ac - 1, av + 1);
+
+	__time(&endsecs, &endnsecs);
+	if (getrusage(RUSAGE_CHILDREN, &after) < 0) {
+		warn("getrusage");
+		return status;
+	}
+
+	real.tv_sec = endsecs;
+	real.tv_usec = endnsecs / 1000;
+	start.tv_sec = startsecs;
+	start.tv_usec = startnsecs / 1000;
+	tvsub(&real, &start);
+	tvsub(&after.ru_utime, &before.ru_utime);
+	tvsub(&after.ru_stime, &before.ru_stime);
+
+	warnx("real %lu.%03lu  user %lu.%03lu  sys %lu.%03lu",
+	      (unsigned long) real.tv_sec,
+	      (unsigned long) real.tv_usec / 1000,
+	      (unsigned long) after.ru_utime.tv_sec,
+	      (unsigned long) after.ru_utime.tv_usec / 1000,
+	      (unsigned long) after.ru_stime.tv_sec,
+	      (unsigned long) after.ru_stime.tv_usec / 1000);
+
+	return status;
+}
+
 /*
  * a struct of the builtins associates the builtin name with the function that
  * executes it.  they must all take an argc and argv.
@@ -288,47 +362,28 @@ static struct {
 	{ "cd",    cmd_chdir },
 	{ "chdir", cmd_chdir },
 	{ "exit",  cmd_exit },
+	{ "time",  cmd_time },
 	{ "wait",  cmd_wait },
 	{ NULL, NULL }
 };
 
 /*
- * docommand
- * tokenizes the command line using strtok.  if there aren't any commands,
- * simply returns.  checks to see if it's a builtin, running it if it is.
+ * runcommand
+ * checks to see if the command is a builtin, running it if it is.
  * otherwise, it's a standard command.  check for the '&', try to background
  * the job if possible, otherwise just run it and wait on it.
  */
 static
 int
-docommand(char *buf)
+runcommand(int nargs, char **args)
 {
-	char *args[NARG_MAX + 1];
-	int nargs, i;
-	char *s;
+	int i;
 	pid_t pid;
 	int status;
 	int bg=0;
 	time_t startsecs, endsecs;
 	unsigned long startnsecs, endnsecs;
 
-	nargs = 0;
-	for (s = strtok(buf, " \t\r\n"); s; s = strtok(NULL, " \t\r\n")) {
-		if (nargs >= NARG_MAX) {
-			printf("%s: Too many arguments "
-			       "(exceeds system limit)\n",
-			       args[0]);
-			return 1;
-		}
-		args[nargs++] = s;
-	}
-	args[nargs] = NULL;
-
-	if (nargs==0) {
-		/* empty line */
-		return 0;
-	}
-
 	for (i=0; builtins[i].name; i++) {
 		if (!strcmp(builtins[i].name, args[0])) {
 			return builtins[i].func(nargs, args);
@@ -339,7 +394,7 @@ docommand(char *buf)
 
 	if (nargs > 0 && !strcmp(args[nargs-1], "&")) {
 		/* background */
-		if (!can_bg()) {
+		if (!can_bg(1)) {
 			printf("%s: Too many background jobs; wait for "
 			       "some to finish before starting more\n",
 			       args[0]);
@@ -354,6 +409,7 @@ docommand(char *buf)
 		__time(&startsecs, &startnsecs);
 	}
 
+#ifdef HOST
 	pid = fork();
 	switch (pid) {
 		case -1:
@@ -375,6 +431,18 @@ docommand(char *buf)
 		default:
 			break;
 	}
+#else
+	/*
+	 * Have the kernel build the child straight from the program,
+	 * rather than copying ourselves with fork only to throw the
+	 * copy away in execv.
+	 */
+	pid = spawn(args[0], args);
+	if (pid < 0) {
+		warn("%s", args[0]);
+		return _MKWAIT_EXIT(1);
+	}
+#endif
 
 	/* parent */
 	if (bg) {
@@ -404,6 +472,161 @@ docommand(char *buf)
 	return status;
 }
 
+/*
+ * runpipeline
+ * runs the stages of "a | b | c", each one's standard output feeding
+ * the next one's standard input, and waits for them all. returns the
+ * status of the last stage. if BG is set ("a | b &"), every stage is
+ * put in the background array instead, for "wait" to collect like
+ * any other background job.
+ */
+static
+int
+runpipeline(int nstages, char **stages[], int bg)
+{
+	pid_t pids[NARG_MAX];
+	int fds[2];
+	int infd, status, i, n;
+
+	if (bg && !can_bg(nstages)) {
+		printf("%s: Too many background jobs; wait for "
+		       "some to finish before starting more\n",
+		       stages[0][0]);
+		return -1;
+	}
+
+	infd = -1;
+	for (n = 0; n < nstages; n++) {
+		fds[0] = fds[1] = -1;
+		if (n < nstages - 1 && pipe(fds) < 0) {
+			warn("pipe");
+			break;
+		}
+#ifdef HOST
+		pids[n] = fork();
+#else
+		/* the child only rearranges its descriptors and execs */
+		pids[n] = vfork();
+#endif
+		if (pids[n] < 0) {
+			warn("fork");
+			if (fds[0] >= 0) {
+				close(fds[0]);
+				close(fds[1]);
+			}
+			break;
+		}
+		if (pids[n] == 0) {
+			/* child */
+			if (infd >= 0) {
+				dup2(infd, STDIN_FILENO);
+				close(infd);
+			}
+			if (fds[1] >= 0) {
+				dup2(fds[1], STDOUT_FILENO);
+				close(fds[0]);
+				close(fds[1]);
+			}
+			execv(stages[n][0], stages[n]);
+			warn("%s", stages[n][0]);
+			_exit(1);
+		}
+		/* parent: hand the read end on to the next stage */
+		if (infd >= 0) {
+			close(infd);
+		}
+		if (fds[1] >= 0) {
+			close(fds[1]);
+		}
+		infd = fds[0];
+	}
+	if (infd >= 0) {
+		close(infd);
+	}
+
+	if (bg) {
+		for (i = 0; i < n; i++) {
+			remember_bg(pids[i]);
+		}
+		if (n > 0) {
+			printf("[%d] %s | ... &\n", pids[n-1], stages[0][0]);
+		}
+		return n < nstages ? _MKWAIT_EXIT(1) : 0;
+	}
+
+	status = 0;
+	for (i = 0; i < n; i++) {
+		if (waitpid(pids[i], &status, 0) < 0) {
+			warn("waitpid");
+			status = -1;
+		}
+	}
+	if (n < nstages) {
+		status = _MKWAIT_EXIT(1);
+	}
+	return status;
+}
+
+/*
+ * docommand
+ * tokenizes the command line using strtok.  if there aren't any commands,
+ * simply returns.  if there are pipes, runs the pipeline (in the
+ * background, if it ends in '&'); otherwise runs the command.
+ */
+static
+int
+docommand(char *buf)
+{
+	char *args[NARG_MAX + 1];
+	char **stages[NARG_MAX + 1];
+	int nargs, nstages, i, bg;
+	char *s;
+
+	nargs = 0;
+	for (s = strtok(buf, " \t\r\n"); s; s = strtok(NULL, " \t\r\n")) {
+		if (nargs >= NARG_MAX) {
+			printf("%s: Too many arguments "
+			       "(exceeds system limit)\n",
+			       args[0]);
+			return 1;
+		}
+		args[nargs++] = s;
+	}
+	args[nargs] = NULL;
+
+	if (nargs==0) {
+		/* empty line */
+		return 0;
+	}
+
+	/* split at each "|" */
+	stages[0] = args;
+	nstages = 1;
+	for (i=0; i<nargs; i++) {
+		if (!strcmp(args[i], "|")) {
+			args[i] = NULL;
+			stages[nstages++] = &args[i+1];
+		}
+	}
+	if (nstages > 1) {
+		/* a trailing '&' applies to the whole pipeline */
+		bg = 0;
+		if (args[nargs-1] != NULL && !strcmp(args[nargs-1], "&")) {
+			args[nargs-1] = NULL;
+			bg = 1;
+		}
+		for (i=0; i<nstages; i++) {
+			if (stages[i][0] == NULL) {
+				printf("sh: Missing command in pipeline\n");
+				return 1;
+			}
+		}
+		return runpipeline(nstages, stages, bg);
+	}
+
+	return runcommand(nargs, args);
+}
+
 /*
  * getcmd
  * pulls valid characters off the console, filling the buffer.  
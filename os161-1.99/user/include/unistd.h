@@ -151,9 +151,32 @@ int getdirentry(int filehandle, char *buf, size_t buflen);
 int symlink(const char *target, const char *linkname);
 int readlink(const char *path, char *buf, size_t buflen);
 int dup2(int filehandle, int newhandle);
+int pread(int filehandle, void *buf, size_t size, off_t pos);
+int pwrite(int filehandle, const void *buf, size_t size, off_t pos);
 int pipe(int filehandles[2]);
 time_t __time(time_t *seconds, unsigned long *nanoseconds);
+int nanosleep(const struct timespec *req, struct timespec *rem);
 int __getcwd(char *buf, size_t buflen);
+pid_t vfork(void);
+/*
+ * spawn: run PROG with ARGS in a new child process, as fork plus
+ * execv would, but without copying the parent. Returns the child's
+ * pid; fails without creating a child if PROG cannot be loaded.
+ */
+pid_t spawn(const char *prog, char *const *args);
+/*
+ * copy_file_range: copy up to LEN bytes from INFD to OUTFD inside the
+ * kernel, without passing through a user buffer. Each of INPOS and
+ * OUTPOS, if not NULL, gives the offset to use and is updated, and
+ * the file's own seek position is left alone; if NULL, the file's
+ * seek position is used and advanced. FLAGS must be 0. Returns the
+ * number of bytes copied, which is 0 at end of file.
+ *
+ * sendfile: the same thing, always writing at OUTFD's seek position.
+ */
+int copy_file_range(int infd, off_t *inpos, int outfd, off_t *outpos,
+		    size_t len, unsigned flags);
+int sendfile(int outfd, int infd, off_t *inpos, size_t len);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
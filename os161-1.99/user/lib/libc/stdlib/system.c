@@ -74,7 +74,11 @@ system(const char *cmd)
 
 	argv[nargs] = NULL;
 
-	pid = fork();
+	/*
+	 * The child only execs, so there's no point copying our
+	 * address space for it; vfork lends it ours instead.
+	 */
+	pid = vfork();
 	switch (pid) {
 	    case -1:
 		return -1;
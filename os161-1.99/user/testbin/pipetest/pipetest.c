@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * pipetest - test pipes.
+ *
+ * Checks that a reader sees end of file once the last writer has
+ * gone, that writing with no reader left fails with EPIPE, that
+ * writes of up to PIPE_BUF bytes from several processes are never
+ * interleaved, and that a large write into a reader waiting on an
+ * empty pipe (which the kernel copies straight into the reader's
+ * pages) arrives intact.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <limits.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <err.h>
+
+#define NWRITERS	4
+#define NMSGS		16
+#define BIGSIZE		(16 * 4096 + 123)
+
+/* Odd-sized and misaligned, so the direct copy crosses pages. */
+static char bigbuf[BIGSIZE + 4096];
+
+static
+pid_t
+dofork(void)
+{
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	return pid;
+}
+
+static
+void
+dowait(pid_t pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "pid %d failed", pid);
+	}
+}
+
+static
+void
+dopipe(int fds[2])
+{
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+}
+
+static
+unsigned char
+pattern(size_t i)
+{
+	return (i * 7 + i / 251) & 0xff;
+}
+
+/*
+ * A child writes a message and exits; the parent must read it and
+ * then get end of file, again and again.
+ */
+static
+void
+test_eof(void)
+{
+	static const char msg[] = "hello, pipe";
+	char buf[64];
+	int fds[2];
+	size_t got;
+	ssize_t r;
+	pid_t pid;
+
+	printf("pipetest: eof\n");
+	dopipe(fds);
+	pid = dofork();
+	if (pid == 0) {
+		close(fds[0]);
+		if (write(fds[1], msg, sizeof(msg)) != sizeof(msg)) {
+			err(1, "write");
+		}
+		_exit(0);
+	}
+	close(fds[1]);
+
+	got = 0;
+	while ((r = read(fds[0], buf + got, sizeof(buf) - got)) > 0) {
+		got += r;
+	}
+	if (r < 0) {
+		err(1, "read");
+	}
+	if (got != sizeof(msg) || memcmp(buf, msg, sizeof(msg)) != 0) {
+		errx(1, "eof: got %u bytes, expected %u", got, sizeof(msg));
+	}
+	if (read(fds[0], buf, sizeof(buf)) != 0) {
+		errx(1, "eof: second read did not return end of file");
+	}
+	close(fds[0]);
+	dowait(pid);
+}
+
+/*
+ * With the read end closed, writing must fail with EPIPE.
+ */
+static
+void
+test_epipe(void)
+{
+	int fds[2];
+	char c = 'x';
+
+	printf("pipetest: epipe\n");
+	dopipe(fds);
+	close(fds[0]);
+	if (write(fds[1], &c, 1) >= 0) {
+		errx(1, "epipe: write with no reader succeeded");
+	}
+	if (errno != EPIPE) {
+		err(1, "epipe: write with no reader");
+	}
+	close(fds[1]);
+}
+
+/*
+ * NWRITERS children each write NMSGS messages of PIPE_BUF bytes
+ * filled with their own number. Each message must come out whole.
+ */
+static
+void
+test_atomic(void)
+{
+	static char msg[PIPE_BUF], in[PIPE_BUF];
+	int fds[2], counts[NWRITERS];
+	size_t fill, i;
+	pid_t pids[NWRITERS];
+	ssize_t r;
+	int w, j;
+
+	printf("pipetest: atomic writes\n");
+	dopipe(fds);
+	for (w = 0; w < NWRITERS; w++) {
+		pids[w] = dofork();
+		if (pids[w] == 0) {
+			close(fds[0]);
+			memset(msg, 'a' + w, sizeof(msg));
+			for (j = 0; j < NMSGS; j++) {
+				if (write(fds[1], msg, sizeof(msg))
+				    != sizeof(msg)) {
+					err(1, "write");
+				}
+			}
+			_exit(0);
+		}
+		counts[w] = 0;
+	}
+	close(fds[1]);
+
+	fill = 0;
+	while ((r = read(fds[0], in + fill, sizeof(in) - fill)) > 0) {
+		fill += r;
+		if (fill < sizeof(in)) {
+			continue;
+		}
+		for (i = 1; i < sizeof(in); i++) {
+			if (in[i] != in[0]) {
+				errx(1, "atomic: message interleaved at "
+				     "byte %u ('%c' then '%c')",
+				     i, in[0], in[i]);
+			}
+		}
+		w = in[0] - 'a';
+		if (w < 0 || w >= NWRITERS) {
+			errx(1, "atomic: garbage byte %d", in[0]);
+		}
+		counts[w]++;
+		fill = 0;
+	}
+	if (r < 0) {
+		err(1, "read");
+	}
+	if (fill != 0) {
+		errx(1, "atomic: %u stray bytes at the end", fill);
+	}
+	for (w = 0; w < NWRITERS; w++) {
+		if (counts[w] != NMSGS) {
+			errx(1, "atomic: writer %d: %d messages, expected %d",
+			     w, counts[w], NMSGS);
+		}
+	}
+	close(fds[0]);
+	for (w = 0; w < NWRITERS; w++) {
+		dowait(pids[w]);
+	}
+}
+
+/*
+ * The parent reads into a large buffer while the pipe is empty; the
+ * child, after giving it time to get there, writes BIGSIZE bytes in
+ * one go, which the kernel can copy straight into the parent's
+ * buffer.
+ */
+static
+void
+test_direct(void)
+{
+	struct timespec ts;
+	char *buf = bigbuf + 1;
+	int fds[2];
+	size_t got, i;
+	ssize_t r;
+	pid_t pid;
+
+	printf("pipetest: large writes\n");
+	dopipe(fds);
+	pid = dofork();
+	if (pid == 0) {
+		close(fds[0]);
+		for (i = 0; i < BIGSIZE; i++) {
+			buf[i] = pattern(i);
+		}
+		ts.tv_sec = 0;
+		ts.tv_nsec = 100000000;
+		nanosleep(&ts, NULL);
+		if (write(fds[1], buf, BIGSIZE) != BIGSIZE) {
+			err(1, "write");
+		}
+		_exit(0);
+	}
+	close(fds[1]);
+
+	memset(bigbuf, 0, sizeof(bigbuf));
+	got = 0;
+	while ((r = read(fds[0], buf + got, BIGSIZE - got)) > 0) {
+		got += r;
+	}
+	if (r < 0) {
+		err(1, "read");
+	}
+	if (got != BIGSIZE) {
+		errx(1, "direct: got %u bytes, expected %u", got, BIGSIZE);
+	}
+	for (i = 0; i < BIGSIZE; i++) {
+		if ((unsigned char)buf[i] != pattern(i)) {
+			errx(1, "direct: byte %u is %d, expected %d",
+			     i, (unsigned char)buf[i], pattern(i));
+		}
+	}
+	if (bigbuf[0] != 0 || buf[BIGSIZE] != 0) {
+		errx(1, "direct: wrote outside the buffer");
+	}
+	close(fds[0]);
+	dowait(pid);
+}
+
+int
+main(void)
+{
+	test_eof();
+	test_epipe();
+	test_atomic();
+	test_direct();
+	printf("pipetest: passed\n");
+	return 0;
+}
@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2000, 2001, 2002, 2003, 2004, 2005, 2008, 2009
+ *	The President and Fellows of Harvard College.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the University nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE UNIVERSITY AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE UNIVERSITY OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * polltest - test poll() and select().
+ *
+ * Uses a pipe: checks that the read end is not ready while the pipe
+ * is empty and is once something has been written (including when
+ * the write comes from another process while we wait), that it
+ * reports POLLHUP once the writer has closed, that a closed
+ * descriptor gives POLLNVAL from poll and EBADF from select, and
+ * that zero and finite timeouts behave.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/select.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <err.h>
+
+/* Milliseconds for the finite timeouts. */
+#define TIMEOUT_MS	200
+
+/*
+ * Milliseconds since some fixed point.
+ */
+static
+unsigned long
+now_ms(void)
+{
+	time_t secs;
+	unsigned long nsecs;
+
+	__time(&secs, &nsecs);
+	return secs * 1000 + nsecs / 1000000;
+}
+
+/*
+ * Fork a child that waits a bit and then writes a byte to FD.
+ */
+static
+pid_t
+latewrite(int fd)
+{
+	struct timespec ts;
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0) {
+		err(1, "fork");
+	}
+	if (pid == 0) {
+		ts.tv_sec = 0;
+		ts.tv_nsec = 100000000;
+		nanosleep(&ts, NULL);
+		if (write(fd, "x", 1) != 1) {
+			err(1, "write");
+		}
+		_exit(0);
+	}
+	return pid;
+}
+
+static
+void
+dowait(pid_t pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		errx(1, "pid %d failed", pid);
+	}
+}
+
+/*
+ * Poll FD for EVENTS with TIMEOUT; check the result and revents.
+ */
+static
+void
+checkpoll(const char *what, int fd, int events, int timeout,
+	  int expect, int expectrevents)
+{
+	struct pollfd pfd;
+	int r;
+
+	pfd.fd = fd;
+	pfd.events = events;
+	pfd.revents = -1;
+	r = poll(&pfd, 1, timeout);
+	if (r < 0) {
+		err(1, "poll: %s", what);
+	}
+	if (r != expect || pfd.revents != expectrevents) {
+		errx(1, "poll: %s: returned %d with revents 0x%x, "
+		     "expected %d with 0x%x", what, r, pfd.revents,
+		     expect, expectrevents);
+	}
+}
+
+static
+void
+test_poll(void)
+{
+	struct pollfd pfds[2];
+	unsigned long start, elapsed;
+	int fds[2];
+	char c;
+	pid_t pid;
+
+	printf("polltest: poll\n");
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+
+	checkpoll("empty pipe", fds[0], POLLIN, 0, 0, 0);
+	checkpoll("write end", fds[1], POLLOUT, 0, 1, POLLOUT);
+
+	start = now_ms();
+	checkpoll("finite timeout", fds[0], POLLIN, TIMEOUT_MS, 0, 0);
+	elapsed = now_ms() - start;
+	if (elapsed < TIMEOUT_MS) {
+		errx(1, "poll: timed out after %lu ms, expected %d",
+		     elapsed, TIMEOUT_MS);
+	}
+
+	if (write(fds[1], "x", 1) != 1) {
+		err(1, "write");
+	}
+	checkpoll("after write", fds[0], POLLIN, 0, 1, POLLIN);
+	if (read(fds[0], &c, 1) != 1) {
+		err(1, "read");
+	}
+
+	/* Both ends at once; only the write end is ready. */
+	pfds[0].fd = fds[0];
+	pfds[0].events = POLLIN;
+	pfds[1].fd = fds[1];
+	pfds[1].events = POLLOUT;
+	if (poll(pfds, 2, 0) != 1 || pfds[0].revents != 0 ||
+	    pfds[1].revents != POLLOUT) {
+		errx(1, "poll: both ends: wrong result");
+	}
+
+	/* Wait with no timeout for a write from another process. */
+	pid = latewrite(fds[1]);
+	checkpoll("wakeup", fds[0], POLLIN, -1, 1, POLLIN);
+	if (read(fds[0], &c, 1) != 1) {
+		err(1, "read");
+	}
+	dowait(pid);
+
+	close(fds[1]);
+	checkpoll("writer closed", fds[0], POLLIN, 0, 1, POLLHUP);
+
+	close(fds[0]);
+	checkpoll("closed fd", fds[0], POLLIN, 0, 1, POLLNVAL);
+
+	/* Negative descriptors are ignored. */
+	checkpoll("negative fd", -1, POLLIN, 0, 0, 0);
+}
+
+/*
+ * Select on the read end of a pipe for reading and the write end
+ * for writing; check the result and which bits come back set.
+ */
+static
+void
+checkselect(const char *what, int rfd, int wfd, struct timeval *tv,
+	    int expect, int expectr, int expectw)
+{
+	fd_set rset, wset;
+	int nfds, r;
+
+	FD_ZERO(&rset);
+	FD_ZERO(&wset);
+	nfds = 0;
+	if (rfd >= 0) {
+		FD_SET(rfd, &rset);
+		nfds = rfd + 1;
+	}
+	if (wfd >= 0) {
+		FD_SET(wfd, &wset);
+		if (wfd + 1 > nfds) {
+			nfds = wfd + 1;
+		}
+	}
+	r = select(nfds, &rset, &wset, NULL, tv);
+	if (r < 0) {
+		err(1, "select: %s", what);
+	}
+	if (r != expect ||
+	    (rfd >= 0 && (int)FD_ISSET(rfd, &rset) != expectr) ||
+	    (wfd >= 0 && (int)FD_ISSET(wfd, &wset) != expectw)) {
+		errx(1, "select: %s: wrong result %d", what, r);
+	}
+}
+
+static
+void
+test_select(void)
+{
+	struct timeval tv;
+	unsigned long start, elapsed;
+	fd_set rset;
+	int fds[2];
+	char c;
+	pid_t pid;
+
+	printf("polltest: select\n");
+	if (pipe(fds) < 0) {
+		err(1, "pipe");
+	}
+
+	tv.tv_sec = 0;
+	tv.tv_usec = 0;
+	checkselect("empty pipe", fds[0], -1, &tv, 0, 0, 0);
+	checkselect("write end", -1, fds[1], &tv, 1, 0, 1);
+	checkselect("both ends", fds[0], fds[1], &tv, 1, 0, 1);
+
+	tv.tv_sec = 0;
+	tv.tv_usec = TIMEOUT_MS * 1000;
+	start = now_ms();
+	checkselect("finite timeout", fds[0], -1, &tv, 0, 0, 0);
+	elapsed = now_ms() - start;
+	if (elapsed < TIMEOUT_MS) {
+		errx(1, "select: timed out after %lu ms, expected %d",
+		     elapsed, TIMEOUT_MS);
+	}
+
+	if (write(fds[1], "x", 1) != 1) {
+		err(1, "write");
+	}
+	tv.tv_sec = 0;
+	tv.tv_usec = 0;
+	checkselect("after write", fds[0], -1, &tv, 1, 1, 0);
+	if (read(fds[0], &c, 1) != 1) {
+		err(1, "read");
+	}
+
+	pid = latewrite(fds[1]);
+	checkselect("wakeup", fds[0], -1, NULL, 1, 1, 0);
+	if (read(fds[0], &c, 1) != 1) {
+		err(1, "read");
+	}
+	dowait(pid);
+
+	/* Hung up counts as readable. */
+	close(fds[1]);
+	tv.tv_sec = 0;
+	tv.tv_usec = 0;
+	checkselect("writer closed", fds[0], -1, &tv, 1, 1, 0);
+
+	close(fds[0]);
+	FD_ZERO(&rset);
+	FD_SET(fds[0], &rset);
+	if (select(fds[0] + 1, &rset, NULL, NULL, &tv) >= 0) {
+		errx(1, "select: closed fd: succeeded");
+	}
+	if (errno != EBADF) {
+		err(1, "select: closed fd");
+	}
+}
+
+int
+main(void)
+{
+	test_poll();
+	test_select();
+	printf("polltest: passed\n");
+	return 0;
+}